@@ -5,16 +5,81 @@
 using SyntaxError = yy::parser::syntax_error;
 
 
+void* NodeArena::Allocate(size_t size, size_t alignment)
+{
+    allocations++;
+
+    // nodes are small, anything larger than a block gets memory of its own
+    if (size > block_size)
+    {
+        large.push_back(std::make_unique<char[]>(size));
+        return large.rbegin()->get();
+    }
+
+    used = (used + alignment - 1) / alignment * alignment;
+    if (used + size > block_size)
+    {
+        // move on to the next block, which may be left from before a reset
+        if (block + 1 < blocks.size())
+            block++;
+        else
+        {
+            blocks.push_back(std::make_unique<char[]>(block_size));
+            block = blocks.size() - 1;
+        }
+        used = 0;
+    }
+    void* memory = blocks[block].get() + used;
+    used += size;
+    return memory;
+}
+
+void NodeArena::Reset()
+{
+    block = 0;
+    used = blocks.empty() ? block_size : 0;
+    large.clear();
+    allocations = 0;
+}
+
+
+string OperatorName(Operator op)
+{
+    switch (op)
+    {
+    case Operator::Plus: return "+";
+    case Operator::Minus: return "-";
+    case Operator::Times: return "*";
+    case Operator::Divide: return "/";
+    case Operator::BitAnd: return "&";
+    case Operator::BitOr: return "|";
+    case Operator::BitXor: return "^";
+    case Operator::BitNot: return "~";
+    case Operator::Not: return "!";
+    case Operator::And: return "&&";
+    case Operator::Or: return "||";
+    case Operator::Equal: return "==";
+    case Operator::NotEqual: return "!=";
+    case Operator::Greater: return ">";
+    case Operator::GreaterEqual: return ">=";
+    case Operator::Less: return "<";
+    case Operator::LessEqual: return "<=";
+    }
+    assert(false);
+    return "";
+}
+
+
 bool UnaryValueExpression::Precomputable(int& result)
 {
     int a;
     if (exp->Precomputable(a))
     {
-        if (op == "+")
+        if (op == Operator::Plus)
             result = a;
-        else if (op == "-")
+        else if (op == Operator::Minus)
             result = -a;
-        else if (op == "~")
+        else if (op == Operator::BitNot)
             result = ~a;
         return true;
     }
@@ -27,23 +92,24 @@ bool BinaryValueExpression::Precomputable(int& result)
     int a, b;
     if (exp1->Precomputable(a) && exp2->Precomputable(b))
     {
-        if (op == "+")
+        if (op == Operator::Plus)
             result = a + b;
-        else if (op == "-")
+        else if (op == Operator::Minus)
             result = a - b;
-        else if (op == "*")
+        else if (op == Operator::Times)
             result = a * b;
-        else if (op == "/")
+        else if (op == Operator::Divide)
         {
+            // unsigned, as the code generated for a division that is not folded uses divu
             if (b == 0)
                 return false;
-            result = a / b;
+            result = int(uint32_t(a) / uint32_t(b));
         }
-        else if (op == "&")
+        else if (op == Operator::BitAnd)
             result = a & b;
-        else if (op == "|")
+        else if (op == Operator::BitOr)
             result = a | b;
-        else if (op == "^")
+        else if (op == Operator::BitXor)
             result = a ^ b;
         return true;
     }
@@ -51,6 +117,83 @@ bool BinaryValueExpression::Precomputable(int& result)
 }
 
 
+bool ValueCast::Precomputable(int& result)
+{
+    bool value;
+    if (exp->Precomputable(value))
+    {
+        result = value;
+        return true;
+    }
+    return false;
+}
+
+
+bool BooleanCast::Precomputable(bool& result)
+{
+    int value;
+    if (exp->Precomputable(value))
+    {
+        result = value != 0;
+        return true;
+    }
+    return false;
+}
+
+
+bool UnaryBooleanExpression::Precomputable(bool& result)
+{
+    bool a;
+    if (exp->Precomputable(a))
+    {
+        result = !a;
+        return true;
+    }
+    return false;
+}
+
+
+bool BinaryBooleanExpression::Precomputable(bool& result)
+{
+    // the second operand is not evaluated if the first one decides the result
+    bool a, b;
+    if (!exp1->Precomputable(a))
+        return false;
+    if (op == Operator::And && !a)
+        result = false;
+    else if (op == Operator::Or && a)
+        result = true;
+    else if (exp2->Precomputable(b))
+        result = b;
+    else
+        return false;
+    return true;
+}
+
+
+bool RelationalExpression::Precomputable(bool& result)
+{
+    int a, b;
+    if (exp1->Precomputable(a) && exp2->Precomputable(b))
+    {
+        if (op == Operator::Equal)
+            result = a == b;
+        else if (op == Operator::NotEqual)
+            result = a != b;
+        else if (op == Operator::Greater)
+            result = a > b;
+        else if (op == Operator::GreaterEqual)
+            result = a >= b;
+        else if (op == Operator::Less)
+            result = a < b;
+        else if (op == Operator::LessEqual)
+            result = a <= b;
+        return true;
+    }
+    return false;
+}
+
+
 FunctionCallExpression::FunctionCallExpression(const string& name, const vector<shared_ptr<Expression>>& args, const Location& loc)
     : ValueExpression(loc), name(name)
 {
@@ -127,3 +270,100 @@ FunctionDefinition::FunctionDefinition(const string& name, shared_ptr<SymbolType
             "a function definition cannot have more than 4 input parameters");
 }
 
+shared_ptr<ValueExpression> FunctionDefinition::ReturnedExpression()
+{
+    if (body->statements.size() != 1)
+        return nullptr;
+    auto statement = std::dynamic_pointer_cast<ReturnStatement>(body->statements[0]);
+    return statement == nullptr ? nullptr : statement->exp;
+}
+
+
+void Program::PropagateConstants()
+{
+    // a global assigned anywhere is not a constant
+    set<string> assigned;
+    for (auto d : definitions)
+        if (auto function = std::dynamic_pointer_cast<FunctionDefinition>(d))
+            function->body->Walk([&assigned](Statement& statement) {
+                if (auto assignment = dynamic_cast<AssignmentExpression*>(&statement))
+                    if (auto variable = std::dynamic_pointer_cast<VariableExpression>(assignment->left))
+                        assigned.insert(variable->name);
+            });
+
+    // globals are only visible to the functions defined after them
+    map<string, int> constants;
+    for (auto d : definitions)
+    {
+        if (auto field = std::dynamic_pointer_cast<FieldDefinition>(d))
+        {
+            if (is_value_type(field->type) && assigned.find(field->name) == assigned.end())
+                constants[field->name] = *field->type == *char_type ? field->value & 0xff : field->value;
+        }
+        else if (auto function = std::dynamic_pointer_cast<FunctionDefinition>(d))
+        {
+            // parameters and locals hide globals with the same name
+            set<string> declared;
+            for (auto p : function->params)
+                declared.insert(p->name);
+            function->body->Walk([&declared](Statement& statement) {
+                if (auto declaration = dynamic_cast<VariableDeclaration*>(&statement))
+                    declared.insert(declaration->name);
+            });
+
+            function->body->Walk([&constants, &declared](Statement& statement) {
+                if (auto variable = dynamic_cast<VariableExpression*>(&statement))
+                {
+                    auto constant = constants.find(variable->name);
+                    if (constant != constants.end() && declared.find(variable->name) == declared.end())
+                    {
+                        variable->constant = true;
+                        variable->constant_value = constant->second;
+                    }
+                }
+            });
+        }
+    }
+}
+
+void Program::InlineCalls(size_t limit)
+{
+    if (limit == 0)
+        return;
+
+    map<string, size_t> calls;
+    for (auto d : definitions)
+        if (auto function = std::dynamic_pointer_cast<FunctionDefinition>(d))
+            function->body->Walk([&calls](Statement& statement) {
+                if (auto call = dynamic_cast<FunctionCallExpression*>(&statement))
+                    calls[call->name]++;
+            });
+
+    for (auto d : definitions)
+    {
+        auto function = std::dynamic_pointer_cast<FunctionDefinition>(d);
+        if (function == nullptr || std::dynamic_pointer_cast<MainFunctionDefinition>(d) != nullptr)
+            continue;
+
+        // only functions of values returning a single expression, which are called somewhere
+        auto exp = function->ReturnedExpression();
+        auto count = calls.find(function->name);
+        if (exp == nullptr || count == calls.end() || !is_value_type(function->type)
+            || !std::all_of(function->params.begin(), function->params.end(),
+                [](auto p) { return is_value_type(p->type); }))
+            continue;
+
+        size_t size = 0;
+        bool recursive = false;
+        exp->Walk([&](Statement& statement) {
+            size++;
+            if (auto call = dynamic_cast<FunctionCallExpression*>(&statement))
+                recursive = recursive || call->name == function->name;
+        });
+
+        // every call gets a copy of the expression, a function called once can be larger
+        // as its own code is left out
+        if (!recursive && size <= (count->second == 1 ? 4 * limit : limit))
+            function->inlined = true;
+    }
+}
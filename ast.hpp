@@ -3,19 +3,118 @@
 #include "translation.hpp"
 
 
+// nodes of a tree are carved out of large blocks owned by the arena, which must
+// outlive the tree, freeing a node only runs its destructor
+class NodeArena
+{
+public:
+    NodeArena() {}
+    NodeArena(const NodeArena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment);
+
+    // reuse the blocks for another tree, the nodes of the last one must all be freed
+    void Reset();
+
+    // the number of allocations since the last reset, one for each node
+    size_t Allocations() const { return allocations; }
+
+    // the arena nodes are allocated in by the current thread, nullptr for the heap
+    static inline thread_local NodeArena* current = nullptr;
+
+    // makes an arena the current one for the lifetime of the scope
+    class Scope
+    {
+    public:
+        Scope(NodeArena& arena) : previous(current) { current = &arena; }
+        ~Scope() { current = previous; }
+
+    private:
+        NodeArena* previous;
+    };
+
+    template<typename T>
+    class Allocator
+    {
+    public:
+        using value_type = T;
+
+        Allocator(NodeArena& arena) : arena(&arena) {}
+        template<typename U>
+        Allocator(const Allocator<U>& other) : arena(other.arena) {}
+
+        T* allocate(size_t n) { return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T))); }
+        void deallocate(T*, size_t) {}
+
+        template<typename U>
+        bool operator==(const Allocator<U>& other) const { return arena == other.arena; }
+        template<typename U>
+        bool operator!=(const Allocator<U>& other) const { return arena != other.arena; }
+
+    private:
+        template<typename U>
+        friend class Allocator;
+
+        NodeArena* arena;
+    };
+
+private:
+    static constexpr size_t block_size = 64 * 1024;
+
+    vector<std::unique_ptr<char[]>> blocks;
+    // the block being filled and how much of it is used
+    size_t block = 0;
+    size_t used = block_size;
+    // allocations larger than a block, given back on reset
+    vector<std::unique_ptr<char[]>> large;
+    size_t allocations = 0;
+};
+
+// a node in the current arena, or on the heap if there is none
+template<typename T, typename... Args>
+shared_ptr<T> MakeNode(Args&&... args)
+{
+    if (NodeArena::current != nullptr)
+        return std::allocate_shared<T>(NodeArena::Allocator<T>(*NodeArena::current), std::forward<Args>(args)...);
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+
+enum class Operator
+{
+    Plus, Minus, Times, Divide, BitAnd, BitOr, BitXor, BitNot,
+    Not, And, Or, Equal, NotEqual, Greater, GreaterEqual, Less, LessEqual
+};
+
+// the operator as written in the source
+string OperatorName(Operator op);
+
+
 class Statement
 {
 public:
     Statement(const Location& loc) : location(loc) {}
     virtual ~Statement() {}
 
-    Location location;
+    SourceSpan location;
 
     virtual Code Compile(LocalContext& ctx) { return Code(); }
 
-    virtual string Tree(int indent = 0)
+    // the direct subexpressions and substatements, for passes over the tree
+    virtual vector<shared_ptr<Statement>> Children() { return {}; }
+
+    // visit this statement and then everything below it
+    void Walk(const function<void(Statement&)>& visit)
     {
-        return string(indent, ' ') + "empty statement\n";
+        visit(*this);
+        for (auto child : Children())
+            if (child != nullptr)
+                child->Walk(visit);
+    }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
+    {
+        out << string(indent, ' ') << "empty statement\n";
     };
 };
 
@@ -52,15 +151,28 @@ class BooleanExpression : public Expression
 {
 public:
     BooleanExpression(const Location& loc) : Expression(loc) {}
+
+    virtual bool Precomputable(bool& result)
+    {
+        return false;
+    }
     
     virtual Code Compile(LocalContext& ctx)
     {
         string label = ctx.global_context.NewLabel();
         ExpressionContext inner = ctx;
-        return Evaluate(inner, label, label) + (tab + label + ":\n");
+        return Evaluate(inner, label, label, label) + Instruction::Label(label);
     }
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label) { assert(false); };
+    // jump to true_label or false_label, next_label is the one following the code, which needs no jump
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label = "") { assert(false); };
+
+    // compute the value as 0 or 1 without branches, the symbol is null if this needs them
+    virtual std::pair<Code, shared_ptr<Symbol>> Materialize(ExpressionContext& ctx)
+    {
+        return std::make_pair(Code(), nullptr);
+    }
 };
 
 
@@ -71,21 +183,26 @@ public:
         : ValueExpression(exp->location), exp(exp) {}
     
     shared_ptr<BooleanExpression> exp;
+
+    virtual bool Precomputable(int& result);
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
+    virtual vector<shared_ptr<Statement>> Children() { return { exp }; }
+
     static shared_ptr<ValueExpression> IfNeeded(shared_ptr<Expression> exp)
     {
         if (auto value = std::dynamic_pointer_cast<ValueExpression>(exp))
             return value;
         if (auto boolean = std::dynamic_pointer_cast<BooleanExpression>(exp))
-            return std::make_shared<ValueCast>(boolean);
+            return MakeNode<ValueCast>(boolean);
         assert(false);  // must not happen
     }
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "cast to value\n" + exp->Tree(indent + indent_length);
+        out << string(indent, ' ') << "cast to value\n";
+        exp->Tree(out, indent + indent_length);
     }
 };
 
@@ -97,21 +214,29 @@ public:
         : BooleanExpression(exp->location), exp(exp) {}
     
     shared_ptr<ValueExpression> exp;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label = "");
+
+    virtual std::pair<Code, shared_ptr<Symbol>> Materialize(ExpressionContext& ctx);
+
+    virtual vector<shared_ptr<Statement>> Children() { return { exp }; }
 
     static shared_ptr<BooleanExpression> IfNeeded(shared_ptr<Expression> exp)
     {
         if (auto boolean = std::dynamic_pointer_cast<BooleanExpression>(exp))
             return boolean;
         if (auto value = std::dynamic_pointer_cast<ValueExpression>(exp))
-            return std::make_shared<BooleanCast>(value);
+            return MakeNode<BooleanCast>(value);
         assert(false);  // must not happen
     }
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "cast to bool\n" + exp->Tree(indent + indent_length);
+        out << string(indent, ' ') << "cast to bool\n";
+        exp->Tree(out, indent + indent_length);
     }
 };
 
@@ -119,58 +244,71 @@ public:
 class UnaryValueExpression : public ValueExpression
 {
 public:
-    UnaryValueExpression(const string& op, shared_ptr<Expression> exp, const Location& loc)
+    UnaryValueExpression(Operator op, shared_ptr<Expression> exp, const Location& loc)
         : ValueExpression(loc + exp->location), exp(ValueCast::IfNeeded(exp)), op(op)
     {
-        if (op != "+" && op != "-" && op != "~")
+        if (op != Operator::Plus && op != Operator::Minus && op != Operator::BitNot)
             throw std::domain_error("invalid operator");
     }
 
     shared_ptr<ValueExpression> exp;
-    string op;
+    Operator op;
 
     virtual bool Precomputable(int& result);
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return { exp }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "unary operator " + op + "\n" + exp->Tree(indent + indent_length);
+        out << string(indent, ' ') << "unary operator " << OperatorName(op) << "\n";
+        exp->Tree(out, indent + indent_length);
     }
 
 private:
-    static inline const map<string, string> op_to_instruction = 
-        {{"+", "move"}, {"-", "negu"}, {"~", "not"}};
+    static inline const map<Operator, Opcode> op_to_instruction = 
+        {{Operator::Plus, Opcode::Move}, {Operator::Minus, Opcode::Negu}, {Operator::BitNot, Opcode::Not}};
 };
 
 
 class BinaryValueExpression : public ValueExpression
 {
 public:
-    BinaryValueExpression(const string& op, shared_ptr<Expression> exp1, shared_ptr<Expression> exp2)
+    BinaryValueExpression(Operator op, shared_ptr<Expression> exp1, shared_ptr<Expression> exp2)
         : ValueExpression(exp1->location + exp2->location),
         exp1(ValueCast::IfNeeded(exp1)), exp2(ValueCast::IfNeeded(exp2)), op(op)
     {
-        if (op != "+" && op != "-" && op != "*" && op != "/" && op != "&" && op != "|" && op != "^")
+        if (op != Operator::Plus && op != Operator::Minus && op != Operator::Times && op != Operator::Divide && op != Operator::BitAnd && op != Operator::BitOr && op != Operator::BitXor)
             throw std::domain_error("invalid operator");
     }
 
     shared_ptr<ValueExpression> exp1, exp2;
-    string op;
+    Operator op;
     
     virtual bool Precomputable(int& result);
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return { exp1, exp2 }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "binary operator " + op + "\n" +
-            exp1->Tree(indent + indent_length) + exp2->Tree(indent + indent_length);
+        out << string(indent, ' ') << "binary operator " << OperatorName(op) << "\n";
+        exp1->Tree(out, indent + indent_length);
+        exp2->Tree(out, indent + indent_length);
     }
 
 private:
-    static inline const map<string, string> op_to_instruction = 
-        {{"+", "addu"}, {"-", "subu"}, {"*", "mul"}, {"/", "divu"}, {"&", "and"}, {"|", "or"}, {"^", "xor"}};;
+    static inline const map<Operator, Opcode> op_to_instruction = 
+        {{Operator::Plus, Opcode::Addu}, {Operator::Minus, Opcode::Subu}, {Operator::Times, Opcode::Mul}, {Operator::Divide, Opcode::Divu},
+        {Operator::BitAnd, Opcode::And}, {Operator::BitOr, Opcode::Or}, {Operator::BitXor, Opcode::Xor}};
+
+    // forms taking a 16 bit immediate, Operator::Minus uses addiu with the negated constant
+    static inline const map<Operator, Opcode> op_to_immediate_instruction = 
+        {{Operator::Plus, Opcode::Addiu}, {Operator::BitAnd, Opcode::Andi}, {Operator::BitOr, Opcode::Ori}, {Operator::BitXor, Opcode::Xori}};
+
+    static bool Commutative(Operator op) { return op != Operator::Minus && op != Operator::Divide; }
 };
 
 
@@ -190,9 +328,9 @@ public:
 
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + std::to_string(value) + "\n";
+        out << string(indent, ' ') << value << "\n";
     }
 };
 
@@ -215,7 +353,7 @@ public:
         assert(false); // must not happen
     }
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
         assert(false); // must not happen
     }
@@ -238,6 +376,16 @@ public:
         : LValueExpression(loc), name(name) {}
 
     string name;
+
+    // set by Program::PropagateConstants for globals that are never assigned
+    bool constant = false;
+    int constant_value = 0;
+
+    virtual bool Precomputable(int& result)
+    {
+        result = constant_value;
+        return constant;
+    }
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
     
@@ -247,14 +395,18 @@ public:
         if (!symbol)
             throw CompileError(location, "undefined symbol \"" + name + "\"");
 
+        string reg = value->Register();
+        if (!reg.empty())
+            return symbol->SaveValue(reg);
+
         Code code = value->LoadValue("$v0");
         code += symbol->SaveValue("$v0");
         return code;
     }
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + name + "\n";
+        out << string(indent, ' ') << name << "\n";
     }
 };
 
@@ -277,9 +429,12 @@ private:
         shared_ptr<Symbol> array_symbol, shared_ptr<Symbol> index_symbol);
 
 public:
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return { index }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + name + "[ ]\n" + index->Tree(indent + indent_length);
+        out << string(indent, ' ') << name << "[ ]\n";
+        index->Tree(out, indent + indent_length);
     }
 };
 
@@ -295,10 +450,13 @@ public:
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return { left, exp }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "assignment =\n" +
-            left->Tree(indent + indent_length) + exp->Tree(indent + indent_length);
+        out << string(indent, ' ') << "assignment =\n";
+        left->Tree(out, indent + indent_length);
+        exp->Tree(out, indent + indent_length);
     }
 };
 
@@ -313,13 +471,25 @@ public:
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    // the called function, checked against the arguments
+    shared_ptr<FunctionSymbol> Callee(ExpressionContext& ctx);
+
+    // evaluate the arguments into $a0..$a3
+    Code LoadArguments(ExpressionContext& ctx, FunctionSymbol& callee);
+
+    // evaluate the arguments, checked against the parameters of the callee
+    Code EvaluateArguments(ExpressionContext& ctx, FunctionSymbol& callee, vector<shared_ptr<Symbol>>& symbols);
+
+    // evaluate the expression returned by an inlined callee in place of the call
+    std::pair<Code, shared_ptr<Symbol>> Inline(ExpressionContext& ctx, FunctionSymbol& callee);
+
+    virtual vector<shared_ptr<Statement>> Children() { return { args.begin(), args.end() }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        string str = string(indent, ' ') + "call " + name + "\n";
-        if (args.size() > 0)
-            for (auto a : args)
-                str += a->Tree(indent + indent_length);
-        return str;
+        out << string(indent, ' ') << "call " << name << "\n";
+        for (auto a : args)
+            a->Tree(out, indent + indent_length);
     }
 };
 
@@ -327,21 +497,29 @@ public:
 class UnaryBooleanExpression : public BooleanExpression
 {
 public:
-    UnaryBooleanExpression(const string& op, shared_ptr<Expression> exp, const Location& loc)
+    UnaryBooleanExpression(Operator op, shared_ptr<Expression> exp, const Location& loc)
         : BooleanExpression(loc + exp->location), exp(BooleanCast::IfNeeded(exp)), op(op)
     {
-        if (op != "!")
+        if (op != Operator::Not)
             throw std::domain_error("invalid operator");
     }
 
     shared_ptr<BooleanExpression> exp;
-    string op;
+    Operator op;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label = "");
+
+    virtual std::pair<Code, shared_ptr<Symbol>> Materialize(ExpressionContext& ctx);
+
+    virtual vector<shared_ptr<Statement>> Children() { return { exp }; }
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "unary operator " + op + "\n" + exp->Tree(indent + indent_length);
+        out << string(indent, ' ') << "unary operator " << OperatorName(op) << "\n";
+        exp->Tree(out, indent + indent_length);
     }
 };
 
@@ -349,23 +527,31 @@ public:
 class BinaryBooleanExpression : public BooleanExpression
 {
 public:
-    BinaryBooleanExpression(const string& op, shared_ptr<Expression> exp1, shared_ptr<Expression> exp2)
+    BinaryBooleanExpression(Operator op, shared_ptr<Expression> exp1, shared_ptr<Expression> exp2)
         : BooleanExpression(exp1->location + exp2->location), 
         exp1(BooleanCast::IfNeeded(exp1)), exp2(BooleanCast::IfNeeded(exp2)), op(op)
     {
-        if (op != "&&" && op != "||")
+        if (op != Operator::And && op != Operator::Or)
             throw std::domain_error("invalid operator");
     }
 
     shared_ptr<BooleanExpression> exp1, exp2;
-    string op;
+    Operator op;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label = "");
+
+    virtual std::pair<Code, shared_ptr<Symbol>> Materialize(ExpressionContext& ctx);
+
+    virtual vector<shared_ptr<Statement>> Children() { return { exp1, exp2 }; }
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "binary operator " + op + "\n" +
-            exp1->Tree(indent + indent_length) + exp2->Tree(indent + indent_length);
+        out << string(indent, ' ') << "binary operator " << OperatorName(op) << "\n";
+        exp1->Tree(out, indent + indent_length);
+        exp2->Tree(out, indent + indent_length);
     }
 };
 
@@ -373,28 +559,51 @@ public:
 class RelationalExpression : public BooleanExpression
 {
 public:
-    RelationalExpression(const string& op, shared_ptr<Expression> exp1, shared_ptr<Expression> exp2)
+    RelationalExpression(Operator op, shared_ptr<Expression> exp1, shared_ptr<Expression> exp2)
         : BooleanExpression(exp1->location + exp2->location), 
         exp1(ValueCast::IfNeeded(exp1)), exp2(ValueCast::IfNeeded(exp2)), op(op)
     {
-        if (op != "==" && op != "!=" && op != "<=" && op != ">=" && op != "<" && op != ">")
+        if (op != Operator::Equal && op != Operator::NotEqual && op != Operator::LessEqual && op != Operator::GreaterEqual && op != Operator::Less && op != Operator::Greater)
             throw std::domain_error("invalid operator");
     }
 
     shared_ptr<ValueExpression> exp1, exp2;
-    string op;
+    Operator op;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label = "");
+
+    virtual std::pair<Code, shared_ptr<Symbol>> Materialize(ExpressionContext& ctx);
+
+    virtual vector<shared_ptr<Statement>> Children() { return { exp1, exp2 }; }
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "relational operator " + op + "\n" +
-            exp1->Tree(indent + indent_length) + exp2->Tree(indent + indent_length);
+        out << string(indent, ' ') << "relational operator " << OperatorName(op) << "\n";
+        exp1->Tree(out, indent + indent_length);
+        exp2->Tree(out, indent + indent_length);
     }
 
 private:
-    static inline const map<string, string> op_to_instruction = 
-        {{"==", "beq"}, {"!=", "bne"}, {">", "bgt"}, {">=", "bge"}, {"<", "blt"}, {"<=", "ble"}};;
+    static inline const map<Operator, Opcode> op_to_instruction = 
+        {{Operator::Equal, Opcode::Beq}, {Operator::NotEqual, Opcode::Bne}, {Operator::NotEqual, Opcode::Bne}, {Operator::Greater, Opcode::Bgt}, {Operator::GreaterEqual, Opcode::Bge},
+        {Operator::Less, Opcode::Blt}, {Operator::LessEqual, Opcode::Ble}};
+
+    // branches comparing against zero
+    static inline const map<Operator, Opcode> op_to_zero_instruction = 
+        {{Operator::Equal, Opcode::Beqz}, {Operator::NotEqual, Opcode::Bnez}, {Operator::Greater, Opcode::Bgtz}, {Operator::GreaterEqual, Opcode::Bgez},
+        {Operator::Less, Opcode::Bltz}, {Operator::LessEqual, Opcode::Blez}};
+
+    // the operator testing the opposite, to branch when the comparison is false
+    static inline const map<Operator, Operator> negated_op = 
+        {{Operator::Equal, Operator::NotEqual}, {Operator::NotEqual, Operator::Equal}, {Operator::Greater, Operator::LessEqual}, {Operator::GreaterEqual, Operator::Less}, {Operator::Less, Operator::GreaterEqual}, {Operator::LessEqual, Operator::Greater}};
+
+public:
+    // the operator to use when the operands are swapped
+    static inline const map<Operator, Operator> swapped_op = 
+        {{Operator::Equal, Operator::Equal}, {Operator::NotEqual, Operator::NotEqual}, {Operator::Greater, Operator::Less}, {Operator::GreaterEqual, Operator::LessEqual}, {Operator::Less, Operator::Greater}, {Operator::LessEqual, Operator::GreaterEqual}};
 };
 
 
@@ -409,9 +618,9 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + name + " : " + type->Name() + "\n";
+        out << string(indent, ' ') << name << " : " << type->Name() << "\n";
     }
 };
 
@@ -430,9 +639,9 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "continue\n";
+        out << string(indent, ' ') << "continue\n";
     }
 };
 
@@ -444,9 +653,9 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "break\n";
+        out << string(indent, ' ') << "break\n";
     }
 };
 
@@ -463,10 +672,13 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return { exp }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        return string(indent, ' ') + "return\n" +
-            (exp == nullptr ? "" : exp->Tree(indent + indent_length));
+        out << string(indent, ' ') << "return\n";
+        if (exp != nullptr)
+            exp->Tree(out, indent + indent_length);
     }
 };
 
@@ -498,22 +710,24 @@ public:
         return CompileOnContext(ctx);
     }
 
+    // the code of statements in sequence, up to the first jump, the statements after it
+    // are still compiled for their diagnostics
+    static Code CompileStatements(const vector<shared_ptr<Statement>>& statements, LocalContext& ctx);
+
 private:
     Code CompileOnContext(LocalContext& ctx)
     {
-        Code code;
-        for (auto s : statements)
-            code += s->Compile(ctx);
-        return code;
+        return CompileStatements(statements, ctx);
     }
 
 public:
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return statements; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        string str = string(indent, ' ') + "block\n";
+        out << string(indent, ' ') << "block\n";
         for (auto s : statements)
-            str += s->Tree(indent + indent_length);
-        return str;
+            s->Tree(out, indent + indent_length);
     }
 };
 
@@ -531,16 +745,17 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return { condition, then_block, else_block }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        string str = string(indent, ' ') + "if\n";
-        str += string(indent + indent_length, ' ') + "condition\n";
-        str += condition->Tree(indent + 2 * indent_length);
-        str += string(indent + indent_length, ' ') + "then\n";
-        str += then_block->Tree(indent + 2 * indent_length);
-        str += string(indent + indent_length, ' ') + "else\n";
-        str += else_block->Tree(indent + 2 * indent_length);
-        return str;
+        out << string(indent, ' ') << "if\n";
+        out << string(indent + indent_length, ' ') << "condition\n";
+        condition->Tree(out, indent + 2 * indent_length);
+        out << string(indent + indent_length, ' ') << "then\n";
+        then_block->Tree(out, indent + 2 * indent_length);
+        out << string(indent + indent_length, ' ') << "else\n";
+        else_block->Tree(out, indent + 2 * indent_length);
     }
 };
 
@@ -567,19 +782,29 @@ public:
     
     virtual Code Compile(LocalContext& parent_ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children()
     {
-        string str = string(indent, ' ') + "switch\n";
-        str += string(indent + indent_length, ' ') + "on\n";
-        str += exp->Tree(indent + 2 * indent_length);
+        vector<shared_ptr<Statement>> children = { exp };
+        for (auto& body : case_bodies)
+            children.insert(children.end(), body.begin(), body.end());
+        return children;
+    }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
+    {
+        out << string(indent, ' ') << "switch\n";
+        out << string(indent + indent_length, ' ') << "on\n";
+        exp->Tree(out, indent + 2 * indent_length);
         for (size_t i = 0; i < case_bodies.size(); i++)
         {
-            str += string(indent + indent_length, ' ') +
-                (case_values[i] == nullptr ? "default" : "case " + std::to_string(*case_values[i])) + "\n";
+            out << string(indent + indent_length, ' ');
+            if (case_values[i] == nullptr)
+                out << "default\n";
+            else
+                out << "case " << *case_values[i] << "\n";
             for (size_t j = 0; j < case_bodies[i].size(); j++)
-                str += case_bodies[i][j]->Tree(indent + 2 * indent_length);
+                case_bodies[i][j]->Tree(out, indent + 2 * indent_length);
         }
-        return str;
     }
 };
 
@@ -595,14 +820,15 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children() { return { condition, body }; }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        string str = string(indent, ' ') + "while\n";
-        str += string(indent + indent_length, ' ') + "condition\n";
-        str += condition->Tree(indent + 2 * indent_length);
-        str += string(indent + indent_length, ' ') + "do\n";
-        str += body->Tree(indent + 2 * indent_length);
-        return str;
+        out << string(indent, ' ') << "while\n";
+        out << string(indent + indent_length, ' ') << "condition\n";
+        condition->Tree(out, indent + 2 * indent_length);
+        out << string(indent + indent_length, ' ') << "do\n";
+        body->Tree(out, indent + 2 * indent_length);
     }
 };
 
@@ -623,19 +849,25 @@ public:
 
     virtual Code Compile(LocalContext& parent_ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual vector<shared_ptr<Statement>> Children()
     {
-        string str = string(indent, ' ') + "for\n";
-        str += string(indent + indent_length, ' ') + "init\n";
+        vector<shared_ptr<Statement>> children = initializer;
+        children.insert(children.end(), { condition, step, body });
+        return children;
+    }
+
+    virtual void Tree(std::ostream& out, int indent = 0)
+    {
+        out << string(indent, ' ') << "for\n";
+        out << string(indent + indent_length, ' ') << "init\n";
         for (auto i : initializer)
-            str += i->Tree(indent + 2 * indent_length);
-        str += string(indent + indent_length, ' ') + "condition\n";
-        str += condition->Tree(indent + 2 * indent_length);
-        str += string(indent + indent_length, ' ') + "step\n";
-        str += step->Tree(indent + 2 * indent_length);
-        str += string(indent + indent_length, ' ') + "do\n";
-        str += body->Tree(indent + 2 * indent_length);
-        return str;
+            i->Tree(out, indent + 2 * indent_length);
+        out << string(indent + indent_length, ' ') << "condition\n";
+        condition->Tree(out, indent + 2 * indent_length);
+        out << string(indent + indent_length, ' ') << "step\n";
+        step->Tree(out, indent + 2 * indent_length);
+        out << string(indent + indent_length, ' ') << "do\n";
+        body->Tree(out, indent + 2 * indent_length);
     }
 };
 
@@ -646,11 +878,15 @@ public:
     Definition(const Location& loc) : location(loc) {}
     virtual ~Definition() {}
 
-    Location location;
+    SourceSpan location;
+
+    // declare the global defined, definitions are declared one by one in source order
+    virtual shared_ptr<GlobalSymbol> Declare(GlobalContext& ctx) = 0;
 
-    virtual Code Compile(GlobalContext&) = 0;
+    // once everything is declared, each definition is compiled in a context of its own
+    virtual Module Compile(GlobalContext& ctx) = 0;
 
-    virtual string Tree(int indent = 0) = 0;
+    virtual void Tree(std::ostream& out, int indent = 0) = 0;
 };
 
 
@@ -668,19 +904,20 @@ public:
     int value = 0;
     string literal;
     
-    virtual Code Compile(GlobalContext& ctx);
+    virtual shared_ptr<GlobalSymbol> Declare(GlobalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    virtual Module Compile(GlobalContext& ctx);
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        string str = string(indent, ' ') + "variable " + name + " : " + type->Name();
+        out << string(indent, ' ') << "variable " << name << " : " << type->Name();
         if (has_value)
         {
             if (is_value_type(type))
-                str += " = " + std::to_string(value) + "\n";
+                out << " = " << value << "\n";
             else
-                str += " = \"" + literal + "\"\n";
+                out << " = \"" << literal << "\"\n";
         }
-        return str;
     }
 };
 
@@ -696,22 +933,35 @@ public:
     shared_ptr<SymbolType> type;
     vector<shared_ptr<VariableDeclaration>> params;
     shared_ptr<StatementBlock> body;
+
+    // calls are replaced by the returned expression and the function is left out of the program
+    bool inlined = false;
+
+    // the expression of a body made of a single return statement, nullptr for any other body
+    shared_ptr<ValueExpression> ReturnedExpression();
     
-    virtual Code Compile(GlobalContext& ctx);
+    virtual shared_ptr<GlobalSymbol> Declare(GlobalContext& ctx);
 
-    virtual string Tree(int indent = 0)
+    // the code is taken from the cache if there is one and it has the function already
+    virtual Module Compile(GlobalContext& ctx);
+
+    // the code of the function, its jump tables are left in the context
+    virtual Code Generate(GlobalContext& ctx);
+
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        string str = string(indent, ' ') + "function " + name + " : " + type->Name() + "\n";
+        out << string(indent, ' ') << "function " << name << " : " << type->Name() << "\n";
         if (params.size() > 0)
         {
-            str += string(indent + indent_length, ' ') + "parameters\n";
+            out << string(indent + indent_length, ' ') << "parameters\n";
             for (auto p : params)
-                str += p->Tree(indent + 2 * indent_length);
+                p->Tree(out, indent + 2 * indent_length);
         }
-        str += string(indent + indent_length, ' ') + "body\n";
-        str += body->Tree(indent + 2 * indent_length);
-        return str;
+        out << string(indent + indent_length, ' ') << "body\n";
+        body->Tree(out, indent + 2 * indent_length);
     }
+private:
+    string CacheKey(GlobalContext& ctx);
 };
 
 
@@ -721,7 +971,9 @@ public:
     MainFunctionDefinition(shared_ptr<SymbolType> type, shared_ptr<StatementBlock> body, const Location& loc)
         : FunctionDefinition("main", type, vector<shared_ptr<VariableDeclaration>>(), body, loc) {}
 
-    virtual Code Compile(GlobalContext& ctx);
+    virtual shared_ptr<GlobalSymbol> Declare(GlobalContext& ctx);
+
+    virtual Code Generate(GlobalContext& ctx);
 };
 
 
@@ -733,19 +985,33 @@ public:
 
     vector<shared_ptr<Definition>> definitions;
 
-    Code Compile(function<void(const Location&, const string&, const string&)> printer);
+    Module Compile(function<void(const Location&, const string&, const string&)> printer,
+        const CompileOptions& options = CompileOptions());
+
+    // replace reads of global values that are never assigned with their initial value
+    void PropagateConstants();
+
+    // mark the small functions whose calls are replaced by the expression they return
+    void InlineCalls(size_t limit);
 
-    virtual string Tree(int indent = 0)
+    virtual void Tree(std::ostream& out, int indent = 0)
     {
-        string str = string(indent, ' ') + "program\n";
+        out << string(indent, ' ') << "program\n";
         for (auto d : definitions)
-            str += d->Tree(indent + indent_length);
-        return str;
+            d->Tree(out, indent + indent_length);
     }
 
 private:
     static inline string builtin_filename = "builtin";
     static inline const string& builtin_asm_filename = "builtins.asm";
+    // the same routines collecting output in a buffer, see CompileOptions::buffered_output
+    static inline const string& buffered_builtin_asm_filename = "builtins_buffered.asm";
+
+    // the builtins are the same for every program, so they are made and read once per process
+    static const vector<shared_ptr<FunctionSymbol>>& Builtins();
+    // builtins.asm split at its labels into the label and the assembly up to the next one,
+    // so only the routines a program refers to are linked
+    static const vector<std::pair<string, string>>& BuiltinAssembly(bool buffered_output = false);
 };
 
 
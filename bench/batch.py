@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# check that the memory of the compiler in batch mode does not grow with the number of jobs
+#
+#   batch.py [-bin directory] [-jobs N] [-threads N]
+#
+# a generated program is compiled N and then 4 N times in one -batch run, on several threads,
+# and the peak memory of the longer run may only be a little above that of the shorter one,
+# since the tree of every job and the code of its functions are freed before the next starts
+
+import os
+import sys
+import tempfile
+
+import generate
+
+
+# the peak may grow by this much, for the nodes the threads keep in their own free lists
+slack_kb = 2048
+
+
+# run the compiler on jobs lines of standard input and return its peak resident memory in kilobytes
+def run(compiler, directory, jobs, threads):
+    read, write = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        try:
+            os.chdir(directory)
+            os.close(write)
+            os.dup2(read, 0)
+            devnull = os.open(os.devnull, os.O_RDWR)
+            os.dup2(devnull, 1)
+            os.execv(compiler, [compiler, "-batch", "-j", str(threads)])
+        finally:
+            os._exit(127)
+    os.close(read)
+    with os.fdopen(write, "w") as output:
+        output.write(jobs)
+    _, status, usage = os.wait4(pid, 0)
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        raise RuntimeError("%s -batch failed with status %d" % (compiler, status))
+    return usage.ru_maxrss
+
+
+def main(arguments):
+    directory = os.getcwd()
+    jobs = 50
+    threads = 4
+    i = 0
+    while i < len(arguments):
+        if arguments[i] == "-bin" and i + 1 < len(arguments):
+            directory = os.path.abspath(arguments[i + 1])
+            i += 1
+        elif arguments[i] == "-jobs" and i + 1 < len(arguments) and arguments[i + 1].isdigit():
+            jobs = int(arguments[i + 1])
+            i += 1
+        elif arguments[i] == "-threads" and i + 1 < len(arguments) and arguments[i + 1].isdigit():
+            threads = int(arguments[i + 1])
+            i += 1
+        else:
+            print("Usage: batch.py [-bin directory] [-jobs N] [-threads N]", file=sys.stderr)
+            return 1
+        i += 1
+
+    compiler = os.path.join(directory, "compile")
+    if not os.access(compiler, os.X_OK):
+        print("missing compile in %s, run make compiler first" % directory, file=sys.stderr)
+        return 1
+
+    work = tempfile.mkdtemp(prefix="bench-")
+    source = os.path.join(work, "functions.c")
+    with open(source, "w") as output:
+        output.write(generate.generate("functions", 100))
+    job = "%s %s\n" % (source, os.path.join(work, "functions.asm"))
+
+    short = run(compiler, directory, job * jobs, threads)
+    long = run(compiler, directory, job * jobs * 4, threads)
+    print("%5d jobs %10d KB" % (jobs, short))
+    print("%5d jobs %10d KB" % (jobs * 4, long))
+
+    for name in os.listdir(work):
+        os.remove(os.path.join(work, name))
+    os.rmdir(work)
+
+    if long > short + slack_kb:
+        print("peak memory grew by %d KB over %d more jobs" % (long - short, jobs * 3), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
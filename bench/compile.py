@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+# measure the throughput of the scan, parse and compile binaries on generated programs
+#
+#   compile.py [-scale N] [-bin directory] [-keep directory] [shape ...]
+#
+# the binaries are run from their directory, as the compiler reads builtins.asm from there,
+# each is given the same program and reports its wall time, tokens/s, lines/s and peak memory
+
+import os
+import sys
+import time
+import tempfile
+
+import generate
+
+
+# the sizes at scale 1, chosen so each program takes the compiler around a second
+sizes = {
+    "expressions": 2000,
+    "functions": 4000,
+    "switch": 4000,
+    "strings": 20000,
+    "locals": 1500,
+    "mixed": 1000,
+}
+
+binaries = ["scan", "parse", "compile"]
+
+
+# run a command and return its wall time and peak resident memory in kilobytes
+def run(command, directory):
+    start = time.perf_counter()
+    pid = os.fork()
+    if pid == 0:
+        try:
+            os.chdir(directory)
+            devnull = os.open(os.devnull, os.O_RDWR)
+            for fd in (0, 1):
+                os.dup2(devnull, fd)
+            os.execv(command[0], command)
+        finally:
+            os._exit(127)
+    _, status, usage = os.wait4(pid, 0)
+    seconds = time.perf_counter() - start
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status) != 0:
+        raise RuntimeError("%s failed with status %d" % (" ".join(command), status))
+    return seconds, usage.ru_maxrss
+
+
+def main(arguments):
+    scale = 1.0
+    directory = os.getcwd()
+    keep = None
+    shapes = []
+    i = 0
+    while i < len(arguments):
+        if arguments[i] == "-scale" and i + 1 < len(arguments):
+            scale = float(arguments[i + 1])
+            i += 1
+        elif arguments[i] == "-bin" and i + 1 < len(arguments):
+            directory = os.path.abspath(arguments[i + 1])
+            i += 1
+        elif arguments[i] == "-keep" and i + 1 < len(arguments):
+            keep = os.path.abspath(arguments[i + 1])
+            i += 1
+        elif arguments[i] in sizes:
+            shapes.append(arguments[i])
+        else:
+            print("Usage: compile.py [-scale N] [-bin directory] [-keep directory] [%s ...]"
+                  % "|".join(sizes), file=sys.stderr)
+            return 1
+        i += 1
+    shapes = shapes or list(sizes)
+
+    for binary in binaries:
+        if not os.access(os.path.join(directory, binary), os.X_OK):
+            print("missing %s in %s, run make all first" % (binary, directory), file=sys.stderr)
+            return 1
+
+    work = keep or tempfile.mkdtemp(prefix="bench-")
+    os.makedirs(work, exist_ok=True)
+
+    print("%-12s %8s %9s  %-8s %9s %12s %12s %10s" % (
+        "program", "lines", "tokens", "binary", "seconds", "tokens/s", "lines/s", "peak KB"))
+    for shape in shapes:
+        source = os.path.join(work, shape + ".c")
+        program = generate.generate(shape, max(1, int(sizes[shape] * scale)))
+        with open(source, "w") as output:
+            output.write(program)
+        lines = program.count("\n")
+
+        tokens_file = os.path.join(work, shape + ".tokens")
+        results = {}
+        for binary in binaries:
+            command = [os.path.join(directory, binary), source, "-o", os.path.join(work, shape + ".asm")]
+            # tokens are written once by the scanner for counting and skipped in the other runs
+            command += ["-t", tokens_file] if binary == "scan" else ["-nt", "-a", ""]
+            results[binary] = run(command, directory)
+        with open(tokens_file) as tokens_input:
+            tokens = sum(1 for _ in tokens_input)
+
+        for binary in binaries:
+            seconds, peak = results[binary]
+            print("%-12s %8d %9d  %-8s %9.3f %12.0f %12.0f %10d" % (
+                shape, lines, tokens, binary, seconds, tokens / seconds, lines / seconds, peak))
+
+    if not keep:
+        for name in os.listdir(work):
+            os.remove(os.path.join(work, name))
+        os.rmdir(work)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+# generate large synthetic programs, each stressing one part of the compiler
+#
+#   generate.py <shape> <size> [output]
+#
+# the shapes are
+#   expressions  expressions nested <size> levels deep
+#   functions    <size> functions calling each other
+#   switch       a switch of <size> cases
+#   strings      string literals of <size> characters
+#   locals       blocks declaring <size> locals each
+#   mixed        a bit of everything, <size> times
+
+import sys
+
+
+def expressions(size):
+    # both sides of the operators are nested, so the tree is deep in both directions
+    left = "a"
+    for i in range(size):
+        left = "(%s %s %d)" % (left, "+-*|&^"[i % 6], i % 97 + 1)
+    right = "b"
+    for i in range(size):
+        right = "(%d %s %s)" % (i % 89 + 1, "-+^&|"[i % 5], right)
+    lines = [
+        "int nested(int a, int b)",
+        "<",
+        "    int c = %s." % left,
+        "    if (%s)" % " && ".join("(c != %d || b > %d)" % (i, i) for i in range(min(size, 200))),
+        "        < c = c + %s. >" % right,
+        "    return c.",
+        ">",
+        "",
+        "void main()",
+        "<",
+        "    print_int(nested(read_int(), 2)).",
+        ">",
+    ]
+    return lines
+
+
+def functions(size):
+    lines = []
+    for i in range(size):
+        lines += [
+            "int f%d(int a, int b)" % i,
+            "<",
+            "    int c = a * %d + b." % (i % 13 + 1),
+            "    if (c > %d) < c = c - b. >" % (i * 7 % 1000),
+        ]
+        # every function calls a few of the ones declared before it
+        for callee in (i // 2, i // 3, i - 1):
+            if 0 <= callee < i:
+                lines.append("    c = c + f%d(b, a - %d)." % (callee, callee % 5))
+        lines += ["    return c.", ">", ""]
+    lines += ["void main()", "<", "    print_int(f%d(read_int(), 1))." % (size - 1), ">"]
+    return lines
+
+
+def switch(size):
+    lines = ["int select(int n)", "<", "    int r = 0.", "    switch (n)", "    <"]
+    for i in range(size):
+        # mostly dense cases with a few far apart ones, so both jump tables and searches are made
+        value = i if i % 10 else i * 1000
+        lines += ["        case %d:" % value, "            r = r + %d." % (i * 3 + 1)]
+        if i % 3:
+            lines.append("            break.")
+    lines += [
+        "        default:",
+        "            r = -1.",
+        "    >",
+        "    return r.",
+        ">",
+        "",
+        "void main()",
+        "<",
+        "    print_int(select(read_int())).",
+        ">",
+    ]
+    return lines
+
+
+def strings(size):
+    alphabet = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789,;:!?"
+    lines = []
+    for i in range(16):
+        text = "".join(alphabet[(i + j * 7) % len(alphabet)] for j in range(size))
+        # escapes are broken up evenly through the literal
+        text = "\\n".join(text[k:k + 64] for k in range(0, len(text), 64))
+        lines.append('char s%d[] = "%s".' % (i, text))
+    lines += ["", "void main()", "<"]
+    lines += ["    print_string(s%d)." % i for i in range(16)]
+    lines.append(">")
+    return lines
+
+
+def locals(size):
+    lines = ["int sum(int a)", "<", "    int total = 0."]
+    for block in range(8):
+        lines.append("    <")
+        for i in range(size):
+            lines.append("        int v%d_%d = a + %d." % (block, i, i))
+        lines.append("        total = total + %s." % " + ".join(
+            "v%d_%d" % (block, i) for i in range(0, size, max(1, size // 50))))
+        lines.append("    >")
+    lines += ["    return total.", ">", "", "void main()", "<", "    print_int(sum(read_int())).", ">"]
+    return lines
+
+
+def mixed(size):
+    lines = []
+    for i in range(size):
+        lines += [
+            'char message%d[] = "message number %d\\n".' % (i, i),
+            "int table%d[16]." % i,
+            "",
+            "int g%d(int a, char text[])" % i,
+            "<",
+            "    int i, c = 0.",
+            "    for (i = 0. text[i]. i = i + 1)",
+            "    <",
+            "        switch (text[i])",
+            "        <",
+            "            case 'a': c = c + 1. break.",
+            "            case 'e': c = c + 2. break.",
+            "            case 'o': c = c * 3. break.",
+            "            default: c = c ^ i.",
+            "        >",
+            "    >",
+            "    table%d[a & 15] = ((c + a) * (c - a) / (a + 1)) | (a & 7)." % i,
+            "    while (c > 100 && a > 0) < c = c / 2. a = a - 1. >",
+            "    return c + table%d[0]." % i,
+            ">",
+            "",
+        ]
+    lines += ["void main()", "<", "    int n = read_int(), total = 0."]
+    lines += ["    total = total + g%d(n, message%d)." % (i, i) for i in range(0, size, max(1, size // 100))]
+    lines += ["    print_int(total).", ">"]
+    return lines
+
+
+shapes = {
+    "expressions": expressions,
+    "functions": functions,
+    "switch": switch,
+    "strings": strings,
+    "locals": locals,
+    "mixed": mixed,
+}
+
+
+def generate(shape, size):
+    return "\n".join(shapes[shape](size)) + "\n"
+
+
+if __name__ == "__main__":
+    if len(sys.argv) not in (3, 4) or sys.argv[1] not in shapes:
+        print("Usage: generate.py <%s> <size> [output]" % "|".join(shapes), file=sys.stderr)
+        sys.exit(1)
+    program = generate(sys.argv[1], int(sys.argv[2]))
+    if len(sys.argv) == 4:
+        with open(sys.argv[3], "w") as output:
+            output.write(program)
+    else:
+        sys.stdout.write(program)
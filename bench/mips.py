@@ -0,0 +1,542 @@
+#!/usr/bin/env python3
+# a small simulator of MIPS in the dialect of SPIM, counting what the program executes
+#
+#   mips.py program.asm [-i input | --stdin text] [--stats] [--limit N]
+#
+# it runs the subset of instructions, pseudo instructions, directives and syscalls
+# the compiler and builtins.asm emit, --stats prints the counters to standard error as JSON
+
+import argparse
+import json
+import re
+import sys
+
+TEXT_BASE = 0x00400000
+DATA_BASE = 0x10010000
+STACK_TOP = 0x7FFFEFFC
+
+REGISTERS = {
+    "zero": 0, "at": 1, "v0": 2, "v1": 3, "a0": 4, "a1": 5, "a2": 6, "a3": 7,
+    "t0": 8, "t1": 9, "t2": 10, "t3": 11, "t4": 12, "t5": 13, "t6": 14, "t7": 15,
+    "s0": 16, "s1": 17, "s2": 18, "s3": 19, "s4": 20, "s5": 21, "s6": 22, "s7": 23,
+    "t8": 24, "t9": 25, "k0": 26, "k1": 27, "gp": 28, "sp": 29, "fp": 30, "ra": 31,
+}
+
+LOADS = {"lw", "lb", "lbu", "lh", "lhu"}
+STORES = {"sw", "sb", "sh"}
+BRANCHES = {"beq", "bne", "blt", "ble", "bgt", "bge", "bltu", "bleu", "bgtu", "bgeu",
+            "bltz", "bgez", "bgtz", "blez", "beqz", "bnez"}
+JUMPS = {"b", "j", "jal", "jr", "jalr"}
+
+ESCAPES = {"n": "\n", "t": "\t", "r": "\r", "a": "\a", "b": "\b", "e": "\x1b",
+           "f": "\f", "v": "\v", "0": "\0", "\\": "\\", "'": "'", '"': '"'}
+
+
+class SimulationError(Exception):
+    pass
+
+
+def u32(x):
+    return x & 0xFFFFFFFF
+
+
+def s32(x):
+    x &= 0xFFFFFFFF
+    return x - (1 << 32) if x & 0x80000000 else x
+
+
+def split_operands(text):
+    ops, cur, quote = [], "", False
+    for ch in text:
+        if ch == '"':
+            quote = not quote
+        if ch == "," and not quote:
+            ops.append(cur.strip())
+            cur = ""
+        else:
+            cur += ch
+    if cur.strip():
+        ops.append(cur.strip())
+    return ops
+
+
+def strip_comment(line):
+    quote = False
+    for i, ch in enumerate(line):
+        if ch == '"':
+            quote = not quote
+        elif ch == "#" and not quote:
+            return line[:i]
+    return line
+
+
+def unescape(s):
+    out, i = [], 0
+    while i < len(s):
+        if s[i] == "\\" and i + 1 < len(s):
+            out.append(ESCAPES.get(s[i + 1], s[i + 1]))
+            i += 2
+        else:
+            out.append(s[i])
+            i += 1
+    return "".join(out)
+
+
+class Machine:
+    def __init__(self, source, stdin=""):
+        self.memory = bytearray()
+        self.memory_base = DATA_BASE
+        self.stack = {}
+        self.labels = {}
+        self.text = []      # (mnemonic, operands, source line)
+        self.regs = [0] * 32
+        self.hi = self.lo = 0
+        self.stdin = stdin
+        self.stdout = []
+        self.exit_code = 0
+        self.deferred_words = []
+        self.stats = {"instructions": 0, "loads": 0, "stores": 0, "branches": 0,
+                      "branches_taken": 0, "jumps": 0, "calls": 0, "syscalls": 0,
+                      "max_stack_depth": 0}
+        self.assemble(source)
+
+    # ---------------------------------------------------------------- assembly
+    def assemble(self, source):
+        section = "text"
+        pending = []
+        for number, raw in enumerate(source.splitlines(), 1):
+            line = strip_comment(raw).strip()
+            while True:
+                m = re.match(r"^([\w$.]+):\s*(.*)$", line)
+                if not m:
+                    break
+                pending.append(m.group(1))
+                line = m.group(2).strip()
+            if not line:
+                continue
+            parts = line.split(None, 1)
+            op = parts[0]
+            rest = parts[1] if len(parts) > 1 else ""
+            if op.startswith("."):
+                if op == ".data":
+                    section = "data"
+                elif op == ".text":
+                    section = "text"
+                elif op in (".globl", ".extern"):
+                    pass
+                else:
+                    if section != "data":
+                        raise SimulationError("line %d: data directive in text section" % number)
+                    self.directive(op, rest, pending, number)
+                    pending = []
+                continue
+            if section == "data":
+                raise SimulationError("line %d: instruction in data section" % number)
+            for label in pending:
+                self.define(label, TEXT_BASE + 4 * len(self.text), number)
+            pending = []
+            self.text.append((op, split_operands(rest), number))
+        for label in pending:
+            if section == "text":
+                self.define(label, TEXT_BASE + 4 * len(self.text), 0)
+            else:
+                self.define(label, self.memory_base + len(self.memory), 0)
+
+    def define(self, label, address, number):
+        if label in self.labels:
+            raise SimulationError("line %d: duplicate label %s" % (number, label))
+        self.labels[label] = address
+
+    def directive(self, op, rest, pending, number):
+        def align(n):
+            while len(self.memory) % n:
+                self.memory.append(0)
+        if op == ".align":
+            align(1 << int(rest.split()[0]))
+            for label in pending:
+                self.define(label, self.memory_base + len(self.memory), number)
+            return
+        if op == ".word":
+            align(4)
+        for label in pending:
+            self.define(label, self.memory_base + len(self.memory), number)
+        if op == ".word":
+            for value in split_operands(rest):
+                self.deferred_words.append((len(self.memory), value, number))
+                self.memory.extend(b"\0\0\0\0")
+        elif op == ".byte":
+            for value in split_operands(rest):
+                self.memory.append(int(value, 0) & 0xFF)
+        elif op == ".space":
+            self.memory.extend(b"\0" * int(rest, 0))
+        elif op in (".asciiz", ".ascii"):
+            m = re.match(r'^"(.*)"$', rest.strip())
+            if not m:
+                raise SimulationError("line %d: bad string" % number)
+            data = unescape(m.group(1)).encode("latin-1")
+            self.memory.extend(data)
+            if op == ".asciiz":
+                self.memory.append(0)
+        else:
+            raise SimulationError("line %d: unknown directive %s" % (number, op))
+
+    # ---------------------------------------------------------------- memory
+    def check(self, address, width):
+        if address % width:
+            raise SimulationError("unaligned %d-byte access at 0x%08x" % (width, address))
+
+    def read(self, address, width, signed=False):
+        self.check(address, width)
+        value = 0
+        for i in range(width):
+            value |= self.read_byte(address + i) << (8 * i)
+        if signed and value & (1 << (8 * width - 1)):
+            value -= 1 << (8 * width)
+        return value
+
+    def write(self, address, width, value):
+        self.check(address, width)
+        for i in range(width):
+            self.write_byte(address + i, (value >> (8 * i)) & 0xFF)
+
+    def read_byte(self, address):
+        offset = address - self.memory_base
+        if 0 <= offset < len(self.memory):
+            return self.memory[offset]
+        if address >= 0x7F000000:
+            return self.stack.get(address, 0)
+        raise SimulationError("read from invalid address 0x%08x" % address)
+
+    def write_byte(self, address, value):
+        offset = address - self.memory_base
+        if 0 <= offset < len(self.memory):
+            self.memory[offset] = value
+        elif address >= 0x7F000000:
+            self.stack[address] = value
+        else:
+            raise SimulationError("write to invalid address 0x%08x" % address)
+
+    # ---------------------------------------------------------------- operands
+    def reg(self, name):
+        name = name.strip()
+        if not name.startswith("$"):
+            raise SimulationError("expected register, got %r" % name)
+        key = name[1:]
+        if key.isdigit():
+            return int(key)
+        if key not in REGISTERS:
+            raise SimulationError("unknown register %r" % name)
+        return REGISTERS[key]
+
+    def value(self, text):
+        # the contents of a register or an immediate value
+        text = text.strip()
+        if self.is_register(text):
+            return self.regs[self.reg(text)]
+        return self.immediate(text)
+
+    def immediate(self, text):
+        text = text.strip()
+        if text.startswith("'") and text.endswith("'"):
+            return ord(unescape(text[1:-1]))
+        try:
+            return int(text, 0)
+        except ValueError:
+            pass
+        m = re.match(r"^([\w$.]+)\s*([+-]\s*\w+)?$", text)
+        if m and m.group(1) in self.labels:
+            return self.labels[m.group(1)] + (int(m.group(2).replace(" ", ""), 0) if m.group(2) else 0)
+        raise SimulationError("bad immediate %r" % text)
+
+    def address(self, text):
+        text = text.strip()
+        m = re.match(r"^(.*)\((\$\w+)\)$", text)
+        if m:
+            base = self.regs[self.reg(m.group(2))]
+            offset = m.group(1).strip()
+            return u32(base + (self.immediate(offset) if offset else 0))
+        return u32(self.immediate(text))
+
+    def is_register(self, text):
+        text = text.strip()
+        return text.startswith("$") and (text[1:] in REGISTERS or text[1:].isdigit())
+
+    def set(self, reg, value):
+        if reg:
+            self.regs[reg] = u32(value)
+
+    # ---------------------------------------------------------------- execution
+    def run(self, limit=200_000_000):
+        for offset, value, number in self.deferred_words:
+            v = u32(self.immediate(value))
+            self.memory[offset:offset + 4] = v.to_bytes(4, "little")
+        self.regs[REGISTERS["sp"]] = STACK_TOP
+        self.regs[REGISTERS["gp"]] = 0x10008000
+        pc = TEXT_BASE
+        st = self.stats
+        while True:
+            index = (pc - TEXT_BASE) >> 2
+            if not 0 <= index < len(self.text):
+                raise SimulationError("jump to invalid address 0x%08x" % pc)
+            op, ops, number = self.text[index]
+            st["instructions"] += 1
+            if st["instructions"] > limit:
+                raise SimulationError("instruction limit exceeded")
+            try:
+                target = self.step(op, ops, pc)
+            except SimulationError as e:
+                raise SimulationError("line %d (%s %s): %s" % (number, op, ", ".join(ops), e))
+            if target == "exit":
+                return
+            depth = STACK_TOP - s32(self.regs[29]) if self.regs[29] >= 0x7F000000 else 0
+            if depth > st["max_stack_depth"]:
+                st["max_stack_depth"] = depth
+            pc = target if target is not None else pc + 4
+
+    def step(self, op, ops, pc):
+        r = self.regs
+        st = self.stats
+        if op in LOADS:
+            st["loads"] += 1
+            addr = self.address(ops[1])
+            width = {"lw": 4, "lb": 1, "lbu": 1, "lh": 2, "lhu": 2}[op]
+            self.set(self.reg(ops[0]), self.read(addr, width, op in ("lb", "lh")))
+            return None
+        if op in STORES:
+            st["stores"] += 1
+            addr = self.address(ops[1])
+            width = {"sw": 4, "sb": 1, "sh": 2}[op]
+            self.write(addr, width, r[self.reg(ops[0])])
+            return None
+        if op in BRANCHES:
+            st["branches"] += 1
+            if op in ("bltz", "bgez", "bgtz", "blez", "beqz", "bnez"):
+                a = s32(r[self.reg(ops[0])])
+                taken = {"bltz": a < 0, "bgez": a >= 0, "bgtz": a > 0, "blez": a <= 0,
+                         "beqz": a == 0, "bnez": a != 0}[op]
+                label = ops[1]
+            else:
+                a = r[self.reg(ops[0])]
+                b = u32(self.value(ops[1]))
+                if op.endswith("u"):
+                    x, y = a, b
+                else:
+                    x, y = s32(a), s32(b)
+                base = op[:-1] if op.endswith("u") else op
+                taken = {"beq": x == y, "bne": x != y, "blt": x < y, "ble": x <= y,
+                         "bgt": x > y, "bge": x >= y}[base]
+                label = ops[2]
+            if taken:
+                st["branches_taken"] += 1
+                return self.immediate(label)
+            return None
+        if op in ("b", "j"):
+            st["jumps"] += 1
+            return self.immediate(ops[0])
+        if op == "jal":
+            st["jumps"] += 1
+            st["calls"] += 1
+            r[31] = pc + 4
+            return self.immediate(ops[0])
+        if op == "jr":
+            st["jumps"] += 1
+            return r[self.reg(ops[0])]
+        if op == "jalr":
+            st["jumps"] += 1
+            st["calls"] += 1
+            target = r[self.reg(ops[-1])]
+            r[31 if len(ops) == 1 else self.reg(ops[0])] = pc + 4
+            return target
+        if op == "syscall":
+            st["syscalls"] += 1
+            return self.syscall()
+        if op == "nop":
+            return None
+        if op == "break":
+            raise SimulationError("break instruction")
+
+        d = self.reg(ops[0]) if ops else 0
+        if op == "li":
+            self.set(d, self.immediate(ops[1]))
+        elif op == "la":
+            self.set(d, self.address(ops[1]))
+        elif op == "lui":
+            self.set(d, self.immediate(ops[1]) << 16)
+        elif op == "move":
+            self.set(d, r[self.reg(ops[1])])
+        elif op in ("negu", "neg"):
+            self.set(d, -s32(r[self.reg(ops[1])]))
+        elif op == "not":
+            self.set(d, ~r[self.reg(ops[1])])
+        elif op in ("mfhi", "mflo"):
+            self.set(d, self.hi if op == "mfhi" else self.lo)
+        elif op in ("mult", "multu"):
+            a, b = r[self.reg(ops[0])], r[self.reg(ops[1])]
+            if op == "mult":
+                a, b = s32(a), s32(b)
+            p = a * b
+            self.lo, self.hi = u32(p), u32(p >> 32)
+        elif op in ("div", "divu") and len(ops) == 2:
+            a, b = r[self.reg(ops[0])], r[self.reg(ops[1])]
+            if b != 0:
+                if op == "div":
+                    a, b = s32(a), s32(b)
+                    q = abs(a) // abs(b) * (1 if (a < 0) == (b < 0) else -1)
+                    self.lo, self.hi = u32(q), u32(a - q * b)
+                else:
+                    self.lo, self.hi = a // b, a % b
+        else:
+            a = r[self.reg(ops[1])]
+            b = self.value(ops[2])
+            sa, sb = s32(a), s32(b)
+            ua, ub = u32(a), u32(b)
+            if op in ("addu", "add", "addiu", "addi"):
+                v = sa + sb
+            elif op in ("subu", "sub"):
+                v = sa - sb
+            elif op in ("mul", "mulo"):
+                v = sa * sb
+            elif op == "div":
+                if sb == 0:
+                    raise SimulationError("division by zero")
+                v = abs(sa) // abs(sb) * (1 if (sa < 0) == (sb < 0) else -1)
+            elif op == "divu":
+                if ub == 0:
+                    raise SimulationError("division by zero")
+                v = ua // ub
+            elif op == "rem":
+                if sb == 0:
+                    raise SimulationError("division by zero")
+                q = abs(sa) // abs(sb) * (1 if (sa < 0) == (sb < 0) else -1)
+                v = sa - q * sb
+            elif op == "remu":
+                if ub == 0:
+                    raise SimulationError("division by zero")
+                v = ua % ub
+            elif op in ("and", "andi"):
+                v = ua & ub
+            elif op in ("or", "ori"):
+                v = ua | ub
+            elif op in ("xor", "xori"):
+                v = ua ^ ub
+            elif op == "nor":
+                v = ~(ua | ub)
+            elif op in ("sll", "sllv"):
+                v = ua << (ub & 31)
+            elif op in ("srl", "srlv"):
+                v = ua >> (ub & 31)
+            elif op in ("sra", "srav"):
+                v = sa >> (ub & 31)
+            elif op in ("slt", "slti"):
+                v = int(sa < sb)
+            elif op in ("sltu", "sltiu"):
+                v = int(ua < ub)
+            elif op == "seq":
+                v = int(ua == ub)
+            elif op == "sne":
+                v = int(ua != ub)
+            elif op == "sgt":
+                v = int(sa > sb)
+            elif op == "sge":
+                v = int(sa >= sb)
+            elif op == "sle":
+                v = int(sa <= sb)
+            elif op == "sgtu":
+                v = int(ua > ub)
+            elif op == "sgeu":
+                v = int(ua >= ub)
+            elif op == "sleu":
+                v = int(ua <= ub)
+            else:
+                raise SimulationError("unsupported instruction %s" % op)
+            self.set(d, v)
+        return None
+
+    def syscall(self):
+        r = self.regs
+        code = r[2]
+        if code == 1:
+            self.stdout.append(str(s32(r[4])))
+        elif code == 4:
+            address = r[4]
+            chars = []
+            while True:
+                b = self.read_byte(address)
+                if b == 0:
+                    break
+                chars.append(chr(b))
+                address += 1
+            self.stdout.append("".join(chars))
+        elif code == 11:
+            self.stdout.append(chr(r[4] & 0xFF))
+        elif code == 5:
+            line, self.stdin = self.readline()
+            try:
+                r[2] = u32(int(line.strip() or "0"))
+            except ValueError:
+                r[2] = 0
+        elif code == 8:
+            address, length = r[4], s32(r[5])
+            line, self.stdin = self.readline()
+            data = line[:max(length - 1, 0)]
+            for i, ch in enumerate(data):
+                self.write_byte(address + i, ord(ch))
+            if length > 0:
+                self.write_byte(address + len(data), 0)
+        elif code == 12:
+            if self.stdin:
+                r[2] = ord(self.stdin[0])
+                self.stdin = self.stdin[1:]
+            else:
+                r[2] = 0
+        elif code == 10:
+            self.exit_code = 0
+            return "exit"
+        elif code == 17:
+            self.exit_code = s32(r[4])
+            return "exit"
+        else:
+            raise SimulationError("unsupported syscall %d" % code)
+        return None
+
+    def readline(self):
+        if "\n" in self.stdin:
+            i = self.stdin.index("\n")
+            return self.stdin[:i + 1], self.stdin[i + 1:]
+        return self.stdin, ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description="simulate a MIPS program")
+    parser.add_argument("program", help="assembly file to run")
+    parser.add_argument("-i", "--input", help="file to use as standard input")
+    parser.add_argument("--stdin", help="literal text to use as standard input")
+    parser.add_argument("--stats", action="store_true", help="print counters as JSON to stderr")
+    parser.add_argument("--limit", type=int, default=200_000_000, help="maximum instructions to execute")
+    args = parser.parse_args()
+
+    with open(args.program) as f:
+        source = f.read()
+    stdin = ""
+    if args.input:
+        with open(args.input) as f:
+            stdin = f.read()
+    elif args.stdin is not None:
+        stdin = args.stdin.encode().decode("unicode_escape")
+
+    machine = Machine(source, stdin)
+    try:
+        machine.run(args.limit)
+    except SimulationError as e:
+        sys.stdout.write("".join(machine.stdout))
+        print("simulation error: %s" % e, file=sys.stderr)
+        return 2
+    sys.stdout.write("".join(machine.stdout))
+    sys.stdout.flush()
+    if args.stats:
+        print(json.dumps(machine.stats), file=sys.stderr)
+    return machine.exit_code
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# measure the quality of the generated code by running the programs in bench/programs
+#
+#   runtime.py [-bin directory] [-record] [-flags "compiler flags"] [program ...]
+#
+# each program is compiled, run in the simulator with its .in file as standard input,
+# and its dynamic counts are compared against runtime.json, -record rewrites that baseline
+# an output differing from the one recorded is an error, as the compiler must have a bug
+
+import os
+import sys
+import json
+import shlex
+import tempfile
+import subprocess
+
+import mips
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+programs_directory = os.path.join(here, "programs")
+baseline_file = os.path.join(here, "runtime.json")
+
+counters = ["instructions", "loads", "stores", "branches_taken", "jumps", "max_stack_depth"]
+headings = ["instructions", "loads", "stores", "taken branches", "jumps", "stack bytes"]
+
+
+def simulate(program, stdin):
+    with open(program) as source:
+        machine = mips.Machine(source.read(), stdin)
+    machine.run()
+    return "".join(machine.stdout), machine.stats
+
+
+def main(arguments):
+    directory = os.getcwd()
+    record = False
+    flags = []
+    names = []
+    i = 0
+    while i < len(arguments):
+        if arguments[i] == "-bin" and i + 1 < len(arguments):
+            directory = os.path.abspath(arguments[i + 1])
+            i += 1
+        elif arguments[i] == "-flags" and i + 1 < len(arguments):
+            flags = shlex.split(arguments[i + 1])
+            i += 1
+        elif arguments[i] == "-record":
+            record = True
+        elif not arguments[i].startswith("-"):
+            names.append(arguments[i])
+        else:
+            print("Usage: runtime.py [-bin directory] [-record] [-flags \"compiler flags\"] [program ...]",
+                  file=sys.stderr)
+            return 1
+        i += 1
+    names = names or sorted(name for name in os.listdir(programs_directory) if "." not in name)
+
+    compiler = os.path.join(directory, "compile")
+    if not os.access(compiler, os.X_OK):
+        print("missing compile in %s, run make first" % directory, file=sys.stderr)
+        return 1
+
+    baseline = {}
+    if os.path.exists(baseline_file):
+        with open(baseline_file) as baseline_input:
+            baseline = json.load(baseline_input)
+
+    print("%-12s" % "program" + "".join("%14s %7s" % (heading, "") for heading in headings))
+    failed = False
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="bench-") as work:
+        for name in names:
+            source = os.path.join(programs_directory, name)
+            program = os.path.join(work, name + ".asm")
+            # the compiler reads builtins.asm from its directory, so it is run from there
+            compiled = subprocess.run([compiler, source, "-nt", "-a", "", "-o", program] + flags,
+                                      cwd=directory, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+            if compiled.returncode != 0:
+                print("%-12s failed to compile\n%s" % (name, compiled.stderr), end="")
+                failed = True
+                continue
+
+            stdin = ""
+            if os.path.exists(source + ".in"):
+                with open(source + ".in") as stdin_input:
+                    stdin = stdin_input.read()
+            try:
+                output, stats = simulate(program, stdin)
+            except mips.SimulationError as error:
+                print("%-12s failed to run: %s" % (name, error))
+                failed = True
+                continue
+            results[name] = dict({"output": output}, **{counter: stats[counter] for counter in counters})
+
+            # the change against the baseline is shown in percent after each count
+            old = baseline.get(name)
+            row = "%-12s" % name
+            for counter in counters:
+                if old and old.get(counter):
+                    row += "%13d %+7.1f%%" % (stats[counter], 100.0 * (stats[counter] - old[counter]) / old[counter])
+                else:
+                    row += "%13d %8s" % (stats[counter], "")
+            print(row)
+            if old and not record and old["output"] != output:
+                print("%-12s output differs from the baseline" % name)
+                failed = True
+
+    if record:
+        baseline.update(results)
+        with open(baseline_file, "w") as baseline_output:
+            json.dump(baseline, baseline_output, indent=4, sort_keys=True)
+            baseline_output.write("\n")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
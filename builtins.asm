@@ -1,5 +1,6 @@
 
 # compiler builtin functions, mostly syscall wrappers
+# each label starts a piece linked only into programs referring to it, so no piece falls through to the next
 
 .text
 print_string:
@@ -0,0 +1,160 @@
+
+# compiler builtin functions with buffered output, linked instead of builtins.asm by -buffered-output
+# each label starts a piece linked only into programs referring to it, so no piece falls through to the next
+# the output is collected in $output_buffer and written when it fills up, before reading and on exit,
+# like the unbuffered routines these only touch $v0, the argument registers, hi and lo
+
+.text
+print_string:
+    # $a0 : string address
+    move $a2, $a0
+    lw $a1, $output_length
+    $print_string_next:
+    lbu $a0, 0($a2)
+    beqz $a0, $print_string_done
+    sb $a0, $output_buffer($a1)
+    addiu $a1, $a1, 1
+    addiu $a2, $a2, 1
+    blt $a1, 255, $print_string_next
+    sw $a1, $output_length
+    move $a3, $ra
+    jal $flush_output
+    move $ra, $a3
+    li $a1, 0
+    b $print_string_next
+    $print_string_done:
+    sw $a1, $output_length
+    jr $ra
+
+print_char:
+    # $a0 : character value
+    beqz $a0, $print_char_zero
+    lw $v0, $output_length
+    sb $a0, $output_buffer($v0)
+    addiu $v0, $v0, 1
+    sw $v0, $output_length
+    # flushing returns to the caller
+    bge $v0, 255, $flush_output
+    jr $ra
+    $print_char_zero:
+    # a zero would end the buffer early, so it is written on its own
+    move $a3, $ra
+    jal $flush_output
+    move $ra, $a3
+    li $a0, 0
+    li $v0, 11
+    syscall
+    jr $ra
+
+print_int:
+    # $a0 : integer value
+    # a sign and ten digits must fit in the buffer
+    lw $a1, $output_length
+    ble $a1, 243, $print_int_room
+    move $a2, $a0
+    move $a3, $ra
+    jal $flush_output
+    move $ra, $a3
+    move $a0, $a2
+    li $a1, 0
+    $print_int_room:
+    bgez $a0, $print_int_digits
+    li $v0, 45
+    sb $v0, $output_buffer($a1)
+    addiu $a1, $a1, 1
+    # taken as unsigned from here on, which is right for the smallest integer too
+    negu $a0, $a0
+    $print_int_digits:
+    # find where the last digit goes, then write the digits from there back
+    move $a2, $a0
+    li $v0, 10
+    $print_int_count:
+    addiu $a1, $a1, 1
+    divu $a2, $v0
+    mflo $a2
+    bnez $a2, $print_int_count
+    sw $a1, $output_length
+    $print_int_write:
+    divu $a0, $v0
+    mfhi $a2
+    mflo $a0
+    addiu $a2, $a2, 48
+    addiu $a1, $a1, -1
+    sb $a2, $output_buffer($a1)
+    bnez $a0, $print_int_write
+    jr $ra
+
+
+read_string:
+    # $a0 : input buffer address
+    # $a1 : maximum number of characters to read
+    move $a2, $a0
+    move $a3, $ra
+    jal $flush_output
+    move $ra, $a3
+    move $a0, $a2
+    li $v0, 8
+    syscall
+    jr $ra
+
+read_char:
+    move $a3, $ra
+    jal $flush_output
+    move $ra, $a3
+    li $v0, 12
+    syscall
+    # $v0 contains character read
+    jr $ra
+
+read_int:
+    move $a3, $ra
+    jal $flush_output
+    move $ra, $a3
+    li $v0, 5
+    syscall
+    # $v0 contains integer read
+    jr $ra
+
+
+exit: # terminate without value
+    jal $flush_output
+    li $v0, 10
+    syscall
+
+exit2: # terminate with value
+    # $a0 : termination result
+    move $a2, $a0
+    jal $flush_output
+    move $a0, $a2
+    li $v0, 17
+    syscall
+
+
+$flush_output:
+    # write the buffer and empty it, only touches $v0 and $a0
+    lw $v0, $output_length
+    beqz $v0, $flush_output_done
+    sb $zero, $output_buffer($v0)
+    la $a0, $output_buffer
+    li $v0, 4
+    syscall
+    sw $zero, $output_length
+    $flush_output_done:
+    jr $ra
+
+
+$out_of_bounds_error:
+    la $a0, $out_of_bounds_error_msg
+    jal print_string
+    li $a0, 1
+    j exit2
+
+.data
+$out_of_bounds_error_msg:
+    .asciiz "index out of bounds error!\n"
+
+$output_length:
+    .word 0
+
+$output_buffer:
+    .space 256
@@ -0,0 +1,204 @@
+#include "cache.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <cstring>
+#include <iomanip>
+#include <filesystem>
+#include <random>
+
+
+// entries are binary, fixed size integers in host byte order and strings after their length
+class Writer
+{
+public:
+    Writer(string& buffer) : buffer(buffer) {}
+
+    template<typename T>
+    void Write(T value) { buffer.append(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+    void Write(const string& str)
+    {
+        Write<uint32_t>(str.size());
+        buffer += str;
+    }
+
+private:
+    string& buffer;
+};
+
+class Reader
+{
+public:
+    Reader(const string& buffer) : buffer(buffer) {}
+
+    // false once anything read runs past the end of the buffer
+    template<typename T>
+    bool Read(T& value)
+    {
+        if (position + sizeof(T) > buffer.size())
+            return false;
+        std::memcpy(&value, buffer.data() + position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+    bool Read(string& str)
+    {
+        uint32_t size;
+        if (!Read(size) || position + size > buffer.size())
+            return false;
+        str.assign(buffer, position, size);
+        position += size;
+        return true;
+    }
+
+private:
+    const string& buffer;
+    size_t position = 0;
+};
+
+static void WriteInstruction(Writer& out, const Instruction& instruction)
+{
+    out.Write<uint8_t>(uint8_t(instruction.opcode));
+    out.Write(instruction.text);
+    out.Write<uint8_t>(instruction.operands.size());
+    for (auto& operand : instruction.operands)
+    {
+        out.Write<uint8_t>(uint8_t(operand.kind));
+        out.Write(operand.name);
+        out.Write(operand.base);
+        out.Write<int32_t>(operand.value);
+        out.Write<uint8_t>(operand.frame_relocation);
+    }
+}
+
+static bool ReadInstruction(Reader& in, Instruction& instruction)
+{
+    uint8_t opcode, count;
+    if (!in.Read(opcode) || opcode > uint8_t(Opcode::Syscall))
+        return false;
+    instruction = Instruction(Opcode(opcode));
+    if (!in.Read(instruction.text) || !in.Read(count) || count > OperandList::capacity)
+        return false;
+    for (size_t i = 0; i < count; i++)
+    {
+        Operand operand;
+        uint8_t kind, frame_relocation;
+        int32_t value;
+        if (!in.Read(kind) || kind > uint8_t(Operand::Kind::String) || !in.Read(operand.name)
+            || !in.Read(operand.base) || !in.Read(value) || !in.Read(frame_relocation))
+            return false;
+        operand.kind = Operand::Kind(kind);
+        operand.value = value;
+        operand.frame_relocation = frame_relocation != 0;
+        instruction.operands.push_back(operand);
+    }
+    return true;
+}
+
+
+// 64 bit FNV-1a
+static uint64_t Hash(const string& key, uint64_t seed = 14695981039346656037ull)
+{
+    uint64_t hash = seed;
+    for (unsigned char c : key)
+        hash = (hash ^ c) * 1099511628211ull;
+    return hash;
+}
+
+// a second hash with another seed is kept in the entry, ruling out collisions of the file name
+static uint64_t Check(const string& key)
+{
+    return Hash(key, Hash(key));
+}
+
+string CodeCache::Path(const string& key) const
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << Hash(key) << ".code";
+    return (std::filesystem::path(directory) / name.str()).string();
+}
+
+bool CodeCache::Load(const string& key, Code& code, vector<JumpTable>& jump_tables) const
+{
+    std::ifstream file(Path(key), std::ios::binary);
+    if (!file)
+        return false;
+    string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Reader in(buffer);
+
+    uint64_t check;
+    uint32_t instructions, tables;
+    if (!in.Read(check) || check != Check(key) || !in.Read(instructions))
+        return false;
+
+    Code loaded;
+    for (size_t i = 0; i < instructions; i++)
+    {
+        Instruction instruction(Opcode::Comment);
+        if (!ReadInstruction(in, instruction))
+            return false;
+        loaded += instruction;
+    }
+
+    vector<JumpTable> loaded_tables;
+    if (!in.Read(tables))
+        return false;
+    for (size_t i = 0; i < tables; i++)
+    {
+        JumpTable table;
+        uint32_t targets;
+        if (!in.Read(table.label) || !in.Read(targets))
+            return false;
+        table.targets.resize(targets);
+        for (auto& target : table.targets)
+            if (!in.Read(target))
+                return false;
+        loaded_tables.push_back(std::move(table));
+    }
+
+    code = std::move(loaded);
+    jump_tables = std::move(loaded_tables);
+    return true;
+}
+
+void CodeCache::Store(const string& key, const Code& code, const vector<JumpTable>& jump_tables) const
+{
+    string buffer;
+    Writer out(buffer);
+    uint32_t instructions = 0;
+    for (auto it = code.begin(); it != code.end(); ++it)
+        instructions++;
+    out.Write(Check(key));
+    out.Write(instructions);
+    for (auto& instruction : code)
+        WriteInstruction(out, instruction);
+    out.Write<uint32_t>(jump_tables.size());
+    for (auto& table : jump_tables)
+    {
+        out.Write(table.label);
+        out.Write<uint32_t>(table.targets.size());
+        for (auto& target : table.targets)
+            out.Write(target);
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    string path = Path(key);
+    string temporary = path + "." + std::to_string(std::random_device()()) + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        // the cache only saves time, failing to fill it is not an error
+        if (!file.write(buffer.data(), buffer.size()))
+        {
+            file.close();
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+        std::filesystem::remove(temporary, error);
+}
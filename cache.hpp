@@ -0,0 +1,23 @@
+#pragma once
+
+#include "ir.hpp"
+
+
+// the generated code of functions kept on disk between runs, one file per entry,
+// the key holds everything the code depends on, so an entry never goes stale
+class CodeCache
+{
+public:
+    CodeCache(const string& directory) : directory(directory) {}
+
+    // false if there is no entry for the key or it cannot be read
+    bool Load(const string& key, Code& code, vector<JumpTable>& jump_tables) const;
+
+    // entries are written to a temporary file and renamed, so parallel runs never see half of one
+    void Store(const string& key, const Code& code, const vector<JumpTable>& jump_tables) const;
+
+private:
+    string directory;
+
+    string Path(const string& key) const;
+};
@@ -1,78 +1,617 @@
 #include "ast.hpp"
+#include "cache.hpp"
 
 #include <fstream>
 #include <sstream>
+#include <climits>
+#include <thread>
+#include <atomic>
+#include <tuple>
 
 
+// the register holding the value of symbol, loading it into scratch_reg if it lives in memory
+static string ValueRegister(Code& code, shared_ptr<Symbol> symbol, const string& scratch_reg)
+{
+    string reg = symbol->Register();
+    if (!reg.empty())
+        return reg;
+    code += symbol->LoadValue(scratch_reg);
+    return scratch_reg;
+}
+
+// the register a value should be computed into before saving it to symbol
+static string ResultRegister(shared_ptr<Symbol> symbol, const string& scratch_reg)
+{
+    string reg = symbol->Register();
+    return reg.empty() ? scratch_reg : reg;
+}
+
+// whether an immediate fits the signed or unsigned 16 bit field of an instruction
+static bool FitsImmediate(long long value, bool is_unsigned)
+{
+    if (is_unsigned)
+        return value >= 0 && value <= 0xffff;
+    return value >= -0x8000 && value <= 0x7fff;
+}
+
+
+// the multiplier and shifts computing an unsigned division by a constant as floor(n * multiplier / 2^(32 + shift)),
+// when the multiplier needs 33 bits its top bit is added back, as (t + ((n - t) >> 1)) >> (shift - 1) where
+// t = floor(n * multiplier / 2^32) (Granlund and Montgomery, division by invariant integers using multiplication)
+struct Reciprocal
+{
+    uint32_t multiplier;
+    int shift;
+    bool add;
+};
+
+static Reciprocal UnsignedReciprocal(uint32_t divisor)
+{
+    int log = 0;
+    while ((1ull << log) < divisor)
+        log++;
+
+    // exact for every 32 bit n when the rounding error of the multiplier is at most 2^shift
+    for (int shift = 0; shift <= log && shift < 32; shift++)
+    {
+        uint64_t power = 1ull << (32 + shift);
+        uint64_t multiplier = (power + divisor - 1) / divisor;
+        if (multiplier <= UINT32_MAX && multiplier * divisor - power <= (1ull << shift))
+            return { uint32_t(multiplier), shift, false };
+    }
+    uint64_t multiplier = (((1ull << log) - divisor) << 32) / divisor + 1;
+    return { uint32_t(multiplier), log, true };
+}
+
+// reg = reg1 * constant or reg1 / constant using shifts or a multiplication, false if neither is cheaper
+static bool StrengthReduce(Code& code, Operator op, const string& reg, const string& reg1, int constant)
+{
+    uint32_t value = constant;
+    bool power_of_two = value != 0 && (value & (value - 1)) == 0;
+    int log = 0;
+    while (power_of_two && (1u << log) != value)
+        log++;
+
+    if (op == Operator::Times)
+    {
+        if (value == 1)
+            code += Instruction(Opcode::Move, reg, reg1);
+        else if (power_of_two)
+            code += Instruction(Opcode::Sll, reg, reg1, log);
+        else if (constant == -1)
+            code += Instruction(Opcode::Negu, reg, reg1);
+        else
+            return false;
+        return true;
+    }
+
+    // division is unsigned, as divu is used for it
+    if (op != Operator::Divide || value == 0)
+        return false;
+    if (value == 1)
+        code += Instruction(Opcode::Move, reg, reg1);
+    else if (power_of_two)
+        code += Instruction(Opcode::Srl, reg, reg1, log);
+    else
+    {
+        Reciprocal reciprocal = UnsignedReciprocal(value);
+        code += Instruction(Opcode::Li, "$v1", int(reciprocal.multiplier));
+        code += Instruction(Opcode::Multu, reg1, "$v1");
+        if (reciprocal.add)
+        {
+            code += Instruction(Opcode::Mfhi, "$v1");
+            code += Instruction(Opcode::Subu, reg, reg1, "$v1");
+            code += Instruction(Opcode::Srl, reg, reg, 1);
+            code += Instruction(Opcode::Addu, reg, reg, "$v1");
+            code += Instruction(Opcode::Srl, reg, reg, reciprocal.shift - 1);
+        }
+        else
+        {
+            code += Instruction(Opcode::Mfhi, reg);
+            if (reciprocal.shift > 0)
+                code += Instruction(Opcode::Srl, reg, reg, reciprocal.shift);
+        }
+    }
+    return true;
+}
+
+// a jump to target, unless it is the label right after
+static Code Jump(const string& target, const string& next_label)
+{
+    return target == next_label ? Code() : Code(Instruction(Opcode::B, Operand::Label(target)));
+}
+
+// whether exp can be evaluated even where the program would skip it, i.e. it has no side effects and cannot fail
+static bool SafeToEvaluate(Statement& exp)
+{
+    bool safe = true;
+    exp.Walk([&safe](Statement& s) {
+        int divisor;
+        if (auto binary = dynamic_cast<BinaryValueExpression*>(&s))
+            safe = safe && (binary->op != Operator::Divide || (binary->exp2->Precomputable(divisor) && divisor != 0));
+        else if (!dynamic_cast<ConstantExpression*>(&s) && !dynamic_cast<VariableExpression*>(&s)
+            && !dynamic_cast<UnaryValueExpression*>(&s) && !dynamic_cast<ValueCast*>(&s)
+            && !dynamic_cast<BooleanCast*>(&s) && !dynamic_cast<UnaryBooleanExpression*>(&s)
+            && !dynamic_cast<BinaryBooleanExpression*>(&s) && !dynamic_cast<RelationalExpression*>(&s))
+            safe = false;
+    });
+    return safe;
+}
+
+
+// bounds of variables known at compile time, used to prove array indices are in range
+using Ranges = map<string, std::pair<long long, long long>>;
+
+// whether statement or anything below it assigns the variable name
+static bool Assigns(Statement& statement, const string& name)
+{
+    bool assigns = false;
+    statement.Walk([&assigns, &name](Statement& s) {
+        if (auto assignment = dynamic_cast<AssignmentExpression*>(&s))
+            if (auto variable = std::dynamic_pointer_cast<VariableExpression>(assignment->left))
+                assigns = assigns || variable->name == name;
+    });
+    return assigns;
+}
+
+static void Narrow(Ranges& ranges, const string& name, long long low, long long high)
+{
+    auto& range = ranges.emplace(name, std::make_pair(LLONG_MIN, LLONG_MAX)).first->second;
+    range.first = std::max(range.first, low);
+    range.second = std::min(range.second, high);
+}
+
+// the bounds a condition puts on variables compared against constants when it is true
+static void ConditionRanges(shared_ptr<BooleanExpression> condition, Ranges& ranges)
+{
+    if (auto binary = std::dynamic_pointer_cast<BinaryBooleanExpression>(condition))
+    {
+        if (binary->op == Operator::And)
+        {
+            ConditionRanges(binary->exp1, ranges);
+            ConditionRanges(binary->exp2, ranges);
+        }
+    }
+    else if (auto relational = std::dynamic_pointer_cast<RelationalExpression>(condition))
+    {
+        Operator op = relational->op;
+        int value;
+        auto variable = std::dynamic_pointer_cast<VariableExpression>(relational->exp1);
+        bool constant = relational->exp2->Precomputable(value);
+        if (!variable || variable->constant)
+        {
+            variable = std::dynamic_pointer_cast<VariableExpression>(relational->exp2);
+            constant = relational->exp1->Precomputable(value);
+            op = RelationalExpression::swapped_op.at(op);
+        }
+        if (!variable || variable->constant || !constant)
+            return;
+
+        if (op == Operator::Equal)
+            Narrow(ranges, variable->name, value, value);
+        else if (op == Operator::Less)
+            Narrow(ranges, variable->name, LLONG_MIN, value - 1LL);
+        else if (op == Operator::LessEqual)
+            Narrow(ranges, variable->name, LLONG_MIN, value);
+        else if (op == Operator::Greater)
+            Narrow(ranges, variable->name, value + 1LL, LLONG_MAX);
+        else if (op == Operator::GreaterEqual)
+            Narrow(ranges, variable->name, value, LLONG_MAX);
+    }
+}
+
+// record ranges in ctx for the local variables that none of regions changes
+static void AddRanges(LocalContext& ctx, const Ranges& ranges, const vector<Statement*>& regions)
+{
+    for (auto& [name, range] : ranges)
+    {
+        if (std::any_of(regions.begin(), regions.end(), [&name](auto r) { return Assigns(*r, name); }))
+            continue;
+
+        // globals could be changed by any call
+        auto symbol = ctx[name];
+        if (std::dynamic_pointer_cast<GlobalSymbol>(symbol) || !is_value_type(symbol->type) || range.first > range.second)
+            continue;
+        ctx.ranges[symbol] = std::make_pair(int(std::max<long long>(range.first, INT_MIN)),
+            int(std::min<long long>(range.second, INT_MAX)));
+    }
+}
+
+// the bounds of the value of exp, if known
+static bool IndexRange(shared_ptr<ValueExpression> exp, LocalContext& ctx, long long& low, long long& high)
+{
+    int value;
+    if (exp->Precomputable(value))
+    {
+        low = high = value;
+        return true;
+    }
+
+    if (auto variable = std::dynamic_pointer_cast<VariableExpression>(exp))
+    {
+        int l, h;
+        if (!ctx.KnownRange(ctx[variable->name], l, h))
+            return false;
+        low = l;
+        high = h;
+        return true;
+    }
+
+    if (std::dynamic_pointer_cast<ValueCast>(exp))
+    {
+        low = 0;
+        high = 1;
+        return true;
+    }
+
+    if (auto unary = std::dynamic_pointer_cast<UnaryValueExpression>(exp))
+    {
+        long long l, h;
+        if (unary->op == Operator::BitNot || !IndexRange(unary->exp, ctx, l, h))
+            return false;
+        low = unary->op == Operator::Minus ? -h : l;
+        high = unary->op == Operator::Minus ? -l : h;
+    }
+    else if (auto binary = std::dynamic_pointer_cast<BinaryValueExpression>(exp))
+    {
+        long long l1, h1, l2, h2;
+        if (!IndexRange(binary->exp1, ctx, l1, h1) || !IndexRange(binary->exp2, ctx, l2, h2))
+            return false;
+        if (binary->op == Operator::Plus)
+        {
+            low = l1 + l2;
+            high = h1 + h2;
+        }
+        else if (binary->op == Operator::Minus)
+        {
+            low = l1 - h2;
+            high = h1 - l2;
+        }
+        else if (binary->op == Operator::Times)
+        {
+            auto products = { l1 * l2, l1 * h2, h1 * l2, h1 * h2 };
+            low = std::min(products);
+            high = std::max(products);
+        }
+        else
+            return false;
+    }
+    else
+        return false;
+
+    // the bounds are only valid if the 32 bit arithmetic does not wrap around
+    return low >= INT_MIN && high <= INT_MAX;
+}
+
+// the counter of a loop stepping by a constant from a constant start, e.g. for (i = 0. ... i = i + 1)
+static bool InductionVariable(ForStatement& loop, string& name, int& start, int& step)
+{
+    auto assignment = std::dynamic_pointer_cast<AssignmentExpression>(loop.step);
+    if (!assignment)
+        return false;
+    auto variable = std::dynamic_pointer_cast<VariableExpression>(assignment->left);
+    auto binary = std::dynamic_pointer_cast<BinaryValueExpression>(assignment->exp);
+    if (!variable || !binary || (binary->op != Operator::Plus && binary->op != Operator::Minus))
+        return false;
+    auto operand = std::dynamic_pointer_cast<VariableExpression>(binary->exp1);
+    if (!operand || operand->name != variable->name || !binary->exp2->Precomputable(step)
+        || step == 0 || step == INT_MIN)
+        return false;
+    name = variable->name;
+    if (binary->op == Operator::Minus)
+        step = -step;
+
+    // the last initializer setting the counter must assign a constant
+    for (auto it = loop.initializer.rbegin(); it != loop.initializer.rend(); it++)
+        if (Assigns(**it, name))
+        {
+            auto init = std::dynamic_pointer_cast<AssignmentExpression>(*it);
+            return init && std::dynamic_pointer_cast<VariableExpression>(init->left)
+                && init->exp->Precomputable(start);
+        }
+    return false;
+}
+
+// the parts of a statement run whenever it is, e.g. the condition of an if but not its branches
+static vector<shared_ptr<Statement>> AlwaysRun(Statement& statement)
+{
+    if (auto if_else = dynamic_cast<IfElseStatement*>(&statement))
+        return { if_else->condition };
+    if (auto loop = dynamic_cast<WhileStatement*>(&statement))
+        return { loop->condition };
+    if (auto loop = dynamic_cast<ForStatement*>(&statement))
+    {
+        auto parts = loop->initializer;
+        parts.push_back(loop->condition);
+        return parts;
+    }
+    if (auto switch_statement = dynamic_cast<SwitchStatement*>(&statement))
+        return { switch_statement->exp };
+    if (auto binary = dynamic_cast<BinaryBooleanExpression*>(&statement))
+        return { binary->exp1 };
+    return statement.Children();
+}
+
+// whether every iteration of a loop runs all of its body, which a jump or a call that may
+// end the program prevents, collecting the nodes of the body every iteration reaches
+static bool RunsWholeBody(ForStatement& loop, LocalContext& ctx, set<Statement*>& always)
+{
+    bool whole = true;
+    loop.body->Walk([&](Statement& statement) {
+        if (dynamic_cast<JumpStatement*>(&statement))
+            whole = false;
+        if (auto call = dynamic_cast<FunctionCallExpression*>(&statement))
+        {
+            auto callee = std::dynamic_pointer_cast<FunctionSymbol>(ctx[call->name]);
+            if (!callee || !callee->builtin || call->name == "exit" || call->name == "exit2")
+                whole = false;
+        }
+    });
+
+    function<void(Statement&)> reach = [&](Statement& statement) {
+        always.insert(&statement);
+        for (auto part : AlwaysRun(statement))
+            if (part != nullptr)
+                reach(*part);
+    };
+    reach(*loop.body);
+    return whole;
+}
+
+// check once before a loop like for (i = start. i < n. i = i + 1) that n fits the arrays indexed by i,
+// where n is a local the loop does not change, so the accesses in the body need no checks,
+// only if each of them is made on every iteration, as the check must not reject a program
+// that guards an access or leaves the loop before the index gets too large
+static Code HoistBoundsChecks(ForStatement& loop, LocalContext& ctx, const string& counter, int start, Ranges& ranges)
+{
+    auto relational = std::dynamic_pointer_cast<RelationalExpression>(loop.condition);
+    if (!relational || (relational->op != Operator::Less && relational->op != Operator::LessEqual))
+        return Code();
+    auto variable = std::dynamic_pointer_cast<VariableExpression>(relational->exp1);
+    auto limit = std::dynamic_pointer_cast<VariableExpression>(relational->exp2);
+    if (!variable || !limit || variable->name != counter || limit->name == counter || limit->constant)
+        return Code();
+    if (Assigns(*loop.condition, counter) || Assigns(*loop.body, counter)
+        || Assigns(*loop.condition, limit->name) || Assigns(*loop.body, limit->name) || Assigns(*loop.step, limit->name))
+        return Code();
+    auto limit_symbol = ctx[limit->name];
+    if (std::dynamic_pointer_cast<GlobalSymbol>(limit_symbol) || !is_value_type(limit_symbol->type))
+        return Code();
+
+    set<Statement*> always;
+    if (!RunsWholeBody(loop, ctx, always))
+        return Code();
+
+    // the smallest array indexed by the counter
+    set<string> declared, arrays;
+    size_t size = SIZE_MAX;
+    bool guarded = false;
+    loop.body->Walk([&](Statement& statement) {
+        if (auto declaration = dynamic_cast<VariableDeclaration*>(&statement))
+            declared.insert(declaration->name);
+        if (auto access = dynamic_cast<ArrayAccessExpression*>(&statement))
+        {
+            auto index = std::dynamic_pointer_cast<VariableExpression>(access->index);
+            auto array_symbol = ctx[access->name];
+            if (index && index->name == counter && array_symbol && is_array_type(array_symbol->type))
+            {
+                arrays.insert(access->name);
+                size = std::min(size, as_array_type(array_symbol->type)->size);
+                guarded = guarded || always.find(access) == always.end();
+            }
+        }
+    });
+    if (guarded || size == SIZE_MAX || start < 0 || size_t(start) >= size)
+        return Code();
+
+    // names declared in the body refer to other symbols there
+    arrays.insert(counter);
+    arrays.insert(limit->name);
+    for (auto& name : arrays)
+        if (declared.find(name) != declared.end())
+            return Code();
+
+    int bound = relational->op == Operator::Less ? size : size - 1;
+    string error_label = ctx.global_context.NewLabel();
+    string end_label = ctx.global_context.NewLabel();
+    Code code;
+    code += Instruction::Comment("hoisted array index bounds check");
+    string reg = ValueRegister(code, limit_symbol, "$t0");
+    code += Instruction(Opcode::Bgt, reg, bound, Operand::Label(error_label));
+    code += Instruction(Opcode::B, Operand::Label(end_label));
+    code += Instruction::Label(error_label);
+    code += Instruction(Opcode::Jal, Operand::Label(ctx["$out_of_bounds_error"]->name));
+    code += Instruction::Label(end_label);
+
+    // counting up by one to a limit of at most bound, the counter cannot wrap around
+    Narrow(ranges, counter, start, size - 1);
+    return code;
+}
+
+// the width of the elements of an array or of what a pointer points to
+static size_t ElementWidth(shared_ptr<Symbol> symbol)
+{
+    if (is_array_type(symbol->type))
+        return as_array_type(symbol->type)->underlying_type->Width();
+    return as_pointer_type(symbol->type)->underlying_type->Width();
+}
+
+// in a loop like for (i = start. ... i = i + step) keep the address of array[i] in a register for each
+// array indexed by the counter, so accesses need no scaling or base address, and add the step to it
+// in steps, returns the code setting the registers up and sets count to the registers taken
+static Code ReduceElementPointers(ForStatement& loop, LocalContext& ctx, const string& counter,
+    int start, int step, Code& steps, size_t& count)
+{
+    count = 0;
+    auto counter_symbol = ctx[counter];
+    if (std::dynamic_pointer_cast<GlobalSymbol>(counter_symbol)
+        || Assigns(*loop.condition, counter) || Assigns(*loop.body, counter))
+        return Code();
+
+    vector<string> arrays;
+    auto collect = [&](Statement& statement) {
+        if (auto access = dynamic_cast<ArrayAccessExpression*>(&statement))
+            if (auto index = std::dynamic_pointer_cast<VariableExpression>(access->index))
+                if (index->name == counter && std::find(arrays.begin(), arrays.end(), access->name) == arrays.end())
+                    arrays.push_back(access->name);
+    };
+    loop.condition->Walk(collect);
+    loop.body->Walk(collect);
+
+    FunctionContext& fctx = ctx.function_context;
+    Code code;
+    for (auto& name : arrays)
+    {
+        auto symbol = ctx[name];
+        if (!symbol || (!is_array_type(symbol->type) && !is_pointer_type(symbol->type))
+            || Assigns(*loop.condition, name) || Assigns(*loop.body, name)
+            || fctx.pointer_registers == fctx.max_pointer_registers)
+            continue;
+        long long width = ElementWidth(symbol);
+        if (!FitsImmediate(start * width, false) || !FitsImmediate(step * width, false))
+            continue;
+
+        const string& reg = fctx.temp_registers[fctx.temp_registers.size() - 1 - fctx.pointer_registers];
+        fctx.pointer_registers++;
+        fctx.saved_registers.insert(reg);
+        count++;
+
+        code += is_array_type(symbol->type) ? symbol->LoadAddress(reg) : symbol->LoadValue(reg);
+        if (start != 0)
+            code += Instruction(Opcode::Addiu, reg, reg, int(start * width));
+        steps += Instruction(Opcode::Addiu, reg, reg, int(step * width));
+        ctx.element_pointers[{ symbol.get(), counter_symbol.get() }] = reg;
+    }
+    return code;
+}
+
 std::pair<Code, shared_ptr<Symbol>> ValueCast::Evaluate(ExpressionContext& ctx)
 {
+    int value;
+    if (Precomputable(value))
+        return std::make_pair(Code(), std::make_shared<ConstantSymbol>(value, int_type, location));
+
+    auto materialized = exp->Materialize(ctx);
+    if (materialized.second)
+        return materialized;
+
     string set_label = ctx.local_context.global_context.NewLabel(),
         clear_label = ctx.local_context.global_context.NewLabel(),
         assign_label = ctx.local_context.global_context.NewLabel();
     Code code = exp->Evaluate(ctx, set_label, clear_label);
 
     auto symbol = ctx.NewTemp(exp->location);
-    code += set_label + ":\n";
-    code += tab + "li $v0, 1\n";
-    code += tab + "b " + assign_label + "\n";
-    code += clear_label + ":\n";
-    code += tab + "move $v0, $zero\n";
-    code += assign_label + ":\n";
-    code += symbol->SaveValue("$v0");
-    return std::make_pair(code, symbol);
+    string reg = ResultRegister(symbol, "$v0");
+    code += Instruction::Label(set_label);
+    code += Instruction(Opcode::Li, reg, 1);
+    code += Instruction(Opcode::B, Operand::Label(assign_label));
+    code += Instruction::Label(clear_label);
+    code += Instruction(Opcode::Move, reg, "$zero");
+    code += Instruction::Label(assign_label);
+    code += symbol->SaveValue(reg);
+    return std::make_pair(std::move(code), symbol);
 };
 
-Code BooleanCast::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+Code BooleanCast::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
 {
+    bool value;
+    if (Precomputable(value))
+        return Jump(value ? true_label : false_label, next_label);
+
     ExpressionContext inner = ctx;
     auto [code, symbol] = exp->Evaluate(inner);
 
-    code += symbol->LoadValue("$v0");
-    code += tab + "beq $v0, $zero, " + false_label + "\n";
-    code += tab + "b " + true_label + "\n";
+    string reg = ValueRegister(code, symbol, "$v0");
+    if (true_label == next_label)
+        code += Instruction(Opcode::Beqz, reg, Operand::Label(false_label));
+    else
+    {
+        code += Instruction(Opcode::Bnez, reg, Operand::Label(true_label));
+        code += Jump(false_label, next_label);
+    }
     return code;
 };
 
+std::pair<Code, shared_ptr<Symbol>> BooleanCast::Materialize(ExpressionContext& ctx)
+{
+    ExpressionContext inner = ctx;
+    auto [code, symbol0] = exp->Evaluate(inner);
+
+    auto symbol = ctx.NewTemp(location);
+    string reg0 = ValueRegister(code, symbol0, "$v0");
+    string reg = ResultRegister(symbol, "$v0");
+    code += Instruction(Opcode::Sltu, reg, "$zero", reg0);
+    code += symbol->SaveValue(reg);
+    return std::make_pair(std::move(code), symbol);
+}
+
 std::pair<Code, shared_ptr<Symbol>> UnaryValueExpression::Evaluate(ExpressionContext& ctx)
 {
+    int value;
+    if (Precomputable(value))
+        return std::make_pair(Code(), std::make_shared<ConstantSymbol>(value, int_type, location));
+
     ExpressionContext inner = ctx;
     auto [code, symbol0] = exp->Evaluate(inner);
 
     auto symbol = ctx.NewTemp(location);
 
-    code += symbol0->LoadValue("$v0");
-    code += tab + op_to_instruction.at(op) + " $v0, $v0\n";
-    code += symbol->SaveValue("$v0");
-    return std::make_pair(code, symbol);
+    string reg0 = ValueRegister(code, symbol0, "$v0");
+    string reg = ResultRegister(symbol, "$v0");
+    code += Instruction(op_to_instruction.at(op), reg, reg0);
+    code += symbol->SaveValue(reg);
+    return std::make_pair(std::move(code), symbol);
 }
 
 std::pair<Code, shared_ptr<Symbol>> BinaryValueExpression::Evaluate(ExpressionContext& ctx)
 {
     // warn about division by zero
     int den;
-    if (exp2->Precomputable(den) && den == 0)
+    if (op == Operator::Divide && exp2->Precomputable(den) && den == 0)
         ctx.local_context.global_context.printer(location, "divide by zero", "warning");
 
+    int value;
+    if (Precomputable(value))
+        return std::make_pair(Code(), std::make_shared<ConstantSymbol>(value, int_type, location));
+
     ExpressionContext inner = ctx;
     auto [code1, symbol1] = exp1->Evaluate(inner);
     auto [code2, symbol2] = exp2->Evaluate(inner);
 
     auto symbol = ctx.NewTemp(location);
-    Code code = code1 + code2;
+    Code code = std::move(code1) + std::move(code2);
+
+    // keep a constant operand on the right, where it can become an immediate
+    int constant;
+    if (Commutative(op) && symbol1->Constant(constant) && !symbol2->Constant(constant))
+        std::swap(symbol1, symbol2);
+
+    string reg1 = ValueRegister(code, symbol1, "$v0");
+    string reg = ResultRegister(symbol, "$v0");
+    auto immediate = op_to_immediate_instruction.find(op == Operator::Minus ? Operator::Plus : op);
+    bool use_immediate = false;
+    long long immediate_value = 0;
+    if (symbol2->Constant(constant) && immediate != op_to_immediate_instruction.end())
+    {
+        immediate_value = op == Operator::Minus ? -(long long)constant : constant;
+        use_immediate = FitsImmediate(immediate_value, immediate->second != Opcode::Addiu);
+    }
 
-    code += symbol1->LoadValue("$v0");
-    code += symbol2->LoadValue("$v1");
-    code += tab + op_to_instruction.at(op) + " $v0, $v0, $v1\n";
-    code += symbol->SaveValue("$v0");
-    return std::make_pair(code, symbol);
+    if (use_immediate)
+        code += Instruction(immediate->second, reg, reg1, int(immediate_value));
+    else if (!symbol2->Constant(constant) || !StrengthReduce(code, op, reg, reg1, constant))
+    {
+        string reg2 = ValueRegister(code, symbol2, "$v1");
+        code += Instruction(op_to_instruction.at(op), reg, reg1, reg2);
+    }
+    code += symbol->SaveValue(reg);
+    return std::make_pair(std::move(code), symbol);
 }
 
 std::pair<Code, shared_ptr<Symbol>> ConstantExpression::Evaluate(ExpressionContext& ctx)
 {
-    auto symbol = ctx.NewTemp(location);
-    Code code = tab + "li $v0, " + std::to_string(value) + "\n";
-    code += symbol->SaveValue("$v0");
-    return std::make_pair(code, symbol);
+    return std::make_pair(Code(), std::make_shared<ConstantSymbol>(value, int_type, location));
 }
 
 std::pair<Code, shared_ptr<Symbol>> VariableExpression::Evaluate(ExpressionContext& ctx)
@@ -80,6 +619,8 @@ std::pair<Code, shared_ptr<Symbol>> VariableExpression::Evaluate(ExpressionConte
     auto symbol = ctx.local_context[name];
     if (!symbol)
         throw CompileError(location, "undefined symbol \"" + name + "\"");
+    if (constant)
+        return std::make_pair(Code(), std::make_shared<ConstantSymbol>(constant_value, symbol->type, location));
     return std::make_pair(Code(), symbol);
 }
 
@@ -95,12 +636,20 @@ std::pair<Code, shared_ptr<Symbol>> ArrayAccessExpression::Evaluate(ExpressionCo
     if (is_array_type(symbol->type))
         code += EnsureIndexInRange(ctx, symbol, index_symbol);
 
+    // the index register is clobbered while computing the address, so always copy it
     auto temp = ctx.NewTemp(location);
-    code += index_symbol->LoadValue("$v0");
-    code += symbol->LoadElementValue("$v0", "$v0");
-    code += temp->SaveValue("$v0");
+    string reg = ResultRegister(temp, "$v0");
+    string pointer = ctx.local_context.ElementPointer(symbol, index_symbol);
+    if (!pointer.empty())
+        code += Instruction(ElementWidth(symbol) == 1 ? Opcode::Lb : Opcode::Lw, reg, Operand::Memory(pointer));
+    else
+    {
+        code += index_symbol->LoadValue("$v0");
+        code += symbol->LoadElementValue("$v0", reg);
+    }
+    code += temp->SaveValue(reg);
     
-    return std::make_pair(code, temp);
+    return std::make_pair(std::move(code), temp);
 }
 
 Code ArrayAccessExpression::Assign(ExpressionContext& ctx, shared_ptr<Symbol> value)
@@ -114,9 +663,15 @@ Code ArrayAccessExpression::Assign(ExpressionContext& ctx, shared_ptr<Symbol> va
     if (is_array_type(symbol->type))
         code += EnsureIndexInRange(ctx, symbol, index_symbol);
 
-    code += value->LoadValue("$v0");
-    code += index_symbol->LoadValue("$v1");
-    code += symbol->SaveElementValue("$v1", "$v0");
+    string reg = ValueRegister(code, value, "$v0");
+    string pointer = ctx.local_context.ElementPointer(symbol, index_symbol);
+    if (!pointer.empty())
+        code += Instruction(ElementWidth(symbol) == 1 ? Opcode::Sb : Opcode::Sw, reg, Operand::Memory(pointer));
+    else
+    {
+        code += index_symbol->LoadValue("$v1");
+        code += symbol->SaveElementValue("$v1", reg);
+    }
     return code;
 }
 
@@ -130,18 +685,23 @@ Code ArrayAccessExpression::EnsureIndexInRange(ExpressionContext& ctx,
     if (index->Precomputable(index_value) && (index_value < 0 || index_value >= int(array_type->size)))
         throw CompileError(location, "array index is out of bounds");
 
+    // proven in range, e.g. a loop counter or an index guarded by a comparison
+    long long low, high;
+    if (IndexRange(index, ctx.local_context, low, high) && low >= 0 && high < (long long)array_type->size)
+        return Code();
+
     // runtime check (might consider changing to a break instruction)
     string error_label = ctx.local_context.global_context.NewLabel();
     string end_label = ctx.local_context.global_context.NewLabel();
     Code code;
-    code += tab + "# runtime array index bounds check\n";
-    code += index_symbol->LoadValue("$t0");
-    code += tab + "bltz $t0, " + error_label + "\n";
-    code += tab + "bgeu $t0, " + std::to_string(array_type->size) + ", " + error_label + "\n";
-    code += tab + "b " + end_label + "\n";
-    code += error_label + ":\n";
-    code += tab + "jal " + ctx.local_context["$out_of_bounds_error"]->name + "\n";
-    code += end_label + ":\n";
+    code += Instruction::Comment("runtime array index bounds check");
+    string reg = ValueRegister(code, index_symbol, "$t0");
+    code += Instruction(Opcode::Bltz, reg, Operand::Label(error_label));
+    code += Instruction(Opcode::Bgeu, reg, int(array_type->size), Operand::Label(error_label));
+    code += Instruction(Opcode::B, Operand::Label(end_label));
+    code += Instruction::Label(error_label);
+    code += Instruction(Opcode::Jal, Operand::Label(ctx.local_context["$out_of_bounds_error"]->name));
+    code += Instruction::Label(end_label);
     return code;
 }
 
@@ -155,11 +715,11 @@ std::pair<Code, shared_ptr<Symbol>> AssignmentExpression::Evaluate(ExpressionCon
     // auto symbol = ctx.NewTemp(location);
     // code += value->LoadValue("$v0");
     // code += symbol->SaveValue("$v0");
-    // return std::make_pair(code, symbol);
-    return std::make_pair(code, value);
+    // return std::make_pair(std::move(code), symbol);
+    return std::make_pair(std::move(code), value);
 }
 
-std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionContext& ctx)
+shared_ptr<FunctionSymbol> FunctionCallExpression::Callee(ExpressionContext& ctx)
 {
     auto symbol = ctx.local_context[name];
     if (!symbol)
@@ -172,33 +732,147 @@ std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionC
     if (function_symbol->param_types.size() != args.size())
         throw CompileError(location, "incorrect number of arguments");
 
-    ExpressionContext inner = ctx;
-    vector<shared_ptr<Symbol>> symbols;
-    Code code;
+    return function_symbol;
+}
 
+Code FunctionCallExpression::EvaluateArguments(ExpressionContext& ctx, FunctionSymbol& callee,
+    vector<shared_ptr<Symbol>>& symbols)
+{
+    Code code;
     for (size_t i = 0; i < args.size(); i++)
     {
-        auto [c, s] = args[i]->Evaluate(inner);
+        auto [c, s] = args[i]->Evaluate(ctx);
 
-        if (!function_symbol->param_types[i]->CompatibleWith(s->type))
-            throw CompileError(location, "argument of type " + function_symbol->param_types[i]->Name() +
+        if (!callee.param_types[i]->CompatibleWith(*s->type))
+            throw CompileError(location, "argument of type " + callee.param_types[i]->Name() +
                 " is not compatible with type " + s->type->Name());
 
         symbols.push_back(s);
-        code += c;
+        code += std::move(c);
     }
+    return code;
+}
+
+Code FunctionCallExpression::LoadArguments(ExpressionContext& ctx, FunctionSymbol& callee)
+{
+    vector<shared_ptr<Symbol>> symbols;
+    Code code = EvaluateArguments(ctx, callee, symbols);
+
+    // a parameter kept in an argument register is copied if an earlier argument overwrites it
+    for (size_t i = 0; i < symbols.size(); i++)
+        for (size_t j = 0; j < i; j++)
+            if (symbols[i]->Register() == "$a" + std::to_string(j))
+            {
+                auto temp = ctx.NewTemp(symbols[i]->type, location);
+                code += temp->SaveValue(symbols[i]->Register());
+                symbols[i] = temp;
+                break;
+            }
     
     for (size_t i = 0; i < symbols.size(); i++)
     {
-        auto pt = function_symbol->param_types[i];
+        auto pt = callee.param_types[i];
         string reg = "$a" + std::to_string(i);
 
-        code += symbols[i]->LoadValue(reg);
-        if (*pt == *char_type)
-            code += tab + "and " + reg + ", " + reg + ", 0xff\n";
+        int value;
+        if (symbols[i]->Constant(value))
+            code += Instruction(Opcode::Li, reg, *pt == *char_type ? value & 0xff : value);
+        else
+        {
+            code += symbols[i]->LoadValue(reg);
+            if (*pt == *char_type)
+                code += Instruction(Opcode::Andi, reg, reg, 0xff);
+        }
     }
+    return code;
+}
+
+std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Inline(ExpressionContext& ctx, FunctionSymbol& callee)
+{
+    FunctionDefinition& definition = *callee.inlined;
+    auto exp = definition.ReturnedExpression();
 
-    code += tab + "jal " + function_symbol->name + "\n";
+    ExpressionContext inner = ctx;
+    vector<shared_ptr<Symbol>> symbols;
+    Code code = EvaluateArguments(inner, callee, symbols);
+
+    // parameters assigned in the expression need a copy of their own
+    set<string> assigned;
+    exp->Walk([&assigned](Statement& statement) {
+        if (auto assignment = dynamic_cast<AssignmentExpression*>(&statement))
+            if (auto variable = std::dynamic_pointer_cast<VariableExpression>(assignment->left))
+                assigned.insert(variable->name);
+    });
+
+    LocalContext body(ctx.local_context, callee);
+    auto& temps = FunctionContext::temp_registers;
+    for (size_t i = 0; i < symbols.size(); i++)
+    {
+        auto& param = *definition.params[i];
+        auto symbol = symbols[i];
+        bool is_char = *param.type == *char_type;
+
+        // constants and int temporaries stand for the parameter as they are, anything else
+        // is copied the way it would be passed, as the expression could change it
+        int value;
+        bool temp = std::find(temps.begin(), temps.end(), symbol->Register()) != temps.end();
+        if (assigned.count(param.name) == 0 && symbol->Constant(value))
+            symbol = std::make_shared<ConstantSymbol>(is_char ? value & 0xff : value, param.type, location);
+        else if (assigned.count(param.name) != 0 || !temp || is_char || !(*symbol->type == *param.type))
+        {
+            auto copy = inner.NewTemp(param.type, location);
+            string reg = ResultRegister(copy, "$v0");
+            code += symbol->LoadValue(reg);
+            if (is_char)
+                code += Instruction(Opcode::Andi, reg, reg, 0xff);
+            code += copy->SaveValue(reg);
+            symbol = copy;
+        }
+        ctx.local_context.function_context.symbols.Declare(param.name, symbol, body.scope);
+    }
+
+    // the callee reports its warnings when it is compiled itself
+    GlobalContext& global_context = ctx.local_context.global_context;
+    auto printer = global_context.printer;
+    global_context.printer = [](const Location&, const string&, const string&) {};
+    ExpressionContext body_ctx(body);
+    body_ctx.context_depth = inner.context_depth;
+    auto [body_code, value_symbol] = exp->Evaluate(body_ctx);
+    global_context.printer = printer;
+    code += std::move(body_code);
+
+    bool is_char = *callee.type == *char_type;
+    int value;
+    if (value_symbol->Constant(value))
+        return std::make_pair(std::move(code),
+            std::make_shared<ConstantSymbol>(is_char ? value & 0xff : value, callee.type, location));
+
+    auto result = ctx.NewTemp(location);
+    string reg = ResultRegister(result, "$v0");
+    code += value_symbol->LoadValue(reg);
+    if (is_char)
+        code += Instruction(Opcode::Andi, reg, reg, 0xff);
+    code += result->SaveValue(reg);
+    return std::make_pair(std::move(code), result);
+}
+
+std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionContext& ctx)
+{
+    auto function_symbol = Callee(ctx);
+    if (function_symbol->inlined != nullptr)
+        return Inline(ctx, *function_symbol);
+
+    ExpressionContext inner = ctx;
+    Code code = LoadArguments(inner, *function_symbol);
+
+    if (function_symbol->builtin)
+        code += Instruction(Opcode::Jal, Operand::Label(function_symbol->name));
+    else
+    {
+        code += ctx.SaveLiveTemps(location);
+        code += Instruction(Opcode::Jal, Operand::Label(function_symbol->name));
+        code += ctx.RestoreLiveTemps(location);
+    }
 
     shared_ptr<Symbol> result;
     if (*function_symbol->type == *void_type)
@@ -209,50 +883,194 @@ std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionC
         code += result->SaveValue("$v0");
     }
 
-    return std::make_pair(code, result);
+    return std::make_pair(std::move(code), result);
+}
+
+Code UnaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
+{
+    return exp->Evaluate(ctx, false_label, true_label, next_label);
 }
 
-Code UnaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+std::pair<Code, shared_ptr<Symbol>> UnaryBooleanExpression::Materialize(ExpressionContext& ctx)
 {
-    return exp->Evaluate(ctx, false_label, true_label);
+    ExpressionContext inner = ctx;
+    auto [code, symbol0] = exp->Materialize(inner);
+    if (!symbol0)
+        return std::make_pair(Code(), nullptr);
+
+    auto symbol = ctx.NewTemp(location);
+    string reg0 = ValueRegister(code, symbol0, "$v0");
+    string reg = ResultRegister(symbol, "$v0");
+    code += Instruction(Opcode::Xori, reg, reg0, 1);
+    code += symbol->SaveValue(reg);
+    return std::make_pair(std::move(code), symbol);
 }
 
-Code BinaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+Code BinaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
 {
+    bool value;
+    if (Precomputable(value))
+        return Jump(value ? true_label : false_label, next_label);
+
     string inner_label = ctx.local_context.global_context.NewLabel();
 
-    if (op == "&&")
+    if (op == Operator::And)
     {
-        Code code = exp1->Evaluate(ctx, inner_label, false_label);
-        code += inner_label + ":\n";
-        code += exp2->Evaluate(ctx, true_label, false_label);
+        Code code = exp1->Evaluate(ctx, inner_label, false_label, inner_label);
+        code += Instruction::Label(inner_label);
+        code += exp2->Evaluate(ctx, true_label, false_label, next_label);
         return code;
     }
-    if (op == "||")
+    if (op == Operator::Or)
     {
-        Code code = exp1->Evaluate(ctx, true_label, inner_label);
-        code += inner_label + ":\n";
-        code += exp2->Evaluate(ctx, true_label, false_label);
+        Code code = exp1->Evaluate(ctx, true_label, inner_label, inner_label);
+        code += Instruction::Label(inner_label);
+        code += exp2->Evaluate(ctx, true_label, false_label, next_label);
         return code;
     }
     
     assert(false); // must not happen
 }
 
-Code RelationalExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+std::pair<Code, shared_ptr<Symbol>> BinaryBooleanExpression::Materialize(ExpressionContext& ctx)
 {
+    // the second operand is evaluated even where && and || would skip it
+    if (!SafeToEvaluate(*exp2))
+        return std::make_pair(Code(), nullptr);
+
+    ExpressionContext inner = ctx;
+    auto [code1, symbol1] = exp1->Materialize(inner);
+    auto [code2, symbol2] = exp2->Materialize(inner);
+    if (!symbol1 || !symbol2)
+        return std::make_pair(Code(), nullptr);
+
+    auto symbol = ctx.NewTemp(location);
+    Code code = std::move(code1) + std::move(code2);
+    string reg1 = ValueRegister(code, symbol1, "$v0");
+    string reg2 = ValueRegister(code, symbol2, "$v1");
+    string reg = ResultRegister(symbol, "$v0");
+    code += Instruction(op == Operator::And ? Opcode::And : Opcode::Or, reg, reg1, reg2);
+    code += symbol->SaveValue(reg);
+    return std::make_pair(std::move(code), symbol);
+}
+
+Code RelationalExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
+{
+    bool value;
+    if (Precomputable(value))
+        return Jump(value ? true_label : false_label, next_label);
+
     ExpressionContext inner = ctx;
     auto [code1, symbol1] = exp1->Evaluate(inner);
     auto [code2, symbol2] = exp2->Evaluate(inner);
 
-    Code code = code1 + code2;
-    code += symbol1->LoadValue("$v0");
-    code += symbol2->LoadValue("$v1");
-    code += tab + op_to_instruction.at(op) + " $v0, $v1, " + true_label + "\n";
-    code += tab + "b " + false_label + "\n";
+    Code code = std::move(code1) + std::move(code2);
+
+    // only the side effects of the operands are needed when both labels follow
+    if (true_label == next_label && false_label == next_label)
+        return code;
+
+    // compare against a constant operand as an immediate, or against $zero
+    Operator compare_op = op;
+    int constant;
+    if (symbol1->Constant(constant) && !symbol2->Constant(constant))
+    {
+        std::swap(symbol1, symbol2);
+        compare_op = swapped_op.at(op);
+    }
+
+    // when the true label follows, branch on the opposite comparison to the false label instead
+    string target = true_label;
+    if (true_label == next_label && false_label != next_label)
+    {
+        compare_op = negated_op.at(compare_op);
+        target = false_label;
+    }
+
+    string reg1 = ValueRegister(code, symbol1, "$v0");
+    if (symbol2->Constant(constant) && constant == 0)
+        code += Instruction(op_to_zero_instruction.at(compare_op), reg1, Operand::Label(target));
+    else if (symbol2->Constant(constant))
+        code += Instruction(op_to_instruction.at(compare_op), reg1, constant, Operand::Label(target));
+    else
+    {
+        string reg2 = ValueRegister(code, symbol2, "$v1");
+        code += Instruction(op_to_instruction.at(compare_op), reg1, reg2, Operand::Label(target));
+    }
+    if (target == true_label)
+        code += Jump(false_label, next_label);
     return code;
 }
 
+std::pair<Code, shared_ptr<Symbol>> RelationalExpression::Materialize(ExpressionContext& ctx)
+{
+    ExpressionContext inner = ctx;
+    auto [code1, symbol1] = exp1->Evaluate(inner);
+    auto [code2, symbol2] = exp2->Evaluate(inner);
+
+    auto symbol = ctx.NewTemp(location);
+    Code code = std::move(code1) + std::move(code2);
+
+    Operator compare_op = op;
+    int constant;
+    if (symbol1->Constant(constant) && !symbol2->Constant(constant))
+    {
+        std::swap(symbol1, symbol2);
+        compare_op = swapped_op.at(op);
+    }
+
+    // a <= b is computed as !(b < a), and a == b as (a ^ b) < 1 unsigned
+    string reg1 = ValueRegister(code, symbol1, "$v0");
+    string reg = ResultRegister(symbol, "$v0");
+    bool negate = compare_op == Operator::GreaterEqual || compare_op == Operator::Greater;
+    if (symbol2->Constant(constant) && (compare_op == Operator::Less || compare_op == Operator::GreaterEqual)
+        && FitsImmediate(constant, false))
+        code += Instruction(Opcode::Slti, reg, reg1, constant);
+    else if (symbol2->Constant(constant) && (compare_op == Operator::LessEqual || compare_op == Operator::Greater)
+        && FitsImmediate(constant + 1LL, false))
+        code += Instruction(Opcode::Slti, reg, reg1, constant + 1);
+    else if (symbol2->Constant(constant) && (compare_op == Operator::Equal || compare_op == Operator::NotEqual)
+        && FitsImmediate(constant, true))
+    {
+        if (constant != 0)
+        {
+            code += Instruction(Opcode::Xori, reg, reg1, constant);
+            reg1 = reg;
+        }
+        if (compare_op == Operator::Equal)
+            code += Instruction(Opcode::Sltiu, reg, reg1, 1);
+        else
+            code += Instruction(Opcode::Sltu, reg, "$zero", reg1);
+        negate = false;
+    }
+    else
+    {
+        string reg2 = ValueRegister(code, symbol2, "$v1");
+        if (compare_op == Operator::Less || compare_op == Operator::GreaterEqual)
+            code += Instruction(Opcode::Slt, reg, reg1, reg2);
+        else if (compare_op == Operator::Greater || compare_op == Operator::LessEqual)
+        {
+            code += Instruction(Opcode::Slt, reg, reg2, reg1);
+            negate = compare_op == Operator::LessEqual;
+        }
+        else
+        {
+            code += Instruction(Opcode::Xor, reg, reg1, reg2);
+            if (compare_op == Operator::Equal)
+                code += Instruction(Opcode::Sltiu, reg, reg, 1);
+            else
+                code += Instruction(Opcode::Sltu, reg, "$zero", reg);
+        }
+    }
+    if (negate)
+        code += Instruction(Opcode::Xori, reg, reg, 1);
+    code += symbol->SaveValue(reg);
+    return std::make_pair(std::move(code), symbol);
+}
+
 Code VariableDeclaration::Compile(LocalContext& ctx)
 {
     ctx.DeclareVariable(name, type, location);
@@ -264,7 +1082,7 @@ Code ContinueStatement::Compile(LocalContext& ctx)
     string label = ctx.LastContinueLabel();
     if (label.empty())
         throw CompileError(location, "no outer loop exists");
-    return tab + "b " + label + "\n";
+    return Instruction(Opcode::B, Operand::Label(label));
 }
 
 Code BreakStatement::Compile(LocalContext& ctx)
@@ -272,12 +1090,51 @@ Code BreakStatement::Compile(LocalContext& ctx)
     string label = ctx.LastBreakLabel();
     if (label.empty())
         throw CompileError(location, "no outer loop or switch statement exists");
-    return tab + "b " + label + "\n";
+    return Instruction(Opcode::B, Operand::Label(label));
+}
+
+// the call made by a return statement if it can jump to the callee in the frame of the caller
+static shared_ptr<FunctionCallExpression> TailCall(ReturnStatement& statement, GlobalContext& ctx,
+    SymbolType& return_type)
+{
+    auto call = std::dynamic_pointer_cast<FunctionCallExpression>(statement.exp);
+    if (!ctx.options.tail_calls || call == nullptr)
+        return nullptr;
+
+    // a char function has to mask the value returned by an int callee
+    auto callee = std::dynamic_pointer_cast<FunctionSymbol>(ctx[call->name]);
+    if (!callee || callee->inlined != nullptr || callee->param_types.size() != call->args.size()
+        || *callee->type == *void_type
+        || (return_type == *char_type && !(*callee->type == *char_type)))
+        return nullptr;
+    return call;
 }
 
 Code ReturnStatement::Compile(LocalContext& ctx)
 {
-    SymbolType& return_type = *ctx.function_context.function_symbol.type;
+    FunctionContext& fctx = ctx.function_context;
+    SymbolType& return_type = *fctx.function_symbol.type;
+
+    // main has no caller to return to, so it makes no tail calls
+    auto call = TailCall(*this, ctx.global_context, return_type);
+    if (call != nullptr && !fctx.recursion_label.empty())
+    {
+        ExpressionContext inner = ctx;
+        auto callee = call->Callee(inner);
+        Code code = call->LoadArguments(inner, *callee);
+
+        // a call to itself starts over with the new arguments, others jump after the epilogue
+        if (callee->name == fctx.function_symbol.name)
+            code += Instruction(Opcode::B, Operand::Label(fctx.recursion_label));
+        else
+        {
+            auto& label = fctx.tail_calls[callee->name];
+            if (label.empty())
+                label = "$" + fctx.function_symbol.name + "_tail_" + callee->name;
+            code += Instruction(Opcode::B, Operand::Label(label));
+        }
+        return code;
+    }
 
     Code code;
     if (exp != nullptr && (return_type == *int_type || return_type == *char_type))
@@ -286,22 +1143,41 @@ Code ReturnStatement::Compile(LocalContext& ctx)
         if (exp->Precomputable(value))
         {
             if (return_type == *char_type) value &= 0xff;
-            code += tab + "li $v0, " + std::to_string(value) + "\n";
+            code += Instruction(Opcode::Li, "$v0", value);
         }
         else
         {
             ExpressionContext inner = ctx;
             auto [exp_code, symbol] = exp->Evaluate(inner);
-            code += exp_code;
+            code += std::move(exp_code);
             code += symbol->LoadValue("$v0");
             if (return_type == *char_type)
-                code += tab + "and $v0, $v0, 0xff\n";
+                code += Instruction(Opcode::Andi, "$v0", "$v0", 0xff);
         }
     }
     else if (!(exp == nullptr && return_type == *void_type))
         throw CompileError(location, "return value type does not match function return type");
 
-    code += tab + "b " + ctx.function_context.epilouge_label + "\n";
+    code += Instruction(Opcode::B, Operand::Label(ctx.function_context.epilouge_label));
+    return code;
+}
+
+Code StatementBlock::CompileStatements(const vector<shared_ptr<Statement>>& statements, LocalContext& ctx)
+{
+    Code code;
+    bool reachable = true;
+    for (auto s : statements)
+    {
+        if (reachable)
+            code += s->Compile(ctx);
+        else
+        {
+            DiscardedCode discarded(ctx.function_context);
+            s->Compile(ctx);
+        }
+        if (dynamic_cast<JumpStatement*>(s.get()) != nullptr)
+            reachable = false;
+    }
     return code;
 }
 
@@ -310,15 +1186,125 @@ Code IfElseStatement::Compile(LocalContext& ctx)
     string label = ctx.global_context.NewLabel();
     string then_label = label + "_then", else_label = label + "_else", end_label = label + "_end";
 
+    // only the taken branch is kept, the other one is still compiled for its diagnostics
+    bool value;
+    if (condition->Precomputable(value))
+    {
+        auto compile = [&](Statement& block, bool taken) {
+            if (taken)
+                return block.Compile(ctx);
+            DiscardedCode discarded(ctx.function_context);
+            block.Compile(ctx);
+            return Code();
+        };
+        Code then_code = compile(*then_block, value);
+        Code else_code = compile(*else_block, !value);
+        return value ? std::move(then_code) : std::move(else_code);
+    }
+
+    // indices compared against constants by the condition need no checks in the then block
+    LocalContext then_ctx(ctx);
+    Ranges ranges;
+    ConditionRanges(condition, ranges);
+    AddRanges(then_ctx, ranges, { condition.get(), then_block.get() });
+
     Code code;
     ExpressionContext inner = ctx;
-    code += condition->Evaluate(inner, then_label, else_label);
-    code += then_label + ":\n";
-    code += then_block->Compile(ctx);
-    code += tab + "b " + end_label + "\n";
-    code += else_label + ":\n";
-    code += else_block->Compile(ctx);
-    code += end_label + ":\n";
+    code += condition->Evaluate(inner, then_label, else_label, then_label);
+    code += Instruction::Label(then_label);
+    code += then_block->Compile(then_ctx);
+    Code else_code = else_block->Compile(ctx);
+    if (!else_code.Empty())
+        code += Instruction(Opcode::B, Operand::Label(end_label));
+    code += Instruction::Label(else_label);
+    code += std::move(else_code);
+    code += Instruction::Label(end_label);
+    return code;
+}
+
+// a run of cases is lowered to a jump table when at least a third of its range is used
+static bool Dense(const vector<std::pair<int, string>>& cases, size_t begin, size_t end)
+{
+    long long count = end - begin;
+    long long range = (long long)cases[end - 1].first - cases[begin].first + 1;
+    return count >= 5 && range <= 3 * count;
+}
+
+// split the sorted cases into the longest dense runs, the remaining cases stand alone
+static vector<std::pair<size_t, size_t>> Clusters(const vector<std::pair<int, string>>& cases)
+{
+    vector<std::pair<size_t, size_t>> clusters;
+    for (size_t begin = 0; begin < cases.size(); begin = clusters.rbegin()->second)
+    {
+        size_t end = cases.size();
+        while (end > begin + 1 && !Dense(cases, begin, end))
+            end--;
+        clusters.push_back({ begin, end });
+    }
+    return clusters;
+}
+
+static Code JumpThroughTable(GlobalContext& ctx, const vector<std::pair<int, string>>& cases,
+    size_t begin, size_t end, const string& default_label)
+{
+    int low = cases[begin].first, high = cases[end - 1].first;
+    JumpTable table = { ctx.NewLabel() + "_table" };
+    for (size_t i = begin; i < end; i++)
+    {
+        while ((long long)low + (long long)table.targets.size() < cases[i].first)
+            table.targets.push_back(default_label);
+        table.targets.push_back(cases[i].second);
+    }
+
+    // the unsigned comparison also sends values below the range to the default
+    Code code;
+    if (low == 0)
+        code += Instruction(Opcode::Move, "$v1", "$v0");
+    else if (FitsImmediate(-(long long)low, false))
+        code += Instruction(Opcode::Addiu, "$v1", "$v0", -low);
+    else
+    {
+        code += Instruction(Opcode::Li, "$v1", low);
+        code += Instruction(Opcode::Subu, "$v1", "$v0", "$v1");
+    }
+    code += Instruction(Opcode::Bgeu, "$v1", (int)((long long)high - low + 1), Operand::Label(default_label));
+    code += Instruction(Opcode::Sll, "$v1", "$v1", 2);
+    code += Instruction(Opcode::La, "$t0", Operand::Label(table.label));
+    code += Instruction(Opcode::Addu, "$v1", "$v1", "$t0");
+    code += Instruction(Opcode::Lw, "$v1", Operand::Memory("$v1", 0));
+
+    Instruction jump(Opcode::Jr, "$v1");
+    jump.text = table.label;
+    code += jump;
+
+    ctx.jump_tables.push_back(std::move(table));
+    return code;
+}
+
+// jump from the value in $v0 to the matching case, searching the clusters in [begin, end)
+static Code Dispatch(GlobalContext& ctx, const vector<std::pair<int, string>>& cases,
+    const vector<std::pair<size_t, size_t>>& clusters, size_t begin, size_t end, const string& default_label)
+{
+    Code code;
+    size_t first = end > begin ? clusters[begin].first : 0, last = end > begin ? clusters[end - 1].second : 0;
+    if (end - begin == 1 && last - first > 1)
+        return JumpThroughTable(ctx, cases, first, last, default_label);
+
+    if (last - first <= 4 && end - begin == last - first)
+    {
+        for (size_t i = first; i < last; i++)
+            code += Instruction(Opcode::Beq, "$v0", cases[i].first, Operand::Label(cases[i].second));
+        code += Instruction(Opcode::B, Operand::Label(default_label));
+        return code;
+    }
+
+    // binary search on the first case value of each cluster
+    size_t middle = begin + (end - begin) / 2;
+    string upper_label = ctx.NewLabel();
+    code += Instruction(Opcode::Bge, "$v0", cases[clusters[middle].first].first, Operand::Label(upper_label));
+    code += Dispatch(ctx, cases, clusters, begin, middle, default_label);
+    code += Instruction::Label(upper_label);
+    code += Dispatch(ctx, cases, clusters, middle, end, default_label);
     return code;
 }
 
@@ -334,23 +1320,44 @@ Code SwitchStatement::Compile(LocalContext& parent_ctx)
 
     ctx.break_label = end_label;
 
-    code += symbol->LoadValue("$v0");
-    for (size_t i = 0; i < case_values.size(); i++)
-        if (case_values[i] != nullptr)
-            code += tab + "beq $v0, " + std::to_string(*case_values[i]) + ", " + case_label + std::to_string(i) + "\n";
-    code += tab + "b " + default_label + "\n";
+    // without a default case unmatched values leave the switch
+    if (std::find(case_values.begin(), case_values.end(), nullptr) == case_values.end())
+        default_label = end_label;
+
+    int value;
+    if (symbol->Constant(value))
+    {
+        // jump straight to the matching case
+        auto match = std::find_if(case_values.begin(), case_values.end(),
+            [value](auto other) { return other != nullptr && *other == value; });
+        if (match != case_values.end())
+            code += Instruction(Opcode::B, Operand::Label(case_label + std::to_string(match - case_values.begin())));
+        else
+            code += Instruction(Opcode::B, Operand::Label(default_label));
+    }
+    else
+    {
+        vector<std::pair<int, string>> cases;
+        for (size_t i = 0; i < case_values.size(); i++)
+            if (case_values[i] != nullptr)
+                cases.push_back({ *case_values[i], case_label + std::to_string(i) });
+        std::sort(cases.begin(), cases.end());
+
+        code += symbol->LoadValue("$v0");
+        auto clusters = Clusters(cases);
+        code += Dispatch(ctx.global_context, cases, clusters, 0, clusters.size(), default_label);
+    }
     
     for (size_t i = 0; i < case_bodies.size(); i++)
     {
         if (case_values[i] != nullptr)
-            code += case_label + std::to_string(i) + ":\n";
+            code += Instruction::Label(case_label + std::to_string(i));
         else
-            code += default_label + ":\n";
+            code += Instruction::Label(default_label);
 
-        for (size_t j = 0; j < case_bodies[i].size(); j++)
-            code += case_bodies[i][j]->Compile(ctx);
+        code += StatementBlock::CompileStatements(case_bodies[i], ctx);
     }
-    code += end_label + ":\n";
+    code += Instruction::Label(end_label);
 
     return code;
 }
@@ -365,13 +1372,39 @@ Code WhileStatement::Compile(LocalContext& ctx)
 
     ExpressionContext inner = ctx;
 
+    LocalContext body_ctx(ctx);
+    Ranges ranges;
+    ConditionRanges(condition, ranges);
+    AddRanges(body_ctx, ranges, { condition.get(), body.get() });
+
+    // a loop that never runs is still compiled for its diagnostics
+    bool value;
+    bool constant = condition->Precomputable(value);
+    if (constant && !value)
+    {
+        DiscardedCode discarded(ctx.function_context);
+        body->Compile(body_ctx);
+        return Code();
+    }
+    Code body_code = body->Compile(body_ctx);
+
+    // the condition is tested at the bottom, entered once by a jump, so an iteration takes a single branch
     Code code;
-    code += loop_label + ":\n";
-    code += condition->Evaluate(inner, body_label, end_label);
-    code += body_label + ":\n";
-    code += body->Compile(ctx);
-    code += tab + "b " + loop_label + "\n";
-    code += end_label + ":\n";
+    if (constant)
+    {
+        code += Instruction::Label(loop_label);
+        code += std::move(body_code);
+        code += Instruction(Opcode::B, Operand::Label(loop_label));
+    }
+    else
+    {
+        code += Instruction(Opcode::B, Operand::Label(loop_label));
+        code += Instruction::Label(body_label);
+        code += std::move(body_code);
+        code += Instruction::Label(loop_label);
+        code += condition->Evaluate(inner, body_label, end_label, end_label);
+    }
+    code += Instruction::Label(end_label);
     return code;
 }
 
@@ -391,177 +1424,519 @@ Code ForStatement::Compile(LocalContext& parent_ctx)
     Code code;
     for (auto i : initializer)
         code += i->Compile(ctx);
-    code += loop_label + ":\n";
-    code += condition->Evaluate(inner, body_label, end_label);
-    code += body_label + ":\n";
-    code += body->Compile(ctx);
-    code += step_label + ":\n";
-    code += step->Compile(ctx);
-    code += tab + "b " + loop_label + "\n";
-    code += end_label + ":\n";
-    return code;
-}
 
-Code FieldDefinition::Compile(GlobalContext& ctx)
-{
-    ctx.DeclareField(FieldSymbol(name, type, location));
+    // the condition bounds the counter in the body, and the start bounds it from the other side
+    LocalContext body_ctx(ctx);
+    Ranges ranges;
+    ConditionRanges(condition, ranges);
+    string counter;
+    int start, step_value;
+    bool induction = InductionVariable(*this, counter, start, step_value);
+    if (induction)
+    {
+        // the counter stays on the side of its start only if the step cannot wrap it around
+        // from a value the condition lets into the body
+        auto range = ranges.find(counter);
+        if (range != ranges.end() && step_value > 0 && range->second.second <= (long long)INT_MAX - step_value)
+            Narrow(ranges, counter, start, LLONG_MAX);
+        else if (range != ranges.end() && step_value < 0 && range->second.first >= (long long)INT_MIN - step_value)
+            Narrow(ranges, counter, LLONG_MIN, start);
+
+        if (ctx.global_context.options.hoist_bounds_checks && step_value == 1)
+            code += HoistBoundsChecks(*this, ctx, counter, start, ranges);
+    }
+    AddRanges(body_ctx, ranges, { condition.get(), body.get() });
+
+    // a loop that never runs only keeps its initializer
+    bool value;
+    bool constant = condition->Precomputable(value);
+    Code pointer_steps;
+    size_t pointers = 0;
+    if (induction && (!constant || value))
+        code += ReduceElementPointers(*this, ctx, counter, start, step_value, pointer_steps, pointers);
+    if (constant && !value)
+    {
+        DiscardedCode discarded(ctx.function_context);
+        body->Compile(body_ctx);
+        step->Compile(ctx);
+        return code;
+    }
+    Code body_code = body->Compile(body_ctx);
+    Code step_code = step->Compile(ctx) + std::move(pointer_steps);
+    ctx.function_context.pointer_registers -= pointers;
 
-    Code code;
-    if (ctx.current_section != "data")
+    // rotated like a while loop, the step falls through into the condition
+    if (constant)
+    {
+        code += Instruction::Label(loop_label);
+        code += std::move(body_code);
+        code += Instruction::Label(step_label);
+        code += std::move(step_code);
+        code += Instruction(Opcode::B, Operand::Label(loop_label));
+    }
+    else
     {
-        ctx.current_section = "data";
-        code += ".data\n";
+        code += Instruction(Opcode::B, Operand::Label(loop_label));
+        code += Instruction::Label(body_label);
+        code += std::move(body_code);
+        code += Instruction::Label(step_label);
+        code += std::move(step_code);
+        code += Instruction::Label(loop_label);
+        code += condition->Evaluate(inner, body_label, end_label, end_label);
     }
+    code += Instruction::Label(end_label);
+    return code;
+}
+
+shared_ptr<GlobalSymbol> FieldDefinition::Declare(GlobalContext& ctx)
+{
+    return ctx.DeclareField(FieldSymbol(name, type, location));
+}
 
-    code += name + ":\n";
-    if (auto valuetype = std::dynamic_pointer_cast<ValueType>(type))
+Module FieldDefinition::Compile(GlobalContext& ctx)
+{
+    Code code = Instruction::Label(name);
+    if (is_value_type(type))
     {
-        code += tab + valuetype->Allocation(value) + "\n";
+        code += static_cast<ValueType&>(*type).Allocation(value);
     }
-    else if (auto arraytype = std::dynamic_pointer_cast<ArrayType>(type))
+    else if (auto arraytype = as_array_type(type))
     {
         if (has_value)
         {
-            code += tab + arraytype->Allocation(literal) + "\n";
+            code += arraytype->Allocation(literal);
             if (arraytype->Width() > literal.size() + 1)
-                code += tab + ArrayType(arraytype->underlying_type,
-                    arraytype->Width() - literal.size() - 1).Allocation() + "\n";
+                code += ArrayType::Get(arraytype->underlying_type,
+                    arraytype->Width() - literal.size() - 1)->Allocation();
         }
         else
-            code += tab + arraytype->Allocation() + "\n";
+            code += arraytype->Allocation();
     }
     else
         assert(false); // must not happen
 
-    return code + "\n";
+    Module module;
+    module.Append(Module::Section::Data, std::move(code));
+    return module;
+}
+
+// inlined calls are made by the expressions they are replaced with
+static bool MakesCalls(Statement& code, GlobalContext& ctx, const set<Statement*>& tail_calls)
+{
+    bool calls = false;
+    code.Walk([&](Statement& statement) {
+        auto call = dynamic_cast<FunctionCallExpression*>(&statement);
+        if (call == nullptr || tail_calls.count(&statement) != 0)
+            return;
+        auto callee = std::dynamic_pointer_cast<FunctionSymbol>(ctx[call->name]);
+        if (callee == nullptr || callee->inlined == nullptr)
+            calls = true;
+        else if (MakesCalls(*callee->inlined->ReturnedExpression(), ctx, {}))
+            calls = true;
+    });
+    return calls;
+}
+
+// whether the function calls anything, which clobbers $ra and the argument registers,
+// tail calls are made once the function is done with both
+static bool MakesCalls(Statement& body, GlobalContext& ctx, SymbolType& return_type)
+{
+    set<Statement*> tail_calls;
+    body.Walk([&](Statement& statement) {
+        if (auto return_statement = dynamic_cast<ReturnStatement*>(&statement))
+            if (auto call = TailCall(*return_statement, ctx, return_type))
+                tail_calls.insert(call.get());
+    });
+
+    return MakesCalls(body, ctx, tail_calls);
 }
 
-Code FunctionDefinition::Compile(GlobalContext& ctx)
+shared_ptr<GlobalSymbol> FunctionDefinition::Declare(GlobalContext& ctx)
 {
     vector<shared_ptr<SymbolType>> param_types;
     std::transform(params.begin(), params.end(), std::back_inserter(param_types), [](auto d) { return d->type; });
-    auto symbol = ctx.DeclareFunction(FunctionSymbol(name, type, param_types, location));
-
-    FunctionContext fctx(ctx, *symbol);
-    
-    fctx.DeclareParameter("$saved_ra", int_type, location);
-    fctx.DeclareParameter("$saved_fp", int_type, location);
+    FunctionSymbol symbol(name, type, param_types, location);
+    if (inlined)
+        symbol.inlined = this;
+    return ctx.DeclareFunction(symbol);
+}
 
-    for (auto p : params)
-        fctx.DeclareParameter(p->name, p->type, p->location);
+Code FunctionDefinition::Generate(GlobalContext& ctx)
+{
+    FunctionContext fctx(ctx, static_cast<FunctionSymbol&>(*ctx.definition));
+    fctx.recursion_label = "$" + name + "_recur";
 
-    Code code;
-    if (ctx.current_section != "text")
+    // a leaf function keeps $ra and its parameters in their registers and does not touch $fp,
+    // the bounds check error handler also uses jal but never returns
+    bool leaf = !MakesCalls(*body, ctx, *type);
+    
+    if (!leaf)
     {
-        ctx.current_section = "text";
-        code += ".text\n";
+        fctx.DeclareParameter("$saved_ra", int_type, location);
+        fctx.DeclareParameter("$saved_fp", int_type, location);
     }
-    code += name + ":\n";
+
+    for (size_t i = 0; i < params.size(); i++)
+        fctx.DeclareParameter(params[i]->name, params[i]->type, params[i]->location,
+            leaf ? "$a" + std::to_string(i) : "");
+
+    Code code = Instruction::Label(name);
 
     Code body_code = body->Compile(fctx);
 
+    // callee-saved registers used for temporaries
+    vector<std::pair<string, shared_ptr<VariableSymbol>>> saved_registers;
+    for (auto reg : fctx.saved_registers)
+        saved_registers.push_back(std::make_pair(reg, fctx.ReserveSlot(int_type, location)));
+    if (ctx.options.pack_frames)
+        fctx.AllocateFrame(body_code);
+
     // prolouge
-    code += tab + "addu $sp, $sp, " + std::to_string(-*fctx.stack_depth) + "\n";
-    code += fctx["$saved_ra"]->SaveValue("$ra");
-    code += fctx["$saved_fp"]->SaveValue("$fp");
-    code += tab + "move $fp, $sp\n";
+    if (fctx.stack_depth != 0)
+        code += Instruction(Opcode::Addu, "$sp", "$sp", -fctx.stack_depth);
+    if (!leaf)
+    {
+        code += fctx["$saved_ra"]->SaveValue("$ra");
+        code += fctx["$saved_fp"]->SaveValue("$fp");
+        code += Instruction(Opcode::Move, "$fp", "$sp");
+    }
+    for (auto [reg, slot] : saved_registers)
+        code += slot->SaveValue(reg);
 
-    for (size_t i = 0; i < params.size(); i++)
-        code += fctx[params[i]->name]->SaveValue("$a" + std::to_string(i));
+    // self tail calls come back here with the new arguments
+    code += Instruction::Label(fctx.recursion_label);
+    if (!leaf)
+        for (size_t i = 0; i < params.size(); i++)
+            code += fctx[params[i]->name]->SaveValue("$a" + std::to_string(i));
 
-    code += body_code;
+    code += std::move(body_code);
 
     // epilouge
-    code += fctx.epilouge_label + ":\n";
-    code += tab + "move $sp, $fp\n";
-    code += fctx["$saved_ra"]->LoadValue("$ra");
-    code += fctx["$saved_fp"]->LoadValue("$fp");
-    code += tab + "addu $sp, $sp, " + std::to_string(*fctx.stack_depth) + "\n";
-    code += tab + "jr $ra\n";
+    auto restore_frame = [&]() {
+        Code code;
+        if (!leaf)
+            code += Instruction(Opcode::Move, "$sp", "$fp");
+        for (auto [reg, slot] : saved_registers)
+            code += slot->LoadValue(reg);
+        if (!leaf)
+        {
+            code += fctx["$saved_ra"]->LoadValue("$ra");
+            code += fctx["$saved_fp"]->LoadValue("$fp");
+        }
+        if (fctx.stack_depth != 0)
+            code += Instruction(Opcode::Addu, "$sp", "$sp", fctx.stack_depth);
+        return code;
+    };
 
-    return code + "\n";
+    code += Instruction::Label(fctx.epilouge_label);
+    code += restore_frame();
+    code += Instruction(Opcode::Jr, "$ra");
+
+    // the callee of a tail call returns straight to the caller of this function
+    for (auto& [callee, label] : fctx.tail_calls)
+    {
+        code += Instruction::Label(label);
+        code += restore_frame();
+        code += Instruction(Opcode::J, Operand::Label(callee));
+    }
+
+    fctx.LayoutFrame(code);
+    return code;
 }
 
-Code MainFunctionDefinition::Compile(GlobalContext& ctx)
+shared_ptr<GlobalSymbol> MainFunctionDefinition::Declare(GlobalContext& ctx)
 {
-    auto symbol = ctx.DeclareFunction(FunctionSymbol(name, type, {}, location));
-
-    FunctionContext fctx(ctx, *symbol);
+    return ctx.DeclareFunction(FunctionSymbol(name, type, {}, location));
+}
 
-    Code code;
-    if (ctx.current_section != "text")
-    {
-        ctx.current_section = "text";
-        code += ".text\n";
-    }
+Code MainFunctionDefinition::Generate(GlobalContext& ctx)
+{
+    FunctionContext fctx(ctx, static_cast<FunctionSymbol&>(*ctx.definition));
 
-    code += ".globl main\n";
-    code += name + ":\n";
+    Code code = Instruction::Label(name);
 
     Code body_code = body->Compile(fctx);
+    if (ctx.options.pack_frames)
+        fctx.AllocateFrame(body_code);
 
     // prolouge
-    code += tab + "addu $sp, $sp, " + std::to_string(-*fctx.stack_depth) + "\n";
-    code += tab + "move $fp, $sp\n";
+    code += Instruction(Opcode::Addu, "$sp", "$sp", -fctx.stack_depth);
+    code += Instruction(Opcode::Move, "$fp", "$sp");
 
-    code += body_code;
+    code += std::move(body_code);
 
     // epilouge
-    code += fctx.epilouge_label + ":\n";
-    code += tab + "move $sp, $fp\n";
-    code += tab + "addu $sp, $sp, " + std::to_string(*fctx.stack_depth) + "\n";
+    code += Instruction::Label(fctx.epilouge_label);
+    code += Instruction(Opcode::Move, "$sp", "$fp");
+    code += Instruction(Opcode::Addu, "$sp", "$sp", fctx.stack_depth);
     if (*type == *void_type)
-        code += tab + "j " + ctx["exit"]->name + "\n";
+        code += Instruction(Opcode::J, Operand::Label(ctx["exit"]->name));
     else
-        code += tab + "j " + ctx["exit2"]->name + "\n";
+        code += Instruction(Opcode::J, Operand::Label(ctx["exit2"]->name));
 
-    return code + "\n";
+    fctx.LayoutFrame(code);
+    return code;
 }
 
-Code Program::Compile(function<void(const Location&, const string&, const string&)> printer)
+// everything the code of a function depends on besides its own text
+string FunctionDefinition::CacheKey(GlobalContext& ctx)
 {
-    GlobalContext ctx;
-    ctx.printer = printer;
+    std::ostringstream key;
+    // a different build of the compiler may generate different code
+    key << "compiler " << __DATE__ << " " << __TIME__ << "\n";
+    key << "options " << ctx.options.hoist_bounds_checks << ctx.options.tail_calls << ctx.options.pack_frames
+        << " " << ctx.options.inline_limit << "\n";
+    key << (dynamic_cast<MainFunctionDefinition*>(this) ? "main\n" : "");
+    Tree(key);
+
+    // the globals named in the body as they are declared, and the constants propagated from them
+    set<string> names;
+    body->Walk([&](Statement& statement) {
+        if (auto variable = dynamic_cast<VariableExpression*>(&statement))
+        {
+            names.insert(variable->name);
+            if (variable->constant)
+                key << "constant " << variable->name << " = " << variable->constant_value << "\n";
+        }
+        else if (auto access = dynamic_cast<ArrayAccessExpression*>(&statement))
+            names.insert(access->name);
+        else if (auto call = dynamic_cast<FunctionCallExpression*>(&statement))
+            names.insert(call->name);
+    });
+    for (auto& name : names)
+    {
+        auto symbol = ctx[name];
+        if (symbol == nullptr)
+            key << "undeclared " << name << "\n";
+        else if (auto function = std::dynamic_pointer_cast<FunctionSymbol>(symbol))
+        {
+            key << "function " << name << " : " << function->type->Name() << " (";
+            for (auto& param_type : function->param_types)
+                key << param_type->Name() << ",";
+            key << ")" << (function->builtin ? " builtin" : "") << "\n";
+            // the code of an inlined function is part of the code of its callers
+            if (function->inlined != nullptr)
+                key << "inlined\n" << function->inlined->CacheKey(ctx);
+        }
+        else
+            key << "variable " << name << " : " << symbol->type->Name() << "\n";
+    }
+    return key.str();
+}
 
-    // define builtin function (syscalls)
-    Location builtin_location;
-    builtin_location.initialize(&builtin_filename);
-    ctx.DeclareFunction(FunctionSymbol("print_string", void_type, { char_pointer_type }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("print_char", void_type, { char_type }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("print_int", void_type, { int_type }, builtin_location));
-    
-    ctx.DeclareFunction(FunctionSymbol("read_string", void_type, { char_pointer_type, int_type }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("read_char", char_type, { }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("read_int", int_type, { }, builtin_location));
+Module FunctionDefinition::Compile(GlobalContext& ctx)
+{
+    bool global = dynamic_cast<MainFunctionDefinition*>(this) != nullptr;
+    Module module;
+    if (ctx.options.cache_directory.empty())
+    {
+        Code code = Generate(ctx);
+        module.AppendFunction(std::move(code), global, std::move(ctx.jump_tables));
+        return module;
+    }
 
-    ctx.DeclareFunction(FunctionSymbol("exit", void_type, { }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("exit2", void_type, { int_type }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("$out_of_bounds_error", void_type, { int_type }, builtin_location));
+    CodeCache cache(ctx.options.cache_directory);
+    string key = CacheKey(ctx);
+    Code code;
+    vector<JumpTable> jump_tables;
+    if (cache.Load(key, code, jump_tables))
+    {
+        module.AppendFunction(std::move(code), global, std::move(jump_tables));
+        return module;
+    }
 
-    ctx.current_section = "text";
-    Code code = ".data\n";
-    code += ".align 2 # word align\n\n";
-    code += ".text\n";
-    code += tab + "j main # entry point\n\n";
+    // warnings are not kept with the code, so a function reporting any is always generated again
+    bool reported = false;
+    auto printer = ctx.printer;
+    ctx.printer = [&reported, printer](const Location& location, const string& message, const string& type) {
+        reported = true;
+        printer(location, message, type);
+    };
+    code = Generate(ctx);
+    if (!reported)
+        cache.Store(key, code, ctx.jump_tables);
+    module.AppendFunction(std::move(code), global, std::move(ctx.jump_tables));
+    return module;
+}
 
-    for (auto d : definitions)
-        code += d->Compile(ctx);
+// run task(0) to task(count - 1) on up to jobs threads, each taking the next index left
+static void ParallelFor(size_t count, size_t jobs, const function<void(size_t)>& task)
+{
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min(jobs, count);
+    if (jobs <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
 
-    
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+            task(i);
+    };
+    vector<std::thread> threads;
+    for (size_t i = 1; i < jobs; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+const vector<shared_ptr<FunctionSymbol>>& Program::Builtins()
+{
+    static const vector<shared_ptr<FunctionSymbol>> builtins = []() {
+        Location builtin_location;
+        builtin_location.initialize(&builtin_filename);
+        auto builtin = [&builtin_location](const string& name, shared_ptr<SymbolType> type,
+            vector<shared_ptr<SymbolType>> param_types) {
+            return std::make_shared<FunctionSymbol>(name, type, param_types, builtin_location, true);
+        };
+
+        // syscalls
+        return vector<shared_ptr<FunctionSymbol>> {
+            builtin("print_string", void_type, { char_pointer_type }),
+            builtin("print_char", void_type, { char_type }),
+            builtin("print_int", void_type, { int_type }),
+
+            builtin("read_string", void_type, { char_pointer_type, int_type }),
+            builtin("read_char", char_type, { }),
+            builtin("read_int", int_type, { }),
+
+            builtin("exit", void_type, { }),
+            builtin("exit2", void_type, { int_type }),
+            builtin("$out_of_bounds_error", void_type, { int_type }),
+        };
+    }();
+    return builtins;
+}
+
+// the routines of a builtins file, see Program::BuiltinAssembly
+static vector<std::pair<string, string>> ReadBuiltins(const string& filename)
+{
     std::ifstream builtinsfile;
     builtinsfile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
     try
     {
-        builtinsfile.open(builtin_asm_filename);
+        builtinsfile.open(filename);
     }
     catch (const std::ifstream::failure& er)
     {
-        throw std::runtime_error("Unable to open file \"" + builtin_asm_filename + "\": " + er.what());
+        throw std::runtime_error("Unable to open file \"" + filename + "\": " + er.what());
     }
 
     std::stringstream builtins_buffer;
     builtins_buffer << builtinsfile.rdbuf();
-    code += builtins_buffer.str();
 
-    return code;
+    // each piece starts with the section it is in, a label begins a line and is followed by a colon
+    vector<std::pair<string, string>> pieces;
+    string section = ".text", line;
+    while (std::getline(builtins_buffer, line))
+    {
+        size_t start = line.find_first_not_of(" \t");
+        if (start != string::npos && (line.compare(start, 5, ".text") == 0 || line.compare(start, 5, ".data") == 0))
+        {
+            section = line.substr(start, 5);
+            continue;
+        }
+        size_t colon = line.find(':');
+        if (start == 0 && line[0] != '#' && colon != string::npos)
+            pieces.emplace_back(line.substr(0, colon), section + "\n");
+        if (!pieces.empty())
+            pieces.back().second += line + "\n";
+    }
+    return pieces;
+}
+
+const vector<std::pair<string, string>>& Program::BuiltinAssembly(bool buffered_output)
+{
+    if (buffered_output)
+    {
+        static const vector<std::pair<string, string>> assembly = ReadBuiltins(buffered_builtin_asm_filename);
+        return assembly;
+    }
+    static const vector<std::pair<string, string>> assembly = ReadBuiltins(builtin_asm_filename);
+    return assembly;
+}
+
+Module Program::Compile(function<void(const Location&, const string&, const string&)> printer,
+    const CompileOptions& options)
+{
+    GlobalContext ctx;
+    ctx.printer = printer;
+    ctx.options = options;
+
+    PropagateConstants();
+    InlineCalls(options.inline_limit);
+
+    for (auto& builtin : Builtins())
+        ctx.DeclareBuiltin(builtin);
+
+    Module module;
+    module.Append(Module::Section::Data, Instruction::Directive(".align", { 2 }));
+    module.Append(Module::Section::Text,
+        Code(Instruction::Comment("entry point")) + Instruction(Opcode::J, Operand::Label("main")));
+
+    // declare every definition in order, up to the first error
+    vector<GlobalContext> contexts;
+    std::exception_ptr declaration_error;
+    for (auto d : definitions)
+    {
+        try
+        {
+            contexts.push_back(ctx.ForDefinition(d->Declare(ctx)));
+        }
+        catch (const CompileError&)
+        {
+            declaration_error = std::current_exception();
+            break;
+        }
+    }
+
+    // compile the declared definitions in parallel, keeping what each one reports
+    struct Result
+    {
+        Module module;
+        vector<std::tuple<Location, string, string>> messages;
+        std::exception_ptr error;
+    };
+    vector<Result> results(contexts.size());
+    ParallelFor(contexts.size(), options.jobs, [&](size_t i) {
+        auto& result = results[i];
+        contexts[i].printer = [&result](const Location& location, const string& message, const string& type) {
+            result.messages.emplace_back(location, message, type);
+        };
+        try
+        {
+            result.module = definitions[i]->Compile(contexts[i]);
+        }
+        catch (...)
+        {
+            result.error = std::current_exception();
+        }
+    });
+
+    // put everything together in source order, as if compiled one after another,
+    // inlined functions are still compiled for their diagnostics
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        auto& result = results[i];
+        for (auto& [location, message, type] : result.messages)
+            printer(location, message, type);
+        if (result.error)
+            std::rethrow_exception(result.error);
+        auto function = std::dynamic_pointer_cast<FunctionDefinition>(definitions[i]);
+        if (function == nullptr || !function->inlined)
+            module.Append(std::move(result.module));
+    }
+    if (declaration_error)
+        std::rethrow_exception(declaration_error);
+
+    
+    for (auto& [label, assembly] : BuiltinAssembly(options.buffered_output))
+        module.AppendAssembly(assembly, label);
+
+    return module;
 }
@@ -3,6 +3,101 @@
 
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+
+// allocations are counted only while a time report is being made
+static std::atomic<bool> counting_allocations = false;
+static std::atomic<size_t> allocations = 0;
+
+void* operator new(size_t size)
+{
+    if (counting_allocations.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    std::free(memory);
+}
+
+
+yy::parser::symbol_type yylex(Driver& driver)
+{
+    driver.tokens++;
+    if (driver.time_report == Driver::TimeReport::None)
+        return yylex(driver, driver.scanner->state);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t start_allocations = allocations;
+    auto token = yylex(driver, driver.scanner->state);
+    driver.scan_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    driver.scan_allocations += allocations - start_allocations;
+    return token;
+}
+
+void Driver::Time(const std::string& name, const std::function<void()>& run)
+{
+    if (time_report == TimeReport::None)
+    {
+        run();
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t start_allocations = allocations;
+    run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    phases.push_back({ name, seconds, allocations - start_allocations });
+}
+
+void Driver::PrintTimeReport(std::ostream& out) const
+{
+    std::vector<std::pair<std::string, size_t>> counts = {
+        { "tokens", tokens }, { "nodes", arena.Allocations() }, { "symbols", counters.symbols },
+        { "temps", counters.temps }, { "labels", counters.labels }, { "output lines", output_lines },
+    };
+
+    if (time_report == TimeReport::Json)
+    {
+        out << "{\"phases\": [";
+        for (size_t i = 0; i < phases.size(); i++)
+            out << (i == 0 ? "" : ", ") << "{\"name\": \"" << phases[i].name << "\", \"seconds\": "
+                << phases[i].seconds << ", \"allocations\": " << phases[i].allocations << "}";
+        out << "], \"counts\": {";
+        for (size_t i = 0; i < counts.size(); i++)
+            out << (i == 0 ? "" : ", ") << "\"" << counts[i].first << "\": " << counts[i].second;
+        out << "}}\n";
+        return;
+    }
+
+    double total = 0;
+    for (auto& phase : phases)
+        total += phase.seconds;
+    out << std::left << std::setw(14) << "phase" << std::right << std::setw(12) << "seconds"
+        << std::setw(8) << "%" << std::setw(14) << "allocations" << "\n";
+    for (auto& phase : phases)
+        out << std::left << std::setw(14) << phase.name << std::right << std::fixed << std::setprecision(6)
+            << std::setw(12) << phase.seconds << std::setprecision(1) << std::setw(8)
+            << (total > 0 ? 100 * phase.seconds / total : 0) << std::setw(14) << phase.allocations << "\n";
+    out << std::left << std::setw(14) << "total" << std::right << std::setprecision(6) << std::setw(12) << total
+        << std::defaultfloat << "\n\n";
+    for (auto& [name, count] : counts)
+        out << std::left << std::setw(14) << name << std::right << std::setw(12) << count << "\n";
+}
 
 int Driver::Parse()
 {
@@ -12,11 +107,31 @@ int Driver::Parse()
     else
         friendly_filename = input_filename;
 
+    phases.clear();
+    counters.symbols = counters.temps = counters.labels = 0;
+    scan_seconds = 0;
+    scan_allocations = tokens = output_lines = 0;
+    counting_allocations = time_report != TimeReport::None;
+    options.counters = time_report != TimeReport::None ? &counters : nullptr;
+
     // initialize the scanner and parser and perform parsing
-    Scanner scanner(input_filename, friendly_filename, tokens_filename, trace_scanning);
+    source.Open(input_filename);
+    Scanner scanner(source, friendly_filename, tokens_filename, trace_scanning);
+    this->scanner = &scanner;
     yy::parser parse(*this);
     parse.set_debug_level(trace_parsing);
-    int result = parse();
+    NodeArena::Scope nodes(arena);
+    int result;
+    Time("parse", [&]() { result = parse(); });
+    this->scanner = nullptr;
+
+    // the time spent in the scanner is reported on its own
+    if (!phases.empty())
+    {
+        phases.rbegin()->seconds -= scan_seconds;
+        phases.rbegin()->allocations -= scan_allocations;
+        phases.insert(phases.end() - 1, { "scan", scan_seconds, scan_allocations });
+    }
     return result;
 }
 
@@ -29,7 +144,10 @@ int Driver::Scan()
         friendly_filename = input_filename;
 
     // initialize the scanner
-    Scanner scanner(input_filename, friendly_filename, tokens_filename, trace_scanning);
+    source.Open(input_filename);
+    Scanner scanner(source, friendly_filename, tokens_filename, trace_scanning);
+    this->scanner = &scanner;
+    int result = 0;
     try
     {
         // yylex() returns on every scanned token
@@ -40,9 +158,10 @@ int Driver::Scan()
     {
         // print the scan error and return error code
         PrintError(er.location, er.what());
-        return 1;
+        result = 1;
     }
-    return 0;
+    this->scanner = nullptr;
+    return result;
 }
 
 int Driver::Compile()
@@ -62,22 +181,29 @@ int Driver::Compile()
         throw std::runtime_error("Unable to open file \"" + program_filename + "\": " + er.what());
     }
     
-    std::ofstream astfile;
-    astfile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-    try
-    {
-        astfile.open(ast_filename, std::ofstream::trunc);
-    }
-    catch (const std::ofstream::failure& er)
+    if (!ast_filename.empty())
     {
-        throw std::runtime_error("Unable to open file \"" + program_filename + "\": " + er.what());
-    }
+        std::ofstream astfile;
+        astfile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        try
+        {
+            astfile.open(ast_filename, std::ofstream::trunc);
+        }
+        catch (const std::ofstream::failure& er)
+        {
+            throw std::runtime_error("Unable to open file \"" + program_filename + "\": " + er.what());
+        }
 
-    astfile << ast->Tree();
+        Time("tree dump", [&]() { ast->Tree(astfile); });
+    }
 
+    Module module;
     try
     {
-        outfile << ast->Compile(PrintError);
+        Time("codegen", [&]() { module = ast->Compile(
+            [this](const Location& location, const string& message, const string& type) {
+                PrintError(location, message, type);
+            }, options); });
     }
     catch(const CompileError& er)
     {
@@ -85,33 +211,106 @@ int Driver::Compile()
        return 1;
     }
 
+    PeepholeStats stats;
+    Time("peephole", [&]() {
+        module.RunPass([this, &stats](ControlFlowGraph& function) { Peephole(function, options.peephole, stats); });
+    });
+    if (peephole_stats)
+        std::cerr << stats;
+
+    if (options.remove_unreferenced)
+        Time("unreferenced", [&]() { module.RemoveUnreferenced(); });
+
+    if (!ir_filename.empty())
+    {
+        std::ofstream irfile;
+        irfile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        try
+        {
+            irfile.open(ir_filename, std::ofstream::trunc);
+        }
+        catch (const std::ofstream::failure& er)
+        {
+            throw std::runtime_error("Unable to open file \"" + ir_filename + "\": " + er.what());
+        }
+
+        Time("ir dump", [&]() { module.Dump(irfile); });
+    }
+
+    Time("output", [&]() {
+        if (time_report == TimeReport::None)
+        {
+            outfile << module;
+            return;
+        }
+        std::ostringstream text;
+        text << module;
+        string program = text.str();
+        output_lines = std::count(program.begin(), program.end(), '\n');
+        outfile << program;
+    });
+
     outfile.close();
     
     return 0;
 }
 
+int Driver::Batch(std::istream& jobs, std::ostream* replies, int (Driver::*run)())
+{
+    int failures = 0;
+    std::string line;
+    while (std::getline(jobs, line))
+    {
+        // one job per line, the input file and optionally the output file
+        std::istringstream fields(line);
+        std::string input, output;
+        if (!(fields >> input))
+            continue;
+        if (!(fields >> output))
+        {
+            auto extension = input.rfind('.');
+            auto directory = input.rfind('/');
+            if (directory != std::string::npos && extension < directory)
+                extension = std::string::npos;
+            output = input.substr(0, extension) + ".asm";
+        }
+        input_filename = input;
+        program_filename = output;
+
+        int result;
+        try
+        {
+            result = (this->*run)();
+        }
+        catch (const std::exception& ex)
+        {
+            std::cerr << ex.what() << std::endl;
+            result = 1;
+        }
+
+        // free the tree before its arena is reused by the next job
+        ast.reset();
+        arena.Reset();
+
+        if (result != 0)
+            failures++;
+        if (replies != nullptr)
+            *replies << (result == 0 ? "ok " : "error ") << input << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
 void Driver::PrintError(const yy::parser::location_type& location,
-    const std::string& message, const std::string& type)
+    const std::string& message, const std::string& type) const
 {
     // print error line and description
     std::cerr << location << ": " << type << ": " << message << std::endl;
 
-    // print lines containing the error only for real files, not standard input
-    if (location.begin.filename->empty())
-        return;
-        
-    // read the line containing the error and the line before
-    std::ifstream input_file(*location.begin.filename);
-    std::string line, last_line;
-    for (int i = 0; i < location.end.line; i++)
-    {
-        last_line = line;
-        std::getline(input_file, line);
-    }
-    if (input_file.fail()) // unable to read file
+    // the lines containing the error and the line before, if it is in the input and its position is known
+    if (location.begin.line < 1 || location.begin.column < 1 || location.end.column < 1
+        || location.end.line < 1 || size_t(location.end.line) > source.Lines())
         return;
-
-    input_file.close();
+    auto line = source.Line(location.end.line);
     
     // decide were to start the error marker
     auto begin_column = location.begin.column;
@@ -120,7 +319,7 @@ void Driver::PrintError(const yy::parser::location_type& location,
 
     // print the line before the error only if the error is not on line 1
     if (location.end.line > 1)
-        std::cerr << std::setw(5) << location.end.line - 1 << " | " << last_line << "\n";
+        std::cerr << std::setw(5) << location.end.line - 1 << " | " << source.Line(location.end.line - 1) << "\n";
 
     // print the error line
     std::cerr << std::setw(5) << location.end.line << " | " << line << "\n";
@@ -1,13 +1,21 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <functional>
 #include "parser.hpp"
 #include "ast.hpp"
+#include "source.hpp"
 
-// define the yylex function for the scanner and parser
-#define YY_DECL yy::parser::symbol_type yylex(Driver& driver)
+class Scanner;
+
+// define the yylex function for the scanner, it gets the state of the reentrant scanner
+#define YY_DECL yy::parser::symbol_type yylex(Driver& driver, void* yyscanner)
 YY_DECL;
 
+// the function called by the parser, scans with the scanner of the driver
+yy::parser::symbol_type yylex(Driver& driver);
+
 class Driver
 {
 public:
@@ -20,19 +28,68 @@ public:
 
     std::string input_filename;
     std::string friendly_filename;
-    std::string tokens_filename = "tokens.txt";
-    std::string ast_filename = "ast.txt";
+    // empty to skip dumping the tokens or the tree, the default
+    std::string tokens_filename;
+    std::string ast_filename;
     std::string program_filename = "out.asm";
+    // empty to skip dumping the intermediate representation
+    std::string ir_filename;
+
+    CompileOptions options;
+    // whether to print the number of rewrites made by each peephole rule
+    bool peephole_stats = false;
 
+    // report the time and allocations of each phase and the counts of what it made
+    enum class TimeReport { None, Text, Json };
+    TimeReport time_report = TimeReport::None;
+
+    // owns the nodes of the tree, so it is declared before it and outlives it
+    NodeArena arena;
     shared_ptr<Program> ast;
 
+    // the scanner of the running parse or scan, each driver has its own
+    Scanner* scanner = nullptr;
+
+    // the text of the last input parsed or scanned, kept for the lines printed with diagnostics
+    SourceBuffer source;
+
     int Parse();
 
     int Scan();
 
     int Compile();
 
-    // this method is called whenever a syntax error occurs in the parser or in the scanner
-    static void PrintError(const yy::parser::location_type& location,
-        const std::string& message, const std::string& type = "error");
+    // compile one file per line of jobs, "input [output]" with the output defaulting to the input
+    // with an .asm extension, and reply "ok input" or "error input" for each,
+    // the builtins and the arena are kept between jobs, run may instead only scan or parse each file
+    int Batch(std::istream& jobs, std::ostream* replies = nullptr, int (Driver::*run)() = &Driver::Compile);
+
+    // the report of the last parse or compile
+    void PrintTimeReport(std::ostream& out) const;
+
+    // this method is called whenever a syntax error occurs in the parser or in the scanner,
+    // and for the errors and warnings of codegen, which may report them from several threads
+    void PrintError(const yy::parser::location_type& location,
+        const std::string& message, const std::string& type = "error") const;
+
+private:
+    struct Phase
+    {
+        std::string name;
+        double seconds;
+        size_t allocations;
+    };
+    std::vector<Phase> phases;
+
+    // scanning is interleaved with parsing, so it is timed token by token
+    double scan_seconds = 0;
+    size_t scan_allocations = 0;
+    size_t tokens = 0;
+    size_t output_lines = 0;
+    CompileCounters counters;
+
+    // run a phase, timing it if a report is asked for
+    void Time(const std::string& name, const std::function<void()>& run);
+
+    friend yy::parser::symbol_type yylex(Driver& driver);
 };
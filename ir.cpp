@@ -0,0 +1,795 @@
+#include "ir.hpp"
+
+#include <map>
+#include <unordered_map>
+#include <cctype>
+#include <algorithm>
+#include <type_traits>
+#include <iterator>
+#include <cstdint>
+#include <mutex>
+
+
+Operand Operand::Label(const string& label)
+{
+    Operand operand;
+    operand.kind = Kind::Label;
+    operand.name = label;
+    return operand;
+}
+
+Operand Operand::String(const string& literal)
+{
+    Operand operand;
+    operand.kind = Kind::String;
+    operand.name = literal;
+    return operand;
+}
+
+Operand Operand::StackOffset(int offset)
+{
+    Operand operand(offset);
+    operand.frame_relocation = true;
+    return operand;
+}
+
+Operand Operand::Memory(const string& base, const Operand& offset)
+{
+    assert(offset.kind == Kind::Immediate);
+    Operand operand = offset;
+    operand.kind = Kind::Memory;
+    operand.base = base;
+    return operand;
+}
+
+Operand Operand::Global(const string& symbol, const string& base)
+{
+    Operand operand;
+    operand.kind = Kind::Memory;
+    operand.name = symbol;
+    operand.base = base;
+    return operand;
+}
+
+std::ostream& operator<<(std::ostream& out, const Operand& operand)
+{
+    switch (operand.kind)
+    {
+    case Operand::Kind::Register:
+    case Operand::Kind::Label:
+        return out << operand.name;
+    case Operand::Kind::Immediate:
+        assert(!operand.frame_relocation);
+        return out << operand.value;
+    case Operand::Kind::String:
+        return out << '"' << operand.name << '"';
+    case Operand::Kind::Memory:
+        assert(!operand.frame_relocation);
+        out << operand.name;
+        if (operand.name.empty())
+            out << operand.value;
+        else if (operand.value != 0)
+            out << (operand.value > 0 ? "+" : "") << operand.value;
+        if (!operand.base.empty())
+            out << '(' << operand.base << ')';
+        return out;
+    case Operand::Kind::None:
+        return out;
+    }
+    return out;
+}
+
+
+static const char* const mnemonics[] = {
+    "", "", "",
+    "li", "la", "lw", "lb", "lbu", "sw", "sb",
+    "move", "negu", "not",
+    "addu", "subu", "mul", "divu", "and", "or", "xor", "nor", "sll", "srl", "sra", "slt", "sltu", "seq", "sne",
+    "addiu", "andi", "ori", "xori", "slti", "sltiu",
+    "mult", "multu", "mfhi", "mflo",
+    "beq", "bne", "blt", "ble", "bgt", "bge", "bltu", "bleu", "bgtu", "bgeu",
+    "beqz", "bnez", "bltz", "bgez", "bgtz", "blez",
+    "b", "j", "jal", "jr",
+    "syscall",
+};
+
+static_assert(sizeof(mnemonics) / sizeof(*mnemonics) == size_t(Opcode::Syscall) + 1,
+    "every opcode needs a mnemonic");
+
+Instruction::Instruction(Opcode opcode, Operand a, Operand b, Operand c)
+    : opcode(opcode)
+{
+    for (auto& operand : { a, b, c })
+        if (operand.kind != Operand::Kind::None)
+            operands.push_back(operand);
+}
+
+Instruction Instruction::Label(const string& name)
+{
+    Instruction instruction(Opcode::Label);
+    instruction.text = name;
+    return instruction;
+}
+
+Instruction Instruction::Directive(const string& name, const vector<Operand>& operands)
+{
+    Instruction instruction(Opcode::Directive);
+    instruction.text = name;
+    for (auto& operand : operands)
+        instruction.operands.push_back(operand);
+    return instruction;
+}
+
+Instruction Instruction::Comment(const string& text)
+{
+    Instruction instruction(Opcode::Comment);
+    instruction.text = text;
+    return instruction;
+}
+
+const char* Instruction::Mnemonic() const
+{
+    if (opcode == Opcode::Directive)
+        return text.c_str();
+    return mnemonics[size_t(opcode)];
+}
+
+bool Instruction::IsLoad() const
+{
+    return opcode == Opcode::Lw || opcode == Opcode::Lb || opcode == Opcode::Lbu;
+}
+
+bool Instruction::IsStore() const
+{
+    return opcode == Opcode::Sw || opcode == Opcode::Sb;
+}
+
+bool Instruction::IsBranch() const
+{
+    return opcode >= Opcode::Beq && opcode <= Opcode::Blez;
+}
+
+bool Instruction::IsJump() const
+{
+    return opcode == Opcode::B || opcode == Opcode::J || opcode == Opcode::Jr;
+}
+
+string Instruction::Target() const
+{
+    if ((IsBranch() || IsJump() || IsCall()) && !operands.empty()
+        && operands.back().kind == Operand::Kind::Label)
+        return operands.back().name;
+    return "";
+}
+
+std::ostream& operator<<(std::ostream& out, const Instruction& instruction)
+{
+    switch (instruction.opcode)
+    {
+    case Opcode::Label:
+        return out << instruction.text << ":\n";
+    case Opcode::Comment:
+        return out << tab << "# " << instruction.text << "\n";
+    case Opcode::Directive:
+        // data allocations are indented, the others are not
+        if (instruction.text != ".globl" && instruction.text != ".align")
+            out << tab;
+        break;
+    default:
+        out << tab;
+    }
+
+    out << instruction.Mnemonic();
+    for (size_t i = 0; i < instruction.operands.size(); i++)
+        out << (i == 0 ? " " : ", ") << instruction.operands[i];
+    return out << "\n";
+}
+
+
+// nodes are carved out of large blocks and recycled through a free list of each thread,
+// so building code does not hit the heap for every instruction, a thread hands batches
+// of nodes back to a free list shared by all threads when it holds too many and when it
+// ends, code built on one thread and freed on another is thus reused all the same
+namespace
+{
+    template<typename Node>
+    class NodePool
+    {
+    public:
+        // nodes are moved between the free lists in chains of this many
+        static constexpr size_t batch = 1024;
+
+        // the blocks and free list shared by all threads
+        class Shared
+        {
+        public:
+            // a chain of batch free nodes, carving a new block if there are not enough
+            Node* Take()
+            {
+                std::lock_guard lock(mutex);
+                if (count < batch)
+                {
+                    blocks.push_back(std::make_unique<Storage[]>(batch));
+                    for (size_t i = 0; i < batch; i++)
+                    {
+                        Node* node = reinterpret_cast<Node*>(&blocks.rbegin()->get()[i]);
+                        node->next = free_list;
+                        free_list = node;
+                    }
+                    count += batch;
+                }
+                Node* chain = free_list;
+                free_list = Split(chain, batch);
+                count -= batch;
+                return chain;
+            }
+
+            void Give(Node* chain, size_t length)
+            {
+                Node* last = chain;
+                while (last->next != nullptr)
+                    last = last->next;
+                std::lock_guard lock(mutex);
+                last->next = free_list;
+                free_list = chain;
+                count += length;
+            }
+
+        private:
+            using Storage = std::aligned_storage_t<sizeof(Node), alignof(Node)>;
+
+            std::mutex mutex;
+            vector<std::unique_ptr<Storage[]>> blocks;
+            Node* free_list = nullptr;
+            size_t count = 0;
+        };
+
+        ~NodePool()
+        {
+            if (free_list != nullptr)
+                SharedPool().Give(free_list, count);
+        }
+
+        Node* Allocate()
+        {
+            if (free_list == nullptr)
+            {
+                free_list = SharedPool().Take();
+                count = batch;
+            }
+            Node* node = free_list;
+            free_list = node->next;
+            count--;
+            return node;
+        }
+
+        void Release(Node* node)
+        {
+            node->next = free_list;
+            free_list = node;
+            // keep the nodes released last for the next allocations and give back the older batch
+            if (++count == 2 * batch)
+            {
+                Node* chain = Split(free_list, batch);
+                SharedPool().Give(chain, batch);
+                count = batch;
+            }
+        }
+
+    private:
+        // cut a chain after length nodes and return the rest
+        static Node* Split(Node* chain, size_t length)
+        {
+            for (size_t i = 1; i < length; i++)
+                chain = chain->next;
+            Node* rest = chain->next;
+            chain->next = nullptr;
+            return rest;
+        }
+
+        // never destroyed, as the pools of threads still running give back to it at exit
+        static Shared& SharedPool()
+        {
+            static Shared& shared = *new Shared();
+            return shared;
+        }
+
+        Node* free_list = nullptr;
+        size_t count = 0;
+    };
+}
+
+template<typename Node>
+static NodePool<Node>& Pool()
+{
+    static thread_local NodePool<Node> pool;
+    return pool;
+}
+
+Code::Node* Code::NewNode(const Instruction& instruction)
+{
+    Node* node = Pool<Node>().Allocate();
+    return new (node) Node{ instruction };
+}
+
+void Code::FreeNodes(Node* head)
+{
+    auto& pool = Pool<Node>();
+    while (head != nullptr)
+    {
+        Node* next = head->next;
+        head->~Node();
+        pool.Release(head);
+        head = next;
+    }
+}
+
+Code::Code(const Code& other)
+{
+    for (auto& instruction : other)
+        *this += Code(instruction);
+}
+
+
+const Instruction* BasicBlock::Terminator() const
+{
+    if (!instructions.empty() && instructions.rbegin()->IsTerminator())
+        return &*instructions.rbegin();
+    return nullptr;
+}
+
+
+ControlFlowGraph::ControlFlowGraph(const string& name, Code code, vector<JumpTable> jump_tables)
+    : name(name), jump_tables(std::move(jump_tables))
+{
+    // a block starts at every label and right after every branch or jump
+    BasicBlock* current = nullptr;
+    for (auto& instruction : code)
+    {
+        if (instruction.opcode == Opcode::Label)
+        {
+            if (current == nullptr || !current->instructions.empty())
+            {
+                blocks.push_back(std::make_unique<BasicBlock>());
+                current = blocks.rbegin()->get();
+            }
+            current->labels.push_back(instruction.text);
+            continue;
+        }
+
+        if (current == nullptr)
+        {
+            blocks.push_back(std::make_unique<BasicBlock>());
+            current = blocks.rbegin()->get();
+        }
+        bool terminator = instruction.IsTerminator();
+        current->instructions.push_back(std::move(instruction));
+
+        if (terminator)
+            current = nullptr;
+    }
+
+    Connect();
+}
+
+void ControlFlowGraph::Connect()
+{
+    std::map<string, BasicBlock*> labels;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        blocks[i]->index = i;
+        blocks[i]->successors.clear();
+        blocks[i]->predecessors.clear();
+        for (auto& label : blocks[i]->labels)
+            labels[label] = blocks[i].get();
+    }
+
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        BasicBlock* block = blocks[i].get();
+        const Instruction* terminator = block->Terminator();
+
+        // jumps out of the function (e.g. to exit) have no successor
+        if (terminator != nullptr)
+        {
+            auto target = labels.find(terminator->Target());
+            if (target != labels.end())
+                block->successors.push_back(target->second);
+        }
+
+        // an indirect jump may go to any entry of its table
+        if (terminator != nullptr && terminator->opcode == Opcode::Jr && !terminator->text.empty())
+            for (auto& table : jump_tables)
+                if (table.label == terminator->text)
+                    for (auto& entry : table.targets)
+                    {
+                        auto target = labels.find(entry);
+                        if (target != labels.end() && std::find(block->successors.begin(),
+                            block->successors.end(), target->second) == block->successors.end())
+                            block->successors.push_back(target->second);
+                    }
+
+        // everything except unconditional jumps may fall through
+        if ((terminator == nullptr || terminator->IsBranch()) && i + 1 < blocks.size())
+            if (std::find(block->successors.begin(), block->successors.end(), blocks[i + 1].get())
+                == block->successors.end())
+                block->successors.push_back(blocks[i + 1].get());
+
+        for (auto successor : block->successors)
+            successor->predecessors.push_back(block);
+    }
+}
+
+BasicBlock* ControlFlowGraph::FindBlock(const string& label) const
+{
+    for (auto& block : blocks)
+        if (std::find(block->labels.begin(), block->labels.end(), label) != block->labels.end())
+            return block.get();
+    return nullptr;
+}
+
+vector<BasicBlock*> ControlFlowGraph::Dominators() const
+{
+    vector<BasicBlock*> dominators(blocks.size(), nullptr);
+    if (blocks.empty())
+        return dominators;
+
+    // reverse postorder of the blocks reachable from the entry
+    vector<BasicBlock*> order;
+    vector<size_t> position(blocks.size(), SIZE_MAX);
+    vector<bool> visited(blocks.size(), false);
+    vector<std::pair<BasicBlock*, size_t>> stack = { { blocks[0].get(), 0 } };
+    visited[0] = true;
+    while (!stack.empty())
+    {
+        auto& [block, next] = stack.back();
+        if (next < block->successors.size())
+        {
+            BasicBlock* successor = block->successors[next++];
+            if (!visited[successor->index])
+            {
+                visited[successor->index] = true;
+                stack.emplace_back(successor, 0);
+            }
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    std::reverse(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); i++)
+        position[order[i]->index] = i;
+
+    // Cooper, Harvey and Kennedy, a simple, fast dominance algorithm
+    auto intersect = [&](BasicBlock* a, BasicBlock* b) {
+        while (a != b)
+        {
+            while (position[a->index] > position[b->index])
+                a = dominators[a->index];
+            while (position[b->index] > position[a->index])
+                b = dominators[b->index];
+        }
+        return a;
+    };
+    dominators[0] = blocks[0].get();
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++)
+        {
+            BasicBlock* dominator = nullptr;
+            for (auto predecessor : order[i]->predecessors)
+                if (dominators[predecessor->index] != nullptr)
+                    dominator = dominator == nullptr ? predecessor : intersect(predecessor, dominator);
+            if (dominators[order[i]->index] != dominator)
+            {
+                dominators[order[i]->index] = dominator;
+                changed = true;
+            }
+        }
+    }
+    return dominators;
+}
+
+vector<Loop> ControlFlowGraph::Loops() const
+{
+    auto dominators = Dominators();
+    auto dominates = [&](BasicBlock* a, BasicBlock* b) {
+        for (;;)
+        {
+            if (a == b)
+                return true;
+            if (dominators[b->index] == b)
+                return false;
+            b = dominators[b->index];
+        }
+    };
+
+    // the blocks of the loops, merged for back edges to the same header
+    std::map<size_t, vector<bool>> members;
+    for (auto& block : blocks)
+    {
+        if (dominators[block->index] == nullptr)
+            continue;
+        for (auto header : block->successors)
+        {
+            if (!dominates(header, block.get()))
+                continue;
+            auto& member = members[header->index];
+            member.resize(blocks.size(), false);
+            member[header->index] = true;
+            vector<BasicBlock*> work;
+            if (!member[block->index])
+                work.push_back(block.get());
+            while (!work.empty())
+            {
+                BasicBlock* current = work.back();
+                work.pop_back();
+                if (member[current->index])
+                    continue;
+                member[current->index] = true;
+                for (auto predecessor : current->predecessors)
+                    if (!member[predecessor->index] && dominators[predecessor->index] != nullptr)
+                        work.push_back(predecessor);
+            }
+        }
+    }
+
+    vector<Loop> loops;
+    for (auto& [header, member] : members)
+    {
+        Loop loop;
+        loop.header = blocks[header].get();
+        for (auto& block : blocks)
+            if (member[block->index])
+                loop.blocks.push_back(block.get());
+        loops.push_back(std::move(loop));
+    }
+    // a loop inside another has fewer blocks
+    std::stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) {
+        return a.blocks.size() < b.blocks.size();
+    });
+    return loops;
+}
+
+Code ControlFlowGraph::Linearize() const
+{
+    Code code;
+    for (auto& block : blocks)
+    {
+        for (auto& label : block->labels)
+            code += Instruction::Label(label);
+        for (auto& instruction : block->instructions)
+            code += instruction;
+    }
+    return code;
+}
+
+void ControlFlowGraph::Print(std::ostream& out) const
+{
+    for (auto& block : blocks)
+    {
+        for (auto& label : block->labels)
+            out << label << ":\n";
+        for (auto& instruction : block->instructions)
+            out << instruction;
+    }
+}
+
+void ControlFlowGraph::Dump(std::ostream& out) const
+{
+    out << "function " << name << "\n";
+    for (auto& block : blocks)
+    {
+        out << tab << "block " << block->index;
+        for (auto& label : block->labels)
+            out << " " << label;
+        out << " <-";
+        if (block->predecessors.empty())
+            out << (block->index == 0 ? " entry" : " none");
+        for (auto predecessor : block->predecessors)
+            out << " " << predecessor->index;
+        out << " ->";
+        if (block->successors.empty())
+            out << " exit";
+        for (auto successor : block->successors)
+            out << " " << successor->index;
+        out << "\n";
+
+        for (auto& instruction : block->instructions)
+            out << tab << instruction;
+    }
+
+    for (auto& table : jump_tables)
+    {
+        out << tab << "table " << table.label << ":";
+        for (auto& target : table.targets)
+            out << " " << target;
+        out << "\n";
+    }
+}
+
+void ControlFlowGraph::PrintJumpTables(std::ostream& out) const
+{
+    for (auto& table : jump_tables)
+    {
+        out << table.label << ":\n" << tab << ".word";
+        for (size_t i = 0; i < table.targets.size(); i++)
+            out << (i == 0 ? " " : ", ") << table.targets[i];
+        out << "\n";
+    }
+}
+
+
+void Module::Append(Section section, Code code)
+{
+    Unit unit = { section };
+    if (!code.Empty() && code.begin()->opcode == Opcode::Label)
+        unit.name = code.begin()->text;
+    unit.code = std::move(code);
+    units.push_back(std::move(unit));
+}
+
+void Module::AppendFunction(Code code, bool global, vector<JumpTable> jump_tables)
+{
+    assert(!code.Empty() && code.begin()->opcode == Opcode::Label);
+    string name = code.begin()->text;
+
+    Unit unit = { Section::Text };
+    unit.function = std::make_shared<ControlFlowGraph>(name, std::move(code), std::move(jump_tables));
+    unit.global = global;
+    unit.name = name;
+    units.push_back(std::move(unit));
+}
+
+void Module::AppendAssembly(const string& assembly, const string& name)
+{
+    Unit unit = { Section::Text };
+    unit.assembly = assembly;
+    unit.name = name;
+    units.push_back(std::move(unit));
+}
+
+void Module::Append(Module&& other)
+{
+    std::move(other.units.begin(), other.units.end(), std::back_inserter(units));
+    other.units.clear();
+}
+
+void Module::RunPass(const function<void(ControlFlowGraph&)>& pass)
+{
+    for (auto& unit : units)
+        if (unit.function)
+            pass(*unit.function);
+}
+
+// the labels and globals an instruction names
+static void References(const Instruction& instruction, vector<string>& names)
+{
+    for (auto& operand : instruction.operands)
+        if ((operand.kind == Operand::Kind::Label || operand.kind == Operand::Kind::Memory) && !operand.name.empty())
+            names.push_back(operand.name);
+}
+
+size_t Module::RemoveUnreferenced()
+{
+    std::unordered_map<string, size_t> defined;
+    for (size_t i = 0; i < units.size(); i++)
+        if (!units[i].name.empty())
+            defined[units[i].name] = i;
+
+    vector<bool> kept(units.size(), false);
+    vector<size_t> work;
+    for (size_t i = 0; i < units.size(); i++)
+        if (units[i].name.empty())
+        {
+            kept[i] = true;
+            work.push_back(i);
+        }
+
+    while (!work.empty())
+    {
+        auto& unit = units[work.back()];
+        work.pop_back();
+
+        vector<string> names;
+        if (unit.function)
+        {
+            for (auto& block : unit.function->blocks)
+                for (auto& instruction : block->instructions)
+                    References(instruction, names);
+        }
+        else if (!unit.assembly.empty())
+        {
+            // any word of verbatim assembly may be a label
+            string word;
+            for (char c : unit.assembly + "\n")
+                if (std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$')
+                    word += c;
+                else if (!word.empty())
+                {
+                    names.push_back(word);
+                    word.clear();
+                }
+        }
+        else
+            for (auto& instruction : unit.code)
+                References(instruction, names);
+
+        for (auto& name : names)
+        {
+            auto found = defined.find(name);
+            if (found != defined.end() && !kept[found->second])
+            {
+                kept[found->second] = true;
+                work.push_back(found->second);
+            }
+        }
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < units.size(); i++)
+        if (kept[i] && count++ != i)
+            units[count - 1] = std::move(units[i]);
+    size_t removed = units.size() - count;
+    units.resize(count);
+    return removed;
+}
+
+void Module::Dump(std::ostream& out) const
+{
+    for (auto& unit : units)
+    {
+        if (unit.function)
+            unit.function->Dump(out);
+        else if (!unit.assembly.empty())
+            out << "assembly" << (unit.name.empty() ? "" : " " + unit.name) << "\n" << tab << std::count(unit.assembly.begin(), unit.assembly.end(), '\n') << " lines\n";
+        else
+        {
+            out << (unit.section == Module::Section::Data ? "data\n" : "text\n");
+            for (auto& instruction : unit.code)
+                out << tab << instruction;
+        }
+        out << "\n";
+    }
+}
+
+std::ostream& operator<<(std::ostream& out, const Module& module)
+{
+    bool text = false, known = false;
+    for (auto& unit : module.units)
+    {
+        // verbatim assembly is appended as is, with its own section directives
+        if (!unit.assembly.empty())
+        {
+            out << unit.assembly;
+            known = false;
+            continue;
+        }
+
+        bool unit_text = unit.section == Module::Section::Text;
+        if (!known || unit_text != text)
+            out << (unit_text ? ".text\n" : ".data\n");
+        text = unit_text;
+        known = true;
+
+        if (unit.function)
+        {
+            if (unit.global)
+                out << ".globl " << unit.function->name << "\n";
+            unit.function->Print(out);
+
+            // jump tables follow their function in the data section
+            if (!unit.function->jump_tables.empty())
+            {
+                out << "\n.data\n";
+                unit.function->PrintJumpTables(out);
+                text = false;
+            }
+        }
+        else
+            out << unit.code;
+        out << "\n";
+    }
+    return out;
+}
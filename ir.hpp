@@ -0,0 +1,353 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <functional>
+
+using std::string, std::vector, std::shared_ptr, std::function;
+
+
+enum class Opcode
+{
+    // pseudo instructions
+    Label, Directive, Comment,
+
+    // loads and stores
+    Li, La, Lw, Lb, Lbu, Sw, Sb,
+
+    // arithmetic and logic
+    Move, Negu, Not,
+    Addu, Subu, Mul, Divu, And, Or, Xor, Nor, Sll, Srl, Sra, Slt, Sltu, Seq, Sne,
+    Addiu, Andi, Ori, Xori, Slti, Sltiu,
+    Mult, Multu, Mfhi, Mflo,
+
+    // control flow
+    Beq, Bne, Blt, Ble, Bgt, Bge, Bltu, Bleu, Bgtu, Bgeu,
+    Beqz, Bnez, Bltz, Bgez, Bgtz, Blez,
+    B, J, Jal, Jr,
+    Syscall,
+};
+
+
+class Operand
+{
+public:
+    enum class Kind { None, Register, Immediate, Label, Memory, String };
+
+    Operand() {}
+
+    // register operand, e.g. "$v0"
+    Operand(const char* reg) : Operand(string(reg)) {}
+    Operand(const string& reg) : kind(Kind::Register), name(reg)
+    {
+        assert(!reg.empty() && reg[0] == '$');
+    }
+
+    // immediate operand
+    Operand(int value) : kind(Kind::Immediate), value(value) {}
+
+    static Operand Label(const string& label);
+
+    static Operand String(const string& literal);
+
+    // an immediate only known once the frame of the function is laid out
+    static Operand StackOffset(int offset);
+
+    // offset(base), offset may be a stack offset
+    static Operand Memory(const string& base, const Operand& offset = 0);
+
+    // symbol(base), base may be empty
+    static Operand Global(const string& symbol, const string& base = "");
+
+    Kind kind = Kind::None;
+    string name; // register, label, string literal or symbol of a memory operand
+    string base; // base register of a memory operand
+    int value = 0; // immediate or offset of a memory operand
+    bool frame_relocation = false; // if set, value counts down from the top of the frame
+
+    // patch a pending frame relocation once the size of the frame is known
+    void Relocate(int frame_size)
+    {
+        if (frame_relocation)
+        {
+            value = frame_size - value;
+            frame_relocation = false;
+        }
+    }
+
+    bool IsRegister(const string& reg) const { return kind == Kind::Register && name == reg; }
+
+    bool operator==(const Operand& other) const
+    {
+        return kind == other.kind && name == other.name && base == other.base
+            && value == other.value && frame_relocation == other.frame_relocation;
+    }
+    bool operator!=(const Operand& other) const { return !(*this == other); }
+
+    friend std::ostream& operator<<(std::ostream& out, const Operand& operand);
+};
+
+
+// the operands of an instruction, stored inline since there are at most three
+class OperandList
+{
+public:
+    static constexpr size_t capacity = 3;
+
+    void push_back(const Operand& operand)
+    {
+        assert(count < capacity);
+        operands[count++] = operand;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    Operand& operator[](size_t i) { return operands[i]; }
+    const Operand& operator[](size_t i) const { return operands[i]; }
+    Operand& back() { return operands[count - 1]; }
+    const Operand& back() const { return operands[count - 1]; }
+
+    Operand* begin() { return operands; }
+    Operand* end() { return operands + count; }
+    const Operand* begin() const { return operands; }
+    const Operand* end() const { return operands + count; }
+
+private:
+    Operand operands[capacity];
+    size_t count = 0;
+};
+
+
+// a single three-address machine instruction, a label or an assembler directive
+class Instruction
+{
+public:
+    Instruction(Opcode opcode, Operand a = Operand(), Operand b = Operand(), Operand c = Operand());
+
+    static Instruction Label(const string& name);
+
+    static Instruction Directive(const string& name, const vector<Operand>& operands = {});
+
+    static Instruction Comment(const string& text);
+
+    Opcode opcode;
+    string text; // name of a label or directive, text of a comment, jump table of an indirect jr
+    OperandList operands;
+
+    const char* Mnemonic() const;
+
+    bool IsPseudo() const { return opcode == Opcode::Label || opcode == Opcode::Directive || opcode == Opcode::Comment; }
+    bool IsLoad() const;
+    bool IsStore() const;
+    bool IsBranch() const; // conditional branches only
+    bool IsJump() const; // unconditional transfers, including jr
+    bool IsCall() const { return opcode == Opcode::Jal; }
+    bool IsTerminator() const { return IsBranch() || IsJump(); }
+
+    // the label a branch or jump transfers to, empty for jr and other instructions
+    string Target() const;
+
+    friend std::ostream& operator<<(std::ostream& out, const Instruction& instruction);
+};
+
+
+// a sequence of instructions kept as a singly linked list of pooled nodes,
+// appending a temporary splices it in O(1) instead of copying it
+class Code
+{
+private:
+    struct Node
+    {
+        Instruction instruction;
+        Node* next = nullptr;
+    };
+
+    Node* head = nullptr;
+    Node* tail = nullptr;
+
+    static Node* NewNode(const Instruction& instruction);
+    static void FreeNodes(Node* head);
+
+public:
+    class Iterator
+    {
+    public:
+        Iterator(Node* node) : node(node) {}
+        Instruction& operator*() const { return node->instruction; }
+        Instruction* operator->() const { return &node->instruction; }
+        Iterator& operator++() { node = node->next; return *this; }
+        bool operator!=(const Iterator& other) const { return node != other.node; }
+    private:
+        Node* node;
+    };
+
+    Code() {}
+
+    Code(const Instruction& instruction)
+    {
+        head = tail = NewNode(instruction);
+    }
+
+    Code(const Code& other);
+    Code(Code&& other) : head(other.head), tail(other.tail)
+    {
+        other.head = other.tail = nullptr;
+    }
+
+    Code& operator=(Code other)
+    {
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+        return *this;
+    }
+
+    ~Code() { FreeNodes(head); }
+
+    bool Empty() const { return head == nullptr; }
+
+    Iterator begin() const { return Iterator(head); }
+    Iterator end() const { return Iterator(nullptr); }
+
+    friend Code& operator+=(Code& left, Code right);
+    friend Code operator+(Code left, Code right);
+    friend std::ostream& operator<<(std::ostream& out, const Code& code);
+};
+
+inline Code& operator+=(Code& left, Code right)
+{
+    if (right.head == nullptr)
+        return left;
+    if (left.head == nullptr)
+        left.head = right.head;
+    else
+        left.tail->next = right.head;
+    left.tail = right.tail;
+    right.head = right.tail = nullptr;
+    return left;
+}
+
+inline Code operator+(Code left, Code right)
+{
+    left += std::move(right);
+    return left;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const Code& code)
+{
+    for (auto& i : code)
+        out << i;
+    return out;
+}
+
+inline const string& tab = "    ";
+
+
+// a straight-line sequence of instructions entered only through its labels
+class BasicBlock
+{
+public:
+    size_t index = 0;
+    vector<string> labels;
+    vector<Instruction> instructions; // labels are kept apart
+    vector<BasicBlock*> successors, predecessors;
+
+    // the branch or jump ending this block, nullptr if it falls through
+    const Instruction* Terminator() const;
+};
+
+
+// the targets of an indirect jump, emitted as a .word table in the data section
+struct JumpTable
+{
+    string label;
+    vector<string> targets;
+};
+
+
+// a natural loop, the header and the blocks reaching a jump back to it without passing through it
+struct Loop
+{
+    BasicBlock* header = nullptr;
+    vector<BasicBlock*> blocks; // in layout order, including the header
+};
+
+
+// the control flow graph of a single function, blocks are kept in layout order
+class ControlFlowGraph
+{
+public:
+    ControlFlowGraph(const string& name, Code code, vector<JumpTable> jump_tables = {});
+
+    string name;
+    vector<std::unique_ptr<BasicBlock>> blocks;
+    vector<JumpTable> jump_tables;
+
+    // recompute indices and edges, needed after a pass changes the blocks
+    void Connect();
+
+    BasicBlock* FindBlock(const string& label) const;
+
+    // the immediate dominator of each block by index, the entry dominates itself and unreachable blocks have none
+    vector<BasicBlock*> Dominators() const;
+
+    // the loops of the function, inner loops before the loops containing them
+    vector<Loop> Loops() const;
+
+    // the instructions of all blocks in layout order
+    Code Linearize() const;
+
+    // print the instructions of all blocks in layout order
+    void Print(std::ostream& out) const;
+
+    // print the jump tables as data directives
+    void PrintJumpTables(std::ostream& out) const;
+
+    void Dump(std::ostream& out) const;
+};
+
+
+// the translated program: data, functions and verbatim assembly in output order
+class Module
+{
+public:
+    enum class Section { Data, Text };
+
+    void Append(Section section, Code code);
+
+    void AppendFunction(Code code, bool global = false, vector<JumpTable> jump_tables = {});
+
+    // assembly defining the label name, or always kept if name is empty
+    void AppendAssembly(const string& assembly, const string& name = "");
+
+    // move the units of another module to the end of this one
+    void Append(Module&& other);
+
+    // run a pass over the control flow graph of every function
+    void RunPass(const function<void(ControlFlowGraph&)>& pass);
+
+    // leave out the units whose label nothing kept refers to, starting from the units without one
+    // (e.g. the entry point jumping to main), returns the number of units left out
+    size_t RemoveUnreferenced();
+
+    void Dump(std::ostream& out) const;
+
+    friend std::ostream& operator<<(std::ostream& out, const Module& module);
+
+private:
+    struct Unit
+    {
+        Section section;
+        Code code;
+        shared_ptr<ControlFlowGraph> function;
+        bool global = false;
+        string assembly;
+        // the label the unit defines, empty if it has none
+        string name;
+    };
+
+    vector<Unit> units;
+};
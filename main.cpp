@@ -1,9 +1,11 @@
 #include <iostream>
 #include <string>
+#include <sstream>
+#include <vector>
 #include "driver.hpp"
 
 // if _SCAN_ONLY is defined, parsing must be skipped
-#if _PARSE_ONLY
+#if _PARSE_ONLY || _SCAN_ONLY
 bool parse_only = true;
 #if _SCAN_ONLY
 bool scan_only = true;
@@ -18,6 +20,8 @@ bool scan_only = false;
 int main(int argc, char* argv[])
 {
     Driver driver;
+    std::vector<std::string> inputs;
+    bool batch = false;
 
     // parse input arguments and store the configuration in driver
     for (int i = 1; i < argc; i++)
@@ -37,7 +41,7 @@ int main(int argc, char* argv[])
         else if (argv[i] == std::string("-s"))
             driver.trace_scanning = true;
             
-        // do not output tokens to file
+        // do not output tokens to file, the default
         else if (argv[i] == std::string("-nt"))
             driver.tokens_filename = "";
 
@@ -67,6 +71,106 @@ int main(int argc, char* argv[])
             }
         }
 
+        // output the intermediate representation to the specified file
+        else if (argv[i] == std::string("-ir"))
+        {
+            i++;
+            if (i < argc)
+                driver.ir_filename = argv[i];
+            else
+            {
+                std::cerr << "Missing filename for argument -ir" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // check array bounds once before counting loops
+        else if (argv[i] == std::string("-hoist-bounds-checks"))
+            driver.options.hoist_bounds_checks = true;
+
+        // keep a frame for every call, e.g. to see the whole call chain while debugging
+        else if (argv[i] == std::string("-no-tail-calls"))
+            driver.options.tail_calls = false;
+
+        // give every local and temporary a slot of its own, as large as its type is aligned
+        else if (argv[i] == std::string("-no-frame-packing"))
+            driver.options.pack_frames = false;
+
+        // do not run the peephole pass, or only skip one of its rules
+        else if (argv[i] == std::string("-no-peephole"))
+            driver.options.peephole.enabled = false;
+        else if (argv[i] == std::string("-no-peephole-numbering"))
+            driver.options.peephole.value_numbering = false;
+        else if (argv[i] == std::string("-no-peephole-invariants"))
+            driver.options.peephole.loop_invariants = false;
+        else if (argv[i] == std::string("-no-peephole-dead-code"))
+            driver.options.peephole.dead_code = false;
+        else if (argv[i] == std::string("-no-peephole-loads"))
+            driver.options.peephole.redundant_loads = false;
+        else if (argv[i] == std::string("-no-peephole-next"))
+            driver.options.peephole.branches_to_next = false;
+        else if (argv[i] == std::string("-no-peephole-threading"))
+            driver.options.peephole.jump_threading = false;
+        else if (argv[i] == std::string("-no-peephole-inversion"))
+            driver.options.peephole.branch_inversion = false;
+
+        // collect the output in a buffer instead of writing every print at once, not for interactive use
+        else if (argv[i] == std::string("-buffered-output"))
+            driver.options.buffered_output = true;
+
+        // output every definition and builtin, even those main never refers to
+        else if (argv[i] == std::string("-keep-unreferenced"))
+            driver.options.remove_unreferenced = false;
+
+        // largest expression returned by a function that is inlined, 0 to make every call
+        else if (argv[i] == std::string("-inline-limit"))
+        {
+            i++;
+            if (i < argc && *argv[i] != 0 && std::string(argv[i]).find_first_not_of("0123456789") == std::string::npos)
+                driver.options.inline_limit = std::atoi(argv[i]);
+            else
+            {
+                std::cerr << "Missing size for argument -inline-limit" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // print the number of rewrites made by each peephole rule
+        else if (argv[i] == std::string("-peephole-stats"))
+            driver.peephole_stats = true;
+
+        // print the time and allocations of each phase and what it made to standard error
+        else if (argv[i] == std::string("-time-report"))
+            driver.time_report = Driver::TimeReport::Text;
+        else if (argv[i] == std::string("-time-report-json"))
+            driver.time_report = Driver::TimeReport::Json;
+
+        // number of threads compiling function bodies, one per core by default
+        else if (argv[i] == std::string("-j"))
+        {
+            i++;
+            if (i < argc && std::atoi(argv[i]) > 0)
+                driver.options.jobs = std::atoi(argv[i]);
+            else
+            {
+                std::cerr << "Missing thread count for argument -j" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // keep the generated code of functions in a directory and reuse it when they did not change
+        else if (argv[i] == std::string("-cache"))
+        {
+            i++;
+            if (i < argc)
+                driver.options.cache_directory = argv[i];
+            else
+            {
+                std::cerr << "Missing directory for argument -cache" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
         // output filename
         else if (argv[i] == std::string("-o"))
         {
@@ -80,14 +184,34 @@ int main(int argc, char* argv[])
             }
         }
 
+        // read jobs from standard input, one "input [output]" per line, and reply to each
+        else if (argv[i] == std::string("-batch"))
+            batch = true;
+
         // read from standard input
         else if (argv[i] == std::string("-"))
             driver.input_filename = "";
 
         // read from the specified file
         else
-            driver.input_filename = argv[i];
+            inputs.push_back(argv[i]);
+    }
+
+    // several files are compiled in one process, each to its own .asm next to it,
+    // or only scanned or parsed one after the other
+    if (batch || inputs.size() > 1)
+    {
+        auto run = scan_only ? &Driver::Scan : parse_only ? &Driver::Parse : &Driver::Compile;
+        std::stringstream jobs;
+        for (auto& input : inputs)
+            jobs << input << "\n";
+        int result = driver.Batch(jobs, nullptr, run);
+        if (batch && driver.Batch(std::cin, &std::cout, run) != 0)
+            result = 1;
+        return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
     }
+    if (!inputs.empty())
+        driver.input_filename = inputs[0];
 
     // only scan, skip parsing if _SCAN_ONLY is defined
     if (scan_only)
@@ -117,6 +241,8 @@ int main(int argc, char* argv[])
         {
             // if result is not 0, the parser has encountered an error
             int result = driver.Parse();
+            if (driver.time_report != Driver::TimeReport::None)
+                driver.PrintTimeReport(std::cerr);
             if (result != 0)
                 return EXIT_FAILURE;
         }
@@ -134,6 +260,8 @@ int main(int argc, char* argv[])
     {
         // if result is not 0, the compiler has encountered an error
         int result = driver.Compile();
+        if (driver.time_report != Driver::TimeReport::None)
+            driver.PrintTimeReport(std::cerr);
         if (result != 0)
             return EXIT_FAILURE;
     }
@@ -154,7 +154,7 @@
 %%
 Start: DefinitionList MainDefinition {
             $1.push_back($2);
-            driver.ast = std::make_shared<Program>($1);
+            driver.ast = MakeNode<Program>($1);
         };
 
 DefinitionList: %empty { $$ = vector<shared_ptr<Definition>>(); }
@@ -165,18 +165,18 @@ DefinitionList: %empty { $$ = vector<shared_ptr<Definition>>(); }
     ;
 
 FunctionDefinition: TypeSpecifier IDENTIFIER "(" ParameterList ")" StatementBlock {
-            $$ = std::make_shared<FunctionDefinition>($2, $1, $4, $6, @1 + @5);
+            $$ = MakeNode<FunctionDefinition>($2, $1, $4, $6, @1 + @5);
         }
     | VOID IDENTIFIER "(" ParameterList ")" StatementBlock {
-            $$ = std::make_shared<FunctionDefinition>($2, void_type, $4, $6, @1 + @5);
+            $$ = MakeNode<FunctionDefinition>($2, void_type, $4, $6, @1 + @5);
         }
     ;
 
 MainDefinition: TypeSpecifier MAIN "(" ")" StatementBlock {
-            $$ = std::make_shared<MainFunctionDefinition>($1, $5, @1 + @4);
+            $$ = MakeNode<MainFunctionDefinition>($1, $5, @1 + @4);
         }
     | VOID MAIN "(" ")" StatementBlock {
-            $$ = std::make_shared<MainFunctionDefinition>(void_type, $5, @1 + @4);
+            $$ = MakeNode<MainFunctionDefinition>(void_type, $5, @1 + @4);
         }
     ;
 
@@ -186,18 +186,18 @@ FieldDefinition : TypeSpecifier VariableDeclarationList "." {
             {
                 if (var.array)
                 {
-                    auto arraytype = std::make_shared<ArrayType>($1, var.array_size);
+                    auto arraytype = ArrayType::Get($1, var.array_size);
                     if (!var.value)
-                        $$.push_back(std::make_shared<FieldDefinition>(var.name, arraytype, var.location));
+                        $$.push_back(MakeNode<FieldDefinition>(var.name, arraytype, var.location));
                     else
-                        $$.push_back(std::make_shared<FieldDefinition>(var.name, arraytype, var.value, var.location));
+                        $$.push_back(MakeNode<FieldDefinition>(var.name, arraytype, var.value, var.location));
                 }
                 else
                 {
                     if (!var.value)
-                        $$.push_back(std::make_shared<FieldDefinition>(var.name, $1, var.location));
+                        $$.push_back(MakeNode<FieldDefinition>(var.name, $1, var.location));
                     else
-                        $$.push_back(std::make_shared<FieldDefinition>(var.name, $1, var.value, var.location));
+                        $$.push_back(MakeNode<FieldDefinition>(var.name, $1, var.value, var.location));
                 }
             }
         };
@@ -212,21 +212,21 @@ ParameterList: %empty { $$ = vector<shared_ptr<VariableDeclaration>>(); }
     ;
 
 ParameterDeclaration
-    : TypeSpecifier IDENTIFIER { $$ = std::make_shared<VariableDeclaration>($2, $1, @1 + @2); }
+    : TypeSpecifier IDENTIFIER { $$ = MakeNode<VariableDeclaration>($2, $1, @1 + @2); }
     | TypeSpecifier IDENTIFIER "[" "]" {
-            auto type = std::make_shared<PointerType>($1);
-            $$ = std::make_shared<VariableDeclaration>($2, type, @1 + @4);
+            auto type = PointerType::Get($1);
+            $$ = MakeNode<VariableDeclaration>($2, type, @1 + @4);
         }
     ;
 
-StatementBlock: "<" StatementList ">" { $$ = std::make_shared<StatementBlock>($2, @1 + @3); };
+StatementBlock: "<" StatementList ">" { $$ = MakeNode<StatementBlock>($2, @1 + @3); };
 
 StatementList: %empty { $$ = vector<shared_ptr<Statement>>(); }
     | StatementList Statement { $$ = $1; $$.push_back($2); }
     | StatementList VariableDefinition "." { $$ = $1; $$.insert($$.end(), $2.begin(), $2.end()); }
     ;
 
-Statement: "." { $$ = std::make_shared<Statement>(@1); }
+Statement: "." { $$ = MakeNode<Statement>(@1); }
     | Expression "." { $$ = $1; }
     | JumpStatement "." { $$ = $1; }
     | SelectionStatement { $$ = $1; }
@@ -242,16 +242,16 @@ VariableDefinition: TypeSpecifier VariableDeclarationList {
                 {
                     if (var.value != nullptr)
                         throw yy::parser::syntax_error(var.value->location, "initializing local array variables is not supported");
-                    auto arraytype = std::make_shared<ArrayType>($1, var.array_size);
-                    $$.push_back(std::make_shared<VariableDeclaration>(var.name, arraytype, var.location));
+                    auto arraytype = ArrayType::Get($1, var.array_size);
+                    $$.push_back(MakeNode<VariableDeclaration>(var.name, arraytype, var.location));
                 }
                 else
                 {
-                    $$.push_back(std::make_shared<VariableDeclaration>(var.name, $1, var.location));
+                    $$.push_back(MakeNode<VariableDeclaration>(var.name, $1, var.location));
                     if (var.value)
                     {
-                        auto var_exp = std::make_shared<VariableExpression>(var.name, var.location);
-                        $$.push_back(std::make_shared<AssignmentExpression>(var_exp, var.value));
+                        auto var_exp = MakeNode<VariableExpression>(var.name, var.location);
+                        $$.push_back(MakeNode<AssignmentExpression>(var_exp, var.value));
                     }
                 }
             }
@@ -274,7 +274,7 @@ VariableDeclaration
                 throw yy::parser::syntax_error($3->location, "array size cannot be negative or zero");
         }
     | IDENTIFIER "[" Expression "]" "=" STRING_CONST {
-            $$ = { .name = $1, .array = true, .value = std::make_shared<StringLiteral>($6, @6), .location = @1 + @4};
+            $$ = { .name = $1, .array = true, .value = MakeNode<StringLiteral>($6, @6), .location = @1 + @4};
             auto casted = ValueCast::IfNeeded($3);
             if (!casted->Precomputable($$.array_size))
                 throw yy::parser::syntax_error($3->location, "array size must be a constant expression");
@@ -283,7 +283,7 @@ VariableDeclaration
         }
     | IDENTIFIER "[" "]" "=" STRING_CONST {
             $$ = { .name = $1, .array = true, .array_size = int($5.size() + 1),
-                .value = std::make_shared<StringLiteral>($5, @5), .location = @1 + @3};
+                .value = MakeNode<StringLiteral>($5, @5), .location = @1 + @3};
         }
     ;
 
@@ -292,10 +292,10 @@ SelectionStatement
             auto last_else = $7;
             for (auto i = $6.rbegin(); i != $6.rend(); i++)
             {
-                auto ifelse = std::make_shared<IfElseStatement>(std::get<0>(*i), std::get<1>(*i), last_else, std::get<2>(*i));
-                last_else = std::make_shared<StatementBlock>(ifelse);
+                auto ifelse = MakeNode<IfElseStatement>(std::get<0>(*i), std::get<1>(*i), last_else, std::get<2>(*i));
+                last_else = MakeNode<StatementBlock>(ifelse);
             }
-            $$ = std::make_shared<IfElseStatement>($3, $5, last_else, $3->location);
+            $$ = MakeNode<IfElseStatement>($3, $5, last_else, $3->location);
         }
     | SWITCH "(" Expression ")" CaseStatementBlock { $$ = $5; $5->SetExpression($3); $5->location = @1 + @4; }
     ;
@@ -304,12 +304,12 @@ ElseIfList: %empty { $$ = vector<std::tuple<shared_ptr<Expression>, shared_ptr<S
     | ElseIfList ELSEIF "(" Expression ")" StatementBlock { $$ = $1; $$.push_back(std::make_tuple($4, $6, @2 + @5)); }
     ;
 
-OptionalElse : %empty { $$ = std::make_shared<StatementBlock>(@$); }
+OptionalElse : %empty { $$ = MakeNode<StatementBlock>(@$); }
     | ELSE StatementBlock { $$ = $2; }
 
 CaseStatementBlock: "<" CaseStatementList ">" { $$ = $2; };
 
-CaseStatementList: %empty { $$ = std::make_shared<SwitchStatement>(@$); }
+CaseStatementList: %empty { $$ = MakeNode<SwitchStatement>(@$); }
     | CaseStatementList CASE Expression ":" { $$ = $1; $$->AddCase($3, @2 + @4); }
     | CaseStatementList DEFAULT ":" { $$ = $1; $$->AddDefaultCase(@2 + @3); }
     | CaseStatementList Statement { $$ = $1; $$->AddStatement($2); }
@@ -321,9 +321,9 @@ CaseStatementList: %empty { $$ = std::make_shared<SwitchStatement>(@$); }
     ;
 
 IterationStatement
-    : WHILE "(" Expression ")" StatementBlock { $$ = std::make_shared<WhileStatement>($3, $5, @1 + @4); }
+    : WHILE "(" Expression ")" StatementBlock { $$ = MakeNode<WhileStatement>($3, $5, @1 + @4); }
     | FOR "(" ForInitializer "." OptionalExpression "." OptionalExpression ")" StatementBlock {
-            $$ = std::make_shared<ForStatement>($3, $5, $7, $9, @1 + @8);
+            $$ = MakeNode<ForStatement>($3, $5, $7, $9, @1 + @8);
         }
     ;
 
@@ -332,54 +332,54 @@ ForInitializer
     | VariableDefinition { $$ = $1; }
     ;
 
-OptionalExpression: %empty { $$ = std::make_shared<ConstantExpression>(1, @$); }
+OptionalExpression: %empty { $$ = MakeNode<ConstantExpression>(1, @$); }
     | Expression { $$ = $1; }
     ;
 
 JumpStatement
-    : CONTINUE { $$ = std::make_shared<ContinueStatement>(@1); }
-    | BREAK { $$ = std::make_shared<BreakStatement>(@1); }
-    | RETURN { $$ = std::make_shared<ReturnStatement>(@1); }
-    | RETURN Expression { $$ = std::make_shared<ReturnStatement>($2, @1); }
+    : CONTINUE { $$ = MakeNode<ContinueStatement>(@1); }
+    | BREAK { $$ = MakeNode<BreakStatement>(@1); }
+    | RETURN { $$ = MakeNode<ReturnStatement>(@1); }
+    | RETURN Expression { $$ = MakeNode<ReturnStatement>($2, @1); }
     ;
 
 Expression
-    : INT_CONST { $$ = std::make_shared<ConstantExpression>($1, @1); }
-    | CHAR_CONST { $$ = std::make_shared<ConstantExpression>($1, @1); }
-    | IDENTIFIER { $$ = std::make_shared<VariableExpression>($1, @1); }
+    : INT_CONST { $$ = MakeNode<ConstantExpression>($1, @1); }
+    | CHAR_CONST { $$ = MakeNode<ConstantExpression>($1, @1); }
+    | IDENTIFIER { $$ = MakeNode<VariableExpression>($1, @1); }
     | ArrayAccess { $$ = $1; }
     | FunctionCall { $$ = $1; }
 
-    | Expression "+" Expression { $$ = std::make_shared<BinaryValueExpression>("+", $1, $3); }
-    | Expression "-" Expression { $$ = std::make_shared<BinaryValueExpression>("-", $1, $3); }
-    | Expression "*" Expression { $$ = std::make_shared<BinaryValueExpression>("*", $1, $3); }
-    | Expression "/" Expression { $$ = std::make_shared<BinaryValueExpression>("/", $1, $3); }
-    | "+" Expression %prec UnaryPlus { $$ = std::make_shared<UnaryValueExpression>("+", $2, @1); }
-    | "-" Expression %prec UnaryMinus { $$ = std::make_shared<UnaryValueExpression>("-", $2, @1); }
-
-    | Expression "&" Expression { $$ = std::make_shared<BinaryValueExpression>("&", $1, $3); }
-    | Expression "|" Expression { $$ = std::make_shared<BinaryValueExpression>("|", $1, $3); }
-    | Expression "^" Expression { $$ = std::make_shared<BinaryValueExpression>("^", $1, $3); }
-    | "~" Expression { $$ = std::make_shared<UnaryValueExpression>("~", $2, @1); }
-
-    | Expression "&&" Expression { $$ = std::make_shared<BinaryBooleanExpression>("&&", $1, $3); }
-    | Expression "||" Expression { $$ = std::make_shared<BinaryBooleanExpression>("||", $1, $3); }
-    | "!" Expression { $$ = std::make_shared<UnaryBooleanExpression>("!", $2, @1); }
-
-    | Expression "==" Expression { $$ = std::make_shared<RelationalExpression>("==", $1, $3); }
-    | Expression "!=" Expression { $$ = std::make_shared<RelationalExpression>("!=", $1, $3); }
-    | Expression ">" Expression { $$ = std::make_shared<RelationalExpression>(">", $1, $3); }
-    | Expression ">=" Expression { $$ = std::make_shared<RelationalExpression>(">=", $1, $3); }
-    | Expression "<" Expression { $$ = std::make_shared<RelationalExpression>("<", $1, $3); }
-    | Expression "<=" Expression { $$ = std::make_shared<RelationalExpression>("<=", $1, $3); }
+    | Expression "+" Expression { $$ = MakeNode<BinaryValueExpression>(Operator::Plus, $1, $3); }
+    | Expression "-" Expression { $$ = MakeNode<BinaryValueExpression>(Operator::Minus, $1, $3); }
+    | Expression "*" Expression { $$ = MakeNode<BinaryValueExpression>(Operator::Times, $1, $3); }
+    | Expression "/" Expression { $$ = MakeNode<BinaryValueExpression>(Operator::Divide, $1, $3); }
+    | "+" Expression %prec UnaryPlus { $$ = MakeNode<UnaryValueExpression>(Operator::Plus, $2, @1); }
+    | "-" Expression %prec UnaryMinus { $$ = MakeNode<UnaryValueExpression>(Operator::Minus, $2, @1); }
+
+    | Expression "&" Expression { $$ = MakeNode<BinaryValueExpression>(Operator::BitAnd, $1, $3); }
+    | Expression "|" Expression { $$ = MakeNode<BinaryValueExpression>(Operator::BitOr, $1, $3); }
+    | Expression "^" Expression { $$ = MakeNode<BinaryValueExpression>(Operator::BitXor, $1, $3); }
+    | "~" Expression { $$ = MakeNode<UnaryValueExpression>(Operator::BitNot, $2, @1); }
+
+    | Expression "&&" Expression { $$ = MakeNode<BinaryBooleanExpression>(Operator::And, $1, $3); }
+    | Expression "||" Expression { $$ = MakeNode<BinaryBooleanExpression>(Operator::Or, $1, $3); }
+    | "!" Expression { $$ = MakeNode<UnaryBooleanExpression>(Operator::Not, $2, @1); }
+
+    | Expression "==" Expression { $$ = MakeNode<RelationalExpression>(Operator::Equal, $1, $3); }
+    | Expression "!=" Expression { $$ = MakeNode<RelationalExpression>(Operator::NotEqual, $1, $3); }
+    | Expression ">" Expression { $$ = MakeNode<RelationalExpression>(Operator::Greater, $1, $3); }
+    | Expression ">=" Expression { $$ = MakeNode<RelationalExpression>(Operator::GreaterEqual, $1, $3); }
+    | Expression "<" Expression { $$ = MakeNode<RelationalExpression>(Operator::Less, $1, $3); }
+    | Expression "<=" Expression { $$ = MakeNode<RelationalExpression>(Operator::LessEqual, $1, $3); }
 
     | LEFTPAREN Expression RIGHTPAREN { $$ = $2; $$->location = @1 + @3; }
     | Assignment { $$ = $1; }
     ;
 
-ArrayAccess: IDENTIFIER "[" Expression "]" { $$ = std::make_shared<ArrayAccessExpression>($1, $3, @1 + @4); };
+ArrayAccess: IDENTIFIER "[" Expression "]" { $$ = MakeNode<ArrayAccessExpression>($1, $3, @1 + @4); };
 
-FunctionCall: IDENTIFIER "(" ArgumentList ")" { $$ = std::make_shared<FunctionCallExpression>($1, $3, @1 + @4); };
+FunctionCall: IDENTIFIER "(" ArgumentList ")" { $$ = MakeNode<FunctionCallExpression>($1, $3, @1 + @4); };
 
 ArgumentList: %empty { $$ = vector<shared_ptr<Expression>>(); }
     | Expression { $$ = vector<shared_ptr<Expression>>(); $$.push_back($1); }
@@ -388,10 +388,10 @@ ArgumentList: %empty { $$ = vector<shared_ptr<Expression>>(); }
 
 Assignment
     : IDENTIFIER "=" Expression {
-            auto var = std::make_shared<VariableExpression>($1, @1);
-            $$ = std::make_shared<AssignmentExpression>(var, $3);
+            auto var = MakeNode<VariableExpression>($1, @1);
+            $$ = MakeNode<AssignmentExpression>(var, $3);
         }
-    | ArrayAccess "=" Expression { $$ = std::make_shared<AssignmentExpression>($1, $3); }
+    | ArrayAccess "=" Expression { $$ = MakeNode<AssignmentExpression>($1, $3); }
     ;
 
 %%
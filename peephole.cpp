@@ -0,0 +1,981 @@
+#include "peephole.hpp"
+
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+
+
+std::ostream& operator<<(std::ostream& out, const PeepholeStats& stats)
+{
+    return out << "value numbering: " << stats.value_numbering << "\n"
+        << "loop invariants: " << stats.loop_invariants << "\n"
+        << "dead code: " << stats.dead_code << "\n"
+        << "redundant loads: " << stats.redundant_loads << "\n"
+        << "branches to next: " << stats.branches_to_next << "\n"
+        << "jump threading: " << stats.jump_threading << "\n"
+        << "branch inversion: " << stats.branch_inversion << "\n";
+}
+
+
+static size_t RemoveRedundantLoads(BasicBlock& block)
+{
+    size_t count = 0;
+    auto& instructions = block.instructions;
+    for (size_t i = 0; i < instructions.size(); i++)
+    {
+        Instruction& current = instructions[i];
+        if (current.opcode == Opcode::Move && current.operands[0] == current.operands[1])
+        {
+            instructions.erase(instructions.begin() + i--);
+            count++;
+            continue;
+        }
+        if (i == 0)
+            continue;
+
+        // only whole words, a byte load also has to sign extend
+        const Instruction& previous = instructions[i - 1];
+        if ((previous.opcode != Opcode::Sw && previous.opcode != Opcode::Lw)
+            || (current.opcode != Opcode::Sw && current.opcode != Opcode::Lw)
+            || previous.operands[1] != current.operands[1])
+            continue;
+
+        const Operand &reg = previous.operands[0], &memory = previous.operands[1];
+        // a load into the base register moves the address of the next access
+        if (previous.opcode == Opcode::Lw && memory.base == reg.name)
+            continue;
+
+        if (current.opcode == Opcode::Lw)
+        {
+            if (current.operands[0] == reg)
+                instructions.erase(instructions.begin() + i--);
+            else
+                current = Instruction(Opcode::Move, current.operands[0], reg);
+            count++;
+        }
+        else if (current.operands[0] == reg)
+        {
+            // storing the value just loaded from or stored to the same word
+            instructions.erase(instructions.begin() + i--);
+            count++;
+        }
+    }
+    return count;
+}
+
+
+static size_t RemoveBranchesToNext(ControlFlowGraph& function)
+{
+    size_t count = 0;
+    for (size_t i = 0; i + 1 < function.blocks.size(); i++)
+    {
+        auto& block = *function.blocks[i];
+        const Instruction* terminator = block.Terminator();
+        if (terminator == nullptr || terminator->Target().empty())
+            continue;
+
+        auto& next_labels = function.blocks[i + 1]->labels;
+        if (std::find(next_labels.begin(), next_labels.end(), terminator->Target()) != next_labels.end())
+        {
+            block.instructions.pop_back();
+            count++;
+        }
+    }
+    return count;
+}
+
+
+static size_t ThreadJumps(ControlFlowGraph& function)
+{
+    // blocks that do nothing but jump to another label
+    std::map<string, string> forwards;
+    for (auto& block : function.blocks)
+        if (block->instructions.size() == 1 && (block->instructions[0].opcode == Opcode::B
+            || block->instructions[0].opcode == Opcode::J) && !block->instructions[0].Target().empty())
+            for (auto& label : block->labels)
+                forwards[label] = block->instructions[0].Target();
+
+    // follow the chain, leaving jumps that go around in a circle alone
+    auto final_target = [&forwards](const string& label) {
+        std::set<string> visited = { label };
+        string target = label;
+        for (auto forward = forwards.find(target); forward != forwards.end(); forward = forwards.find(target))
+        {
+            target = forward->second;
+            if (!visited.insert(target).second)
+                return label;
+        }
+        return target;
+    };
+
+    size_t count = 0;
+    for (auto& block : function.blocks)
+    {
+        if (block->Terminator() == nullptr || block->Terminator()->Target().empty())
+            continue;
+
+        Instruction& terminator = *block->instructions.rbegin();
+        string target = final_target(terminator.Target());
+        if (target != terminator.Target())
+        {
+            terminator.operands.back() = Operand::Label(target);
+            count++;
+        }
+    }
+
+    for (auto& table : function.jump_tables)
+        for (auto& entry : table.targets)
+        {
+            string target = final_target(entry);
+            if (target != entry)
+            {
+                entry = target;
+                count++;
+            }
+        }
+    return count;
+}
+
+
+static Opcode InvertedBranch(Opcode opcode)
+{
+    switch (opcode)
+    {
+    case Opcode::Beq: return Opcode::Bne;
+    case Opcode::Bne: return Opcode::Beq;
+    case Opcode::Blt: return Opcode::Bge;
+    case Opcode::Bge: return Opcode::Blt;
+    case Opcode::Ble: return Opcode::Bgt;
+    case Opcode::Bgt: return Opcode::Ble;
+    case Opcode::Bltu: return Opcode::Bgeu;
+    case Opcode::Bgeu: return Opcode::Bltu;
+    case Opcode::Bleu: return Opcode::Bgtu;
+    case Opcode::Bgtu: return Opcode::Bleu;
+    case Opcode::Beqz: return Opcode::Bnez;
+    case Opcode::Bnez: return Opcode::Beqz;
+    case Opcode::Bltz: return Opcode::Bgez;
+    case Opcode::Bgez: return Opcode::Bltz;
+    case Opcode::Bgtz: return Opcode::Blez;
+    case Opcode::Blez: return Opcode::Bgtz;
+    default:
+        assert(false && "not a conditional branch");
+        return opcode;
+    }
+}
+
+static size_t InvertBranches(ControlFlowGraph& function)
+{
+    size_t count = 0;
+    for (size_t i = 0; i + 2 < function.blocks.size(); i++)
+    {
+        auto& block = *function.blocks[i];
+        auto& jump_block = *function.blocks[i + 1];
+        auto& taken_labels = function.blocks[i + 2]->labels;
+        const Instruction* terminator = block.Terminator();
+        if (terminator == nullptr || !terminator->IsBranch()
+            || std::find(taken_labels.begin(), taken_labels.end(), terminator->Target()) == taken_labels.end())
+            continue;
+
+        // the jump must only be reachable by falling through the branch
+        if (jump_block.instructions.size() != 1 || jump_block.instructions[0].opcode != Opcode::B
+            || jump_block.predecessors.size() != 1 || jump_block.predecessors[0] != &block)
+            continue;
+
+        Instruction& branch = *block.instructions.rbegin();
+        branch.opcode = InvertedBranch(branch.opcode);
+        branch.operands.back() = jump_block.instructions[0].operands.back();
+        function.blocks.erase(function.blocks.begin() + i + 1);
+        function.Connect();
+        count++;
+    }
+    return count;
+}
+
+
+// what is known at a point of a function, equal value numbers mean equal values
+struct ValueState
+{
+    std::unordered_map<string, size_t> registers; // also hi and lo
+    std::unordered_map<string, size_t> expressions;
+    std::unordered_map<string, size_t> memory; // loads known to give a value
+    vector<string> computed; // memory entries reached through a computed address
+    std::unordered_map<string, bool> branches; // conditions known to be taken or not
+};
+
+class ValueNumbering
+{
+public:
+    size_t count = 0;
+
+    void Run(ControlFlowGraph& function);
+
+private:
+    size_t next_value = 0;
+
+    size_t Number(ValueState& state, const string& reg)
+    {
+        auto found = state.registers.find(reg);
+        if (found != state.registers.end())
+            return found->second;
+        return state.registers[reg] = next_value++;
+    }
+
+    string Key(ValueState& state, const Operand& operand)
+    {
+        switch (operand.kind)
+        {
+        case Operand::Kind::Register: return "v" + std::to_string(Number(state, operand.name));
+        case Operand::Kind::Immediate: return "#" + std::to_string(operand.value);
+        case Operand::Kind::Label: return "@" + operand.name;
+        default: return "?" + std::to_string(next_value++);
+        }
+    }
+
+    // the key of the operands from first to end, operands of commutative operations are sorted
+    string Key(ValueState& state, const Instruction& instruction, size_t first, size_t end = SIZE_MAX)
+    {
+        vector<string> keys;
+        for (size_t i = first; i < std::min(end, instruction.operands.size()); i++)
+            keys.push_back(Key(state, instruction.operands[i]));
+        switch (instruction.opcode)
+        {
+        case Opcode::Addu: case Opcode::Mul: case Opcode::And: case Opcode::Or: case Opcode::Xor:
+        case Opcode::Nor: case Opcode::Seq: case Opcode::Sne: case Opcode::Mult: case Opcode::Multu:
+            std::sort(keys.begin(), keys.end());
+            break;
+        default:
+            break;
+        }
+        string key = std::to_string(int(instruction.opcode));
+        for (auto& operand : keys)
+            key += " " + operand;
+        return key;
+    }
+
+    // a branch without its target
+    string Condition(ValueState& state, const Instruction& branch)
+    {
+        return Key(state, branch, 0, branch.operands.size() - 1);
+    }
+
+    static string Key(Opcode load, const string& name, int offset, const string& base)
+    {
+        return std::to_string(int(load)) + " " + name + " " + std::to_string(offset) + " " + base;
+    }
+
+    string Key(ValueState& state, Opcode load, const Operand& memory)
+    {
+        bool computed = !memory.base.empty() && memory.base != "$sp";
+        return Key(load, memory.name, memory.value,
+            computed ? "v" + std::to_string(Number(state, memory.base)) : memory.base);
+    }
+
+    static bool Computed(const Operand& memory)
+    {
+        return memory.base.empty() ? memory.name.empty() : memory.base != "$sp" || !memory.name.empty();
+    }
+
+    // another register holding the value, empty if there is none
+    static string Holder(const ValueState& state, size_t value)
+    {
+        for (auto& [reg, number] : state.registers)
+            if (number == value && reg[0] == '$')
+                return reg;
+        return "";
+    }
+
+    // a slot on the stack or a global scalar only changes through its own name,
+    // anything reached through a computed address may be changed by any store
+    static void Store(ValueState& state, const Operand& memory, int width)
+    {
+        for (auto& key : state.computed)
+            state.memory.erase(key);
+        state.computed.clear();
+        if (Computed(memory))
+            return;
+        // words are aligned, so a store overlaps the word containing it and the bytes it covers
+        state.memory.erase(Key(Opcode::Lw, memory.name, memory.value & ~3, memory.base));
+        for (int offset = memory.value; offset < memory.value + width; offset++)
+            for (Opcode load : { Opcode::Lb, Opcode::Lbu })
+                state.memory.erase(Key(load, memory.name, offset, memory.base));
+    }
+
+    static void Forget(ValueState& state)
+    {
+        std::unordered_map<string, size_t>().swap(state.memory);
+        state.computed.clear();
+    }
+
+    // the callee may change any register but the stack and frame pointers and any memory
+    static void Call(ValueState& state)
+    {
+        Forget(state);
+        for (auto it = state.registers.begin(); it != state.registers.end(); )
+            it = it->first == "$sp" || it->first == "$fp" ? std::next(it) : state.registers.erase(it);
+    }
+
+    // reuse a value already in a register for the instruction computing it into reg,
+    // false if reg already holds it and the instruction can go
+    bool Reuse(ValueState& state, Instruction& instruction, const string& reg, size_t value, bool move)
+    {
+        auto found = state.registers.find(reg);
+        if (found != state.registers.end() && found->second == value)
+        {
+            count++;
+            return false;
+        }
+        string holder = Holder(state, value);
+        if (move && !holder.empty())
+        {
+            instruction = Instruction(Opcode::Move, reg, holder);
+            count++;
+        }
+        return true;
+    }
+
+    // false if the instruction can be removed
+    bool Visit(ValueState& state, Instruction& instruction);
+};
+
+bool ValueNumbering::Visit(ValueState& state, Instruction& instruction)
+{
+    const auto& operands = instruction.operands;
+    auto define = [&](const string& reg, size_t value) {
+        state.registers[reg] = value;
+        // the stack is addressed relative to $sp
+        if (reg == "$sp")
+            Forget(state);
+        return true;
+    };
+    auto value_of = [&](const string& key) {
+        auto found = state.expressions.find(key);
+        if (found != state.expressions.end())
+            return found->second;
+        return state.expressions[key] = next_value++;
+    };
+
+    switch (instruction.opcode)
+    {
+    case Opcode::Label: case Opcode::Directive: case Opcode::Comment:
+    case Opcode::B: case Opcode::J: case Opcode::Jr:
+        return true;
+
+    case Opcode::Jal: case Opcode::Syscall:
+        Call(state);
+        return true;
+
+    case Opcode::Lw: case Opcode::Lb: case Opcode::Lbu:
+    {
+        string reg = operands[0].name, key = Key(state, instruction.opcode, operands[1]);
+        auto known = state.memory.find(key);
+        if (known == state.memory.end())
+        {
+            known = state.memory.emplace(key, next_value++).first;
+            if (Computed(operands[1]))
+                state.computed.push_back(key);
+        }
+        size_t value = known->second;
+        return Reuse(state, instruction, reg, value, true) && define(reg, value);
+    }
+
+    case Opcode::Sw: case Opcode::Sb:
+    {
+        size_t value = Number(state, operands[0].name);
+        string key = Key(state, Opcode::Lw, operands[1]);
+        auto known = state.memory.find(key);
+        if (instruction.opcode == Opcode::Sw && known != state.memory.end() && known->second == value)
+        {
+            count++;
+            return false;
+        }
+        Store(state, operands[1], instruction.opcode == Opcode::Sw ? 4 : 1);
+        // a byte load sign extends, so only a stored word is known
+        if (instruction.opcode == Opcode::Sw)
+        {
+            state.memory[key] = value;
+            if (Computed(operands[1]))
+                state.computed.push_back(key);
+        }
+        return true;
+    }
+
+    case Opcode::Move: case Opcode::Mfhi: case Opcode::Mflo:
+    {
+        string reg = operands[0].name;
+        size_t value = Number(state, instruction.opcode == Opcode::Move ? operands[1].name
+            : instruction.opcode == Opcode::Mfhi ? "hi" : "lo");
+        return Reuse(state, instruction, reg, value, false) && define(reg, value);
+    }
+
+    case Opcode::Li: case Opcode::La:
+    {
+        string reg = operands[0].name;
+        size_t value = value_of(Key(state, instruction, 1));
+        return Reuse(state, instruction, reg, value, false) && define(reg, value);
+    }
+
+    case Opcode::Mult: case Opcode::Multu:
+    {
+        string key = Key(state, instruction, 0);
+        size_t high = value_of(key + " hi"), low = value_of(key + " lo");
+        if (Number(state, "hi") == high && Number(state, "lo") == low)
+        {
+            count++;
+            return false;
+        }
+        state.registers["hi"] = high;
+        state.registers["lo"] = low;
+        return true;
+    }
+
+    default:
+        break;
+    }
+
+    if (instruction.IsBranch())
+    {
+        auto known = state.branches.find(Condition(state, instruction));
+        if (known == state.branches.end())
+            return true;
+        count++;
+        if (known->second)
+            instruction = Instruction(Opcode::B, operands.back());
+        return known->second;
+    }
+
+    // arithmetic and logic, mul and divu are expanded with hi and lo
+    string reg = operands[0].name;
+    size_t value = value_of(Key(state, instruction, 1));
+    if (instruction.opcode == Opcode::Mul || instruction.opcode == Opcode::Divu)
+    {
+        state.registers["hi"] = next_value++;
+        state.registers["lo"] = next_value++;
+    }
+    return Reuse(state, instruction, reg, value, true) && define(reg, value);
+}
+
+// the bounds check handler never returns, so falling through its call is not a way into a block
+static bool NoReturn(const BasicBlock& block)
+{
+    return !block.instructions.empty() && block.instructions.back().IsCall()
+        && block.instructions.back().Target() == "$out_of_bounds_error";
+}
+
+void ValueNumbering::Run(ControlFlowGraph& function)
+{
+    // a block entered only from one other block starts with what is known at the end of that block,
+    // so each tree of such blocks is numbered as one extended basic block
+    struct Edge { BasicBlock* from = nullptr; size_t count = 0; int taken = -1; };
+    vector<Edge> entries(function.blocks.size());
+    for (auto& block : function.blocks)
+    {
+        const Instruction* terminator = block->Terminator();
+        for (auto successor : block->successors)
+        {
+            auto& labels = successor->labels;
+            bool taken = terminator != nullptr && !terminator->Target().empty()
+                && std::find(labels.begin(), labels.end(), terminator->Target()) != labels.end();
+            bool next = successor->index == block->index + 1 && (terminator == nullptr || terminator->IsBranch());
+            if (next && !taken && NoReturn(*block))
+                continue;
+            auto& entry = entries[successor->index];
+            entry.from = block.get();
+            entry.count++;
+            entry.taken = terminator != nullptr && terminator->IsBranch() && taken != next ? int(taken) : -1;
+        }
+    }
+
+    vector<vector<BasicBlock*>> children(function.blocks.size());
+    vector<std::pair<BasicBlock*, ValueState>> pending;
+    for (auto& block : function.blocks)
+    {
+        auto& entry = entries[block->index];
+        if (block->index != 0 && entry.count == 1)
+            children[entry.from->index].push_back(block.get());
+        else
+            pending.emplace_back(block.get(), ValueState());
+    }
+    std::reverse(pending.begin(), pending.end());
+
+    while (!pending.empty())
+    {
+        auto [block, state] = std::move(pending.back());
+        pending.pop_back();
+
+        auto& instructions = block->instructions;
+        size_t kept = 0;
+        for (size_t i = 0; i < instructions.size(); i++)
+            if (Visit(state, instructions[i]) && kept++ != i)
+                instructions[kept - 1] = std::move(instructions[i]);
+        instructions.resize(kept, Instruction(Opcode::Comment));
+
+        // the condition of the branch ending the block is known in the blocks it leads to
+        string condition;
+        const Instruction* terminator = block->Terminator();
+        if (terminator != nullptr && terminator->IsBranch())
+        {
+            Instruction inverted = *terminator;
+            inverted.opcode = InvertedBranch(inverted.opcode);
+            condition = Condition(state, *terminator) + "\n" + Condition(state, inverted);
+        }
+
+        auto& successors = children[block->index];
+        for (size_t i = 0; i < successors.size(); i++)
+        {
+            BasicBlock* successor = successors[i];
+            ValueState inherited = i + 1 == successors.size() ? std::move(state) : state;
+            int taken = entries[successor->index].taken;
+            if (!condition.empty() && taken != -1)
+            {
+                size_t split = condition.find('\n');
+                inherited.branches[condition.substr(0, split)] = taken == 1;
+                inherited.branches[condition.substr(split + 1)] = taken != 1;
+            }
+            pending.emplace_back(successor, std::move(inherited));
+        }
+    }
+}
+
+
+// registers as bits, hi and lo after the 32 general purpose registers
+using Registers = uint64_t;
+
+static Registers Mask(const string& reg)
+{
+    static const std::unordered_map<string, int> numbers = []() {
+        const char* names[] = {
+            "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+            "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+            "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+            "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra", "hi", "lo" };
+        std::unordered_map<string, int> numbers;
+        for (int i = 0; i < int(std::size(names)); i++)
+            numbers[names[i]] = i;
+        return numbers;
+    }();
+    auto found = numbers.find(reg);
+    return found == numbers.end() ? 0 : Registers(1) << found->second;
+}
+
+// whether operands[0] is the register the instruction writes
+static bool HasDestination(const Instruction& instruction)
+{
+    return (instruction.opcode >= Opcode::Li && instruction.opcode <= Opcode::Sltiu && !instruction.IsStore())
+        || instruction.opcode == Opcode::Mfhi || instruction.opcode == Opcode::Mflo;
+}
+
+// the registers named by the operands from first on
+static Registers Named(const Instruction& instruction, size_t first = 0)
+{
+    Registers named = 0;
+    for (size_t i = first; i < instruction.operands.size(); i++)
+    {
+        auto& operand = instruction.operands[i];
+        if (operand.kind == Operand::Kind::Register)
+            named |= Mask(operand.name);
+        else if (operand.kind == Operand::Kind::Memory && !operand.base.empty())
+            named |= Mask(operand.base);
+    }
+    return named;
+}
+
+// what the caller or the callee of a tail call may read once the function is left,
+// temporaries are saved by the caller
+static Registers Leaving()
+{
+    Registers leaving = Mask("$v0") | Mask("$a0") | Mask("$a1") | Mask("$a2") | Mask("$a3")
+        | Mask("$gp") | Mask("$sp") | Mask("$fp") | Mask("$ra");
+    for (int i = 0; i < 8; i++)
+        leaving |= Mask("$s" + std::to_string(i));
+    return leaving;
+}
+
+// the registers an instruction may read
+static Registers Uses(const Instruction& instruction)
+{
+    switch (instruction.opcode)
+    {
+    case Opcode::Label: case Opcode::Directive: case Opcode::Comment: case Opcode::B:
+        return 0;
+    case Opcode::J:
+        return Leaving();
+    case Opcode::Jr:
+        // through a jump table the successors read the rest
+        return instruction.text.empty() ? Leaving() | Named(instruction) : Named(instruction);
+    case Opcode::Jal:
+        return Mask("$a0") | Mask("$a1") | Mask("$a2") | Mask("$a3") | Mask("$sp") | Mask("$fp");
+    case Opcode::Syscall:
+        return Mask("$v0") | Mask("$a0") | Mask("$a1") | Mask("$a2");
+    case Opcode::Mfhi:
+        return Mask("hi");
+    case Opcode::Mflo:
+        return Mask("lo");
+    default:
+        return Named(instruction, HasDestination(instruction) ? 1 : 0);
+    }
+}
+
+// the registers an instruction surely writes, a callee is only known to change $ra
+static Registers Defines(const Instruction& instruction)
+{
+    switch (instruction.opcode)
+    {
+    case Opcode::Jal:
+        return Mask("$ra");
+    case Opcode::Syscall:
+        return Mask("$v0");
+    case Opcode::Mult: case Opcode::Multu:
+        return Mask("hi") | Mask("lo");
+    case Opcode::Mul: case Opcode::Divu:
+        return Mask(instruction.operands[0].name) | Mask("hi") | Mask("lo");
+    default:
+        return HasDestination(instruction) ? Mask(instruction.operands[0].name) : 0;
+    }
+}
+
+// the registers live at the end of each block
+static vector<Registers> LiveOut(const ControlFlowGraph& function)
+{
+    size_t count = function.blocks.size();
+    vector<Registers> uses(count, 0), defines(count, 0), live_in(count, 0), live_out(count, 0);
+    for (auto& block : function.blocks)
+        for (auto it = block->instructions.rbegin(); it != block->instructions.rend(); ++it)
+        {
+            Registers defined = Defines(*it);
+            uses[block->index] = (uses[block->index] & ~defined) | Uses(*it);
+            defines[block->index] |= defined;
+        }
+
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        for (size_t i = count; i-- > 0; )
+        {
+            auto& block = *function.blocks[i];
+            // falling off the end of the function leaves it as well
+            Registers out = block.successors.empty() && block.Terminator() == nullptr ? Leaving() : 0;
+            for (auto successor : block.successors)
+                out |= live_in[successor->index];
+            Registers in = uses[i] | (out & ~defines[i]);
+            if (out != live_out[i] || in != live_in[i])
+            {
+                live_out[i] = out;
+                live_in[i] = in;
+                changed = true;
+            }
+        }
+    }
+    return live_out;
+}
+
+// compute what a loop does not change in the block entering it, into a temporary the function does not use,
+// the loop keeps a move from it wherever the register the value was computed into is still read,
+// hoisting records the temporaries taken
+static size_t HoistInvariants(ControlFlowGraph& function, const Loop& loop, Registers& hoisting)
+{
+    auto in_loop = [&loop](BasicBlock* block) {
+        return std::find(loop.blocks.begin(), loop.blocks.end(), block) != loop.blocks.end();
+    };
+
+    // the one block entering the loop, it must lead nowhere else
+    BasicBlock* preheader = nullptr;
+    for (auto predecessor : loop.header->predecessors)
+        if (!in_loop(predecessor))
+        {
+            if (preheader != nullptr)
+                return 0;
+            preheader = predecessor;
+        }
+    if (preheader == nullptr || preheader->successors.size() != 1)
+        return 0;
+
+    // a callee may change memory and the temporaries, only the bounds check handler never comes back
+    Registers defined = 0;
+    vector<std::pair<Operand, int>> stores; // addresses and widths
+    for (auto block : loop.blocks)
+        for (auto& instruction : block->instructions)
+        {
+            if (instruction.opcode == Opcode::Syscall
+                || (instruction.IsCall() && instruction.Target() != "$out_of_bounds_error"))
+                return 0;
+            defined |= Defines(instruction);
+            if (instruction.IsStore())
+                stores.emplace_back(instruction.operands[1], instruction.opcode == Opcode::Sw ? 4 : 1);
+        }
+    if (defined & Mask("$sp"))
+        return 0;
+
+    // a slot of the frame or a global scalar the loop never stores to, other addresses are computed
+    // and may not even be valid before the loop
+    auto unchanged = [&stores](const Instruction& load) {
+        const Operand& memory = load.operands[1];
+        bool slot = memory.base == "$sp" && memory.name.empty();
+        if (!slot && !(memory.base.empty() && !memory.name.empty()))
+            return false;
+        int width = load.opcode == Opcode::Lw ? 4 : 1;
+        for (auto& [stored, stored_width] : stores)
+        {
+            if (stored.base == memory.base && stored.name == memory.name
+                && stored.value < memory.value + width && memory.value < stored.value + stored_width)
+                return false;
+        }
+        return true;
+    };
+
+    // temporaries the function never names hold the hoisted values
+    Registers named = 0;
+    for (auto& block : function.blocks)
+        for (auto& instruction : block->instructions)
+            named |= Named(instruction);
+    vector<string> free;
+    for (int i = 9; i >= 1; i--)
+        if (!(named & Mask("$t" + std::to_string(i))))
+            free.push_back("$t" + std::to_string(i));
+
+    vector<Registers> live_out = LiveOut(function);
+    std::map<string, string> hoisted;
+    vector<Instruction> setup;
+    size_t count = 0;
+    for (auto block : loop.blocks)
+    {
+        auto& instructions = block->instructions;
+        // registers holding the same value as a hoisting register, until they are written
+        std::map<string, string> copies;
+        vector<bool> moved(instructions.size(), false), dead(instructions.size(), false);
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            Instruction& instruction = instructions[i];
+            for (size_t j = HasDestination(instruction) ? 1 : 0; j < instruction.operands.size(); j++)
+            {
+                auto& operand = instruction.operands[j];
+                string& reg = operand.kind == Operand::Kind::Memory ? operand.base : operand.name;
+                auto copy = copies.find(reg);
+                if ((operand.kind == Operand::Kind::Register || operand.kind == Operand::Kind::Memory)
+                    && copy != copies.end())
+                    reg = copy->second;
+            }
+            if (instruction.IsJump() || instruction.IsCall() || instruction.opcode == Opcode::Syscall)
+                continue;
+
+            Registers written = Defines(instruction);
+            for (auto it = copies.begin(); it != copies.end(); )
+                it = Mask(it->first) & written ? copies.erase(it) : std::next(it);
+
+            // a division by a register may trap where the loop would not have run it
+            bool invariant = HasDestination(instruction) && instruction.opcode != Opcode::Move
+                && !(Uses(instruction) & defined) && (!instruction.IsLoad() || unchanged(instruction))
+                && (instruction.opcode != Opcode::Divu || (instruction.operands[2].kind == Operand::Kind::Immediate
+                    && instruction.operands[2].value != 0));
+            if (!invariant)
+                continue;
+
+            // a value hoisted out of an inner loop moves on as it is, its register is written nowhere else
+            if (Mask(instruction.operands[0].name) & hoisting)
+            {
+                setup.push_back(instruction);
+                defined &= ~Mask(instruction.operands[0].name);
+                dead[i] = true;
+                count++;
+                continue;
+            }
+
+            std::ostringstream key;
+            key << int(instruction.opcode);
+            for (size_t j = 1; j < instruction.operands.size(); j++)
+                key << " " << instruction.operands[j];
+            // zero is always at hand
+            if (instruction.opcode == Opcode::Li && instruction.operands[1].value == 0)
+                hoisted.emplace(key.str(), "$zero");
+            auto found = hoisted.find(key.str());
+            if (found == hoisted.end())
+            {
+                if (free.empty())
+                    continue;
+                found = hoisted.emplace(key.str(), free.back()).first;
+                hoisting |= Mask(free.back());
+                free.pop_back();
+                setup.push_back(instruction);
+                setup.back().operands[0] = Operand(found->second);
+            }
+            string reg = instruction.operands[0].name;
+            instruction = Instruction(Opcode::Move, reg, found->second);
+            copies[reg] = found->second;
+            moved[i] = true;
+            count++;
+        }
+
+        // the moves are not needed where every read of the register now reads the hoisting register
+        Registers live = live_out[block->index];
+        for (size_t i = instructions.size(); i-- > 0; )
+        {
+            dead[i] = dead[i] || (moved[i] && !(live & Mask(instructions[i].operands[0].name)));
+            if (!dead[i])
+                live = (live & ~Defines(instructions[i])) | Uses(instructions[i]);
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < instructions.size(); i++)
+            if (!dead[i] && kept++ != i)
+                instructions[kept - 1] = std::move(instructions[i]);
+        instructions.resize(kept, Instruction(Opcode::Comment));
+    }
+
+    auto& entry = preheader->instructions;
+    entry.insert(preheader->Terminator() != nullptr ? entry.end() - 1 : entry.end(), setup.begin(), setup.end());
+    return count;
+}
+
+static size_t HoistInvariants(ControlFlowGraph& function)
+{
+    size_t count = 0;
+    Registers hoisting = 0;
+    for (auto& loop : function.Loops())
+        count += HoistInvariants(function, loop, hoisting);
+    return count;
+}
+
+
+// blocks neither the entry nor a jump table leads to, e.g. after a branch value numbering decided
+static size_t RemoveUnreachableBlocks(ControlFlowGraph& function)
+{
+    auto& blocks = function.blocks;
+    vector<bool> reached(blocks.size(), false);
+    vector<BasicBlock*> work;
+    if (!blocks.empty())
+        work.push_back(blocks[0].get());
+    for (auto& table : function.jump_tables)
+        for (auto& target : table.targets)
+            if (auto block = function.FindBlock(target))
+                work.push_back(block);
+    while (!work.empty())
+    {
+        BasicBlock* block = work.back();
+        work.pop_back();
+        if (reached[block->index])
+            continue;
+        reached[block->index] = true;
+        work.insert(work.end(), block->successors.begin(), block->successors.end());
+    }
+
+    size_t count = 0, kept = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        if (!reached[i])
+            count += std::max<size_t>(1, blocks[i]->instructions.size());
+        else if (kept++ != i)
+            blocks[kept - 1] = std::move(blocks[i]);
+    }
+    if (kept != blocks.size())
+    {
+        blocks.resize(kept);
+        function.Connect();
+    }
+    return count;
+}
+
+// whether an instruction does nothing but write its registers, divisions are kept as they trap on zero
+static bool Pure(const Instruction& instruction)
+{
+    return (HasDestination(instruction) && instruction.opcode != Opcode::Divu)
+        || instruction.opcode == Opcode::Mult || instruction.opcode == Opcode::Multu;
+}
+
+// instructions writing registers that are not read before they are written again or the function is left,
+// e.g. copies whose uses value numbering replaced
+static size_t RemoveDeadInstructions(ControlFlowGraph& function)
+{
+    size_t count = 0;
+    // removing an instruction can leave the ones computing its operands unread in earlier blocks
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        auto live_out = LiveOut(function);
+        for (auto& block : function.blocks)
+        {
+            auto& instructions = block->instructions;
+            Registers live = live_out[block->index];
+            vector<bool> dead(instructions.size(), false);
+            for (size_t i = instructions.size(); i-- > 0; )
+            {
+                Registers defined = Defines(instructions[i]);
+                if (Pure(instructions[i]) && defined != 0 && (live & defined) == 0)
+                {
+                    dead[i] = true;
+                    changed = true;
+                    count++;
+                    continue;
+                }
+                live = (live & ~defined) | Uses(instructions[i]);
+            }
+            size_t kept = 0;
+            for (size_t i = 0; i < instructions.size(); i++)
+                if (!dead[i] && kept++ != i)
+                    instructions[kept - 1] = std::move(instructions[i]);
+            instructions.resize(kept, Instruction(Opcode::Comment));
+        }
+    }
+    return count;
+}
+
+
+void Peephole(ControlFlowGraph& function, const PeepholeOptions& options, PeepholeStats& stats)
+{
+    if (!options.enabled)
+        return;
+
+    if (options.value_numbering)
+    {
+        ValueNumbering numbering;
+        numbering.Run(function);
+        stats.value_numbering += numbering.count;
+        function.Connect();
+    }
+
+    if (options.loop_invariants)
+        stats.loop_invariants += HoistInvariants(function);
+
+    if (options.dead_code)
+    {
+        stats.dead_code += RemoveUnreachableBlocks(function);
+        stats.dead_code += RemoveDeadInstructions(function);
+    }
+
+    if (options.redundant_loads)
+        for (auto& block : function.blocks)
+            stats.redundant_loads += RemoveRedundantLoads(*block);
+
+    // one rule may open up another, e.g. threading a jump can leave a branch to the next block
+    for (bool changed = true; changed; )
+    {
+        size_t count = 0;
+        if (options.jump_threading)
+        {
+            size_t threaded = ThreadJumps(function);
+            stats.jump_threading += threaded;
+            count += threaded;
+        }
+        if (options.branches_to_next)
+        {
+            size_t removed = RemoveBranchesToNext(function);
+            stats.branches_to_next += removed;
+            count += removed;
+        }
+        function.Connect();
+        if (options.dead_code)
+        {
+            size_t removed = RemoveUnreachableBlocks(function);
+            stats.dead_code += removed;
+            count += removed;
+        }
+        if (options.branch_inversion)
+        {
+            size_t inverted = InvertBranches(function);
+            stats.branch_inversion += inverted;
+            count += inverted;
+        }
+        changed = count != 0;
+    }
+}
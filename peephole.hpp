@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ir.hpp"
+
+
+// the rules of the peephole pass, all enabled by default
+struct PeepholeOptions
+{
+    bool enabled = true;
+
+    // reuse values already in a register instead of computing or loading them again
+    bool value_numbering = true;
+    // compute values a loop does not change once before it
+    bool loop_invariants = true;
+    // drop blocks nothing reaches and instructions computing values nothing reads
+    bool dead_code = true;
+    // drop a load of the value just stored to or loaded from the same place
+    bool redundant_loads = true;
+    // drop a branch or jump to the block right after it
+    bool branches_to_next = true;
+    // retarget a branch or jump to a block that only jumps elsewhere
+    bool jump_threading = true;
+    // turn "bxx taken; b other; taken:" into "bnxx other; taken:"
+    bool branch_inversion = true;
+};
+
+
+// the number of rewrites made by each rule
+struct PeepholeStats
+{
+    size_t value_numbering = 0;
+    size_t loop_invariants = 0;
+    size_t dead_code = 0;
+    size_t redundant_loads = 0;
+    size_t branches_to_next = 0;
+    size_t jump_threading = 0;
+    size_t branch_inversion = 0;
+
+    friend std::ostream& operator<<(std::ostream& out, const PeepholeStats& stats);
+};
+
+
+// rewrite the code of a function until none of the enabled rules applies
+void Peephole(ControlFlowGraph& function, const PeepholeOptions& options, PeepholeStats& stats);
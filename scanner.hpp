@@ -5,25 +5,23 @@
 #include <memory>
 
 #include "parser.hpp"
-
-// helper class
-class NullBuffer : public std::ostream
-{
-public:
-    int overflow(int c) { return c; }
-};
+#include "source.hpp"
 
 class Scanner
 {
 public:
-    // pass filename = "" to read from standard input
+    // scans the text of source in place, which must outlive the scanner
     // pass tokens_out_filename = "" to not output token list to file
-    Scanner(const std::string& filename, std::string& friendly_filename,
-        const std::string& tokens_out_filename = "tokens.txt", bool trace_scanning = false);
+    Scanner(SourceBuffer& source, std::string& friendly_filename,
+        const std::string& tokens_out_filename = "", bool trace_scanning = false);
     ~Scanner();
 
     std::string tokens_out_filename;
     yy::location location; // for location tracking
     bool trace_scanning;
+    // nullptr if the tokens are not written
     std::shared_ptr<std::ostream> tokens_out;
+
+    // the state of the reentrant flex scanner
+    void* state = nullptr;
 };
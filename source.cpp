@@ -0,0 +1,89 @@
+#include "source.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+void SourceBuffer::Open(const std::string& filename)
+{
+    Close();
+
+    int file = filename.empty() ? -1 : open(filename.c_str(), O_RDONLY);
+    if (!filename.empty() && file < 0)
+        throw std::runtime_error("Unable to open file \"" + filename + "\": " + strerror(errno));
+
+    struct stat status;
+    if (file >= 0 && fstat(file, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+    {
+        // the zero bytes after the text come from an anonymous mapping reserved under the file,
+        // beyond the end of the file the last page of its mapping is zero too
+        size_t page = sysconf(_SC_PAGESIZE);
+        size = status.st_size;
+        mapped = (size + 2 + page - 1) / page * page;
+        void* reserved = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved != MAP_FAILED
+            && mmap(reserved, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file, 0) != MAP_FAILED)
+            data = static_cast<char*>(reserved);
+        else
+        {
+            if (reserved != MAP_FAILED)
+                munmap(reserved, mapped);
+            mapped = 0;
+        }
+    }
+
+    if (data == nullptr)
+    {
+        // standard input, pipes and files that cannot be mapped are read whole
+        if (file < 0)
+            storage.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+        else
+        {
+            char chunk[1 << 16];
+            ssize_t read_size;
+            while ((read_size = read(file, chunk, sizeof(chunk))) > 0)
+                storage.insert(storage.end(), chunk, chunk + read_size);
+            if (read_size < 0)
+            {
+                int error = errno;
+                close(file);
+                throw std::runtime_error("Unable to read file \"" + filename + "\": " + strerror(error));
+            }
+        }
+        size = storage.size();
+        storage.resize(size + 2, 0);
+        data = storage.data();
+    }
+    if (file >= 0)
+        close(file);
+
+    lines.push_back(0);
+    for (const char* next = data; (next = static_cast<const char*>(memchr(next, '\n', data + size - next))); next++)
+        lines.push_back(next + 1 - data);
+}
+
+void SourceBuffer::Close()
+{
+    if (mapped != 0)
+        munmap(data, mapped);
+    data = nullptr;
+    size = mapped = 0;
+    std::vector<char>().swap(storage);
+    lines.clear();
+}
+
+std::string_view SourceBuffer::Line(int line) const
+{
+    if (line < 1 || size_t(line) > lines.size())
+        return std::string_view();
+    size_t begin = lines[line - 1];
+    size_t end = size_t(line) < lines.size() ? lines[line] - 1 : size;
+    return std::string_view(data + begin, end - begin);
+}
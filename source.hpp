@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+// the text of the input, mapped into memory once and shared by the scanner and the error printer,
+// with the offset of every line so a diagnostic does not read the file again
+class SourceBuffer
+{
+public:
+    SourceBuffer() {}
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+    ~SourceBuffer() { Close(); }
+
+    // pass filename = "" to read from standard input, throws if the input cannot be read
+    void Open(const std::string& filename);
+
+    void Close();
+
+    // the text is followed by two zero bytes, flex scans it in place and terminates each token in it
+    char* Data() { return data; }
+    size_t Size() const { return size; }
+
+    // the text of a line without its line break, lines are counted from 1, empty past the last one
+    std::string_view Line(int line) const;
+    size_t Lines() const { return lines.size(); }
+
+private:
+    char* data = nullptr;
+    size_t size = 0;
+    // the length of the mapping, 0 if the text is in storage (e.g. read from a pipe)
+    size_t mapped = 0;
+    std::vector<char> storage;
+    // where each line starts
+    std::vector<size_t> lines;
+};
@@ -1,24 +1,82 @@
 #include "translation.hpp"
 
 #include <algorithm>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+
+
+// file names are few and shared by all spans, so they are looked up in a small table
+static std::mutex files_mutex;
+static vector<const string*> files = { nullptr };
+
+uint16_t SourceSpan::FileIndex(const string* filename)
+{
+    std::lock_guard<std::mutex> lock(files_mutex);
+    auto file = std::find(files.begin(), files.end(), filename);
+    if (file != files.end())
+        return file - files.begin();
+    assert(files.size() <= UINT16_MAX);
+    files.push_back(filename);
+    return files.size() - 1;
+}
+
+const string* SourceSpan::FileName(uint16_t index)
+{
+    std::lock_guard<std::mutex> lock(files_mutex);
+    return files[index];
+}
+
+
+shared_ptr<ArrayType> ArrayType::Get(shared_ptr<ValueType> underlying_type, size_t size)
+{
+    static map<std::pair<ValueType*, size_t>, shared_ptr<ArrayType>> types;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& type = types[{ underlying_type.get(), size }];
+    if (!type)
+        type = shared_ptr<ArrayType>(new ArrayType(underlying_type, size));
+    return type;
+}
+
+shared_ptr<PointerType> PointerType::Get(shared_ptr<ValueType> underlying_type)
+{
+    static map<ValueType*, shared_ptr<PointerType>> types;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& type = types[underlying_type.get()];
+    if (!type)
+        type = shared_ptr<PointerType>(new PointerType(underlying_type));
+    return type;
+}
+
+bool PointerType::CompatibleWith(const SymbolType& other) const
+{
+    if (*this == other)
+        return true;
+    if (other.kind == Kind::Array)
+        return underlying_type->Width() == static_cast<const ArrayType&>(other).underlying_type->Width();
+    return false;
+}
+
 
 Code GlobalSymbol::LoadAddress(const string& reg)
 {
-    return tab + "la " + reg + ", " + name + "\n";
+    return Instruction(Opcode::La, reg, Operand::Label(name));
 }
 
 Code FieldSymbol::LoadValue(const string& reg)
 {
     if (is_array_type(type))
         return LoadAddress(reg);
-    return tab + "lw " + reg + ", " + name + "\n";
+    return Instruction(Opcode::Lw, reg, Operand::Global(name));
 }
 
 Code FieldSymbol::SaveValue(const string& reg)
 {
     if (is_array_type(type))
         throw CompileError(location, ReadableName() + " of type \"" + type->Name() + "\" is not assignable");
-    return tab + "sw " + reg + ", " + name + "\n";
+    return Instruction(Opcode::Sw, reg, Operand::Global(name));
 }
 
 Code FieldSymbol::LoadElementValue(const string& index_reg, const string& dest_reg)
@@ -30,12 +88,11 @@ Code FieldSymbol::LoadElementValue(const string& index_reg, const string& dest_r
 
         Code code;
         if (underlying_type->Width() == 1)
-            code = tab + "lb " + dest_reg + ", " + name + "(" + index_reg + ")\n";
+            code = Instruction(Opcode::Lb, dest_reg, Operand::Global(name, index_reg));
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
-            code += tab + "lw " + dest_reg + ", " + name + "(" + index_reg + ")\n";
+            code = Instruction(Opcode::Sll, index_reg, index_reg, 2);
+            code += Instruction(Opcode::Lw, dest_reg, Operand::Global(name, index_reg));
         }
         else
             throw CompileError(location, "unsupported type width");
@@ -55,12 +112,11 @@ Code FieldSymbol::SaveElementValue(const string& index_reg, const string& source
 
         Code code;
         if (underlying_type->Width() == 1)
-            code = tab + "sb " + source_reg + ", " + name + "(" + index_reg + ")\n";
+            code = Instruction(Opcode::Sb, source_reg, Operand::Global(name, index_reg));
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
-            code += tab + "sw " + source_reg + ", " + name + "(" + index_reg + ")\n";
+            code = Instruction(Opcode::Sll, index_reg, index_reg, 2);
+            code += Instruction(Opcode::Sw, source_reg, Operand::Global(name, index_reg));
         }
         else
             throw CompileError(location, "unsupported type width");
@@ -75,19 +131,19 @@ Code VariableSymbol::LoadValue(const string& reg)
 {
     if (is_array_type(type))
         return LoadAddress(reg);
-    return tab + "lw " + reg + ", " + StackOffset() + "($sp)\n";
+    return Instruction(Opcode::Lw, reg, Operand::Memory("$sp", StackOffset()));
 }
 
 Code VariableSymbol::SaveValue(const string& reg)
 {
     if (is_array_type(type))
         throw CompileError(location, ReadableName() + " of type \"" + type->Name() + "\" is not assignable");
-    return tab + "sw " + reg + ", " + StackOffset() + "($sp)\n";
+    return Instruction(Opcode::Sw, reg, Operand::Memory("$sp", StackOffset()));
 }
 
 Code VariableSymbol::LoadAddress(const string& reg)
 {
-    return tab + "addu " + reg + ", $sp, " + StackOffset() + "\n";
+    return Instruction(Opcode::Addu, reg, "$sp", StackOffset());
 }
 
 Code VariableSymbol::LoadElementValue(const string& index_reg, const string& dest_reg)
@@ -102,31 +158,30 @@ Code VariableSymbol::LoadElementValue(const string& index_reg, const string& des
         {
             if (is_array_type(type))
             {
-                code = tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "lb " + dest_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
+                code = Instruction(Opcode::Addu, index_reg, "$sp", index_reg);
+                code += Instruction(Opcode::Lb, dest_reg, Operand::Memory(index_reg, StackOffset()));
             }
             else
             {
                 code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "lb " + dest_reg + ", " + "(" + index_reg + ")\n";
+                code += Instruction(Opcode::Addu, index_reg, "$t0", index_reg);
+                code += Instruction(Opcode::Lb, dest_reg, Operand::Memory(index_reg));
             }
         }
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
+            code = Instruction(Opcode::Sll, index_reg, index_reg, 2);
 
             if (is_array_type(type))
             {
-                code += tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "lw " + dest_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
+                code += Instruction(Opcode::Addu, index_reg, "$sp", index_reg);
+                code += Instruction(Opcode::Lw, dest_reg, Operand::Memory(index_reg, StackOffset()));
             }
             else
             {
-                code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "lw " + dest_reg + ", " + "(" + index_reg + ")\n";
+                code += LoadValue("$t0");
+                code += Instruction(Opcode::Addu, index_reg, "$t0", index_reg);
+                code += Instruction(Opcode::Lw, dest_reg, Operand::Memory(index_reg));
             }
         }
         else
@@ -150,30 +205,29 @@ Code VariableSymbol::SaveElementValue(const string& index_reg, const string& sou
         {
             if (is_array_type(type))
             {
-                code = tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "sb " + source_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
+                code = Instruction(Opcode::Addu, index_reg, "$sp", index_reg);
+                code += Instruction(Opcode::Sb, source_reg, Operand::Memory(index_reg, StackOffset()));
             }
             else
             {
                 code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "sb " + source_reg + ", " + "(" + index_reg + ")\n";
+                code += Instruction(Opcode::Addu, index_reg, "$t0", index_reg);
+                code += Instruction(Opcode::Sb, source_reg, Operand::Memory(index_reg));
             }
         }
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
+            code = Instruction(Opcode::Sll, index_reg, index_reg, 2);
             if (is_array_type(type))
             {
-                code += tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "sw " + source_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
+                code += Instruction(Opcode::Addu, index_reg, "$sp", index_reg);
+                code += Instruction(Opcode::Sw, source_reg, Operand::Memory(index_reg, StackOffset()));
             }
             else
             {
-                code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "sw " + source_reg + ", " + "(" + index_reg + ")\n";
+                code += LoadValue("$t0");
+                code += Instruction(Opcode::Addu, index_reg, "$t0", index_reg);
+                code += Instruction(Opcode::Sw, source_reg, Operand::Memory(index_reg));
             }
         }
         else
@@ -185,70 +239,425 @@ Code VariableSymbol::SaveElementValue(const string& index_reg, const string& sou
         throw CompileError(location, ReadableName() + " of type " + type->Name() + " is not indexable");
 }
 
+Code RegisterSymbol::LoadValue(const string& reg)
+{
+    if (reg == register_name)
+        return Code();
+    return Instruction(Opcode::Move, reg, register_name);
+}
+
+Code RegisterSymbol::SaveValue(const string& reg)
+{
+    if (reg == register_name)
+        return Code();
+    return Instruction(Opcode::Move, register_name, reg);
+}
+
+Code RegisterSymbol::ElementAddress(const string& index_reg)
+{
+    if (!is_pointer_type(type))
+        throw CompileError(location, ReadableName() + " of type " + type->Name() + " is not indexable");
+
+    auto width = as_pointer_type(type)->underlying_type->Width();
+    Code code;
+    if (width == 4)
+        code += Instruction(Opcode::Sll, index_reg, index_reg, 2);
+    else if (width != 1)
+        throw CompileError(location, "unsupported type width");
+    code += Instruction(Opcode::Addu, index_reg, register_name, index_reg);
+    return code;
+}
+
+Code RegisterSymbol::LoadElementValue(const string& index_reg, const string& dest_reg)
+{
+    Code code = ElementAddress(index_reg);
+    bool byte = as_pointer_type(type)->underlying_type->Width() == 1;
+    code += Instruction(byte ? Opcode::Lb : Opcode::Lw, dest_reg, Operand::Memory(index_reg));
+    return code;
+}
+
+Code RegisterSymbol::SaveElementValue(const string& index_reg, const string& source_reg)
+{
+    Code code = ElementAddress(index_reg);
+    bool byte = as_pointer_type(type)->underlying_type->Width() == 1;
+    code += Instruction(byte ? Opcode::Sb : Opcode::Sw, source_reg, Operand::Memory(index_reg));
+    return code;
+}
+
+Identifier::Identifier(const string& name)
+{
+    // the strings of a node based set never move, the set is shared by all compilations
+    static std::unordered_set<string> names;
+    static std::shared_mutex mutex;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto interned = names.find(name);
+        if (interned != names.end())
+        {
+            this->name = &*interned;
+            return;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    this->name = &*names.insert(name).first;
+}
+
+
+size_t SymbolTable::PushScope()
+{
+    scopes.emplace_back();
+    return Depth();
+}
+
+void SymbolTable::PopScope()
+{
+    for (auto& name : scopes.rbegin()->declared)
+    {
+        auto it = bindings.find(name);
+        it->second.pop_back();
+        if (it->second.empty())
+            bindings.erase(it);
+    }
+    scopes.pop_back();
+}
+
+void SymbolTable::Declare(const Identifier& name, shared_ptr<Symbol> symbol, size_t scope)
+{
+    // an outer scope may declare a name while an inner one is still open
+    auto& list = bindings[name];
+    auto position = std::find_if(list.begin(), list.end(), [scope](auto& b) { return b.scope > scope; });
+    list.insert(position, { scope, symbol });
+    scopes[scope].declared.push_back(name);
+}
+
+shared_ptr<Symbol> SymbolTable::FindInScope(const Identifier& name, size_t scope) const
+{
+    auto it = bindings.find(name);
+    if (it != bindings.end())
+        for (auto& binding : it->second)
+            if (binding.scope == scope)
+                return binding.symbol;
+    return nullptr;
+}
+
+shared_ptr<Symbol> SymbolTable::Find(const Identifier& name, size_t scope)
+{
+    shared_ptr<Symbol> result;
+    size_t found = 0;
+    auto it = bindings.find(name);
+    if (it != bindings.end())
+        for (auto binding = it->second.rbegin(); binding != it->second.rend(); ++binding)
+            if (binding->scope <= scope)
+            {
+                result = binding->symbol;
+                found = binding->scope;
+                break;
+            }
+
+    // a scope that already saw the name also passed it on to the scopes below
+    for (size_t s = scope; s > found; s--)
+        if (!scopes[s].referenced.insert(name).second)
+            break;
+    return result;
+}
+
+bool SymbolTable::Referenced(const Identifier& name, size_t scope) const
+{
+    return scopes[scope].referenced.count(name) != 0;
+}
+
+
 shared_ptr<FieldSymbol> GlobalContext::DeclareField(const FieldSymbol& field)
 {
-    if (symbols.find(field.name) != symbols.end())
+    if (symbols->find(field.name) != symbols->end())
         throw CompileError(field.location, "redeclaration of global variable \"" + field.name + "\"");
+    if (auto counters = options.counters)
+        counters->symbols++;
     auto symbol = std::make_shared<FieldSymbol>(field);
-    symbols[field.name] = symbol;
+    symbol->order = ++declarations;
+    (*symbols)[field.name] = symbol;
     return symbol;
 }
 
 shared_ptr<FunctionSymbol> GlobalContext::DeclareFunction(const FunctionSymbol& function)
 {
-    if (symbols.find(function.name) != symbols.end())
+    if (symbols->find(function.name) != symbols->end())
         throw CompileError(function.location, "redeclaration of function \"" + function.name + "\"");
+    if (auto counters = options.counters)
+        counters->symbols++;
     auto symbol = std::make_shared<FunctionSymbol>(function);
-    symbols[function.name] = symbol;
+    symbol->order = ++declarations;
+    (*symbols)[function.name] = symbol;
     return symbol;
 }
 
+void GlobalContext::DeclareBuiltin(shared_ptr<FunctionSymbol> function)
+{
+    assert(function->builtin && function->order == 0);
+    (*symbols)[function->name] = function;
+}
+
 shared_ptr<Symbol> GlobalContext::operator[](const string& name) const
 {
-    auto it = symbols.find(name);
-    if (it != symbols.end())
+    auto it = symbols->find(name);
+    if (it != symbols->end() && (definition == nullptr || it->second->order <= definition->order))
         return it->second;
     return nullptr;
 }
 
-void FunctionContext::DeclareParameter(const string& name, shared_ptr<SymbolType> type, const Location& loc)
+GlobalContext GlobalContext::ForDefinition(shared_ptr<GlobalSymbol> symbol) const
+{
+    GlobalContext ctx;
+    ctx.options = options;
+    ctx.printer = printer;
+    ctx.symbols = symbols;
+    ctx.declarations = declarations;
+    ctx.definition = symbol;
+    ctx.label_prefix = "$" + symbol->name + "_L";
+    return ctx;
+}
+
+void FunctionContext::DeclareParameter(const string& name, shared_ptr<SymbolType> type, const Location& loc,
+    const string& reg)
 {
-    if (std::find_if(symbols.begin(), symbols.end(),
-        [&name](auto s) { return s->name == name; }) != symbols.end())
+    if (symbols.FindInScope(name, 0))
         throw CompileError(loc, "redeclaration of function parameter \"" + name + "\"");
-    symbols.push_back(std::make_shared<VariableSymbol>(name, type, context_depth, stack_depth, loc));
+    if (auto counters = global_context.options.counters)
+        counters->symbols++;
+
+    if (!reg.empty())
+    {
+        symbols.Declare(name, std::make_shared<RegisterSymbol>(reg, type, loc, name), 0);
+        return;
+    }
+    auto symbol = std::make_shared<VariableSymbol>(name, type, context_depth, loc);
+    // the saved $ra and $fp are named so they cannot clash with a parameter, and kept for the whole function
+    AddSlot(symbol->offset, *type, name[0] == '$', true);
+    symbols.Declare(name, symbol, 0);
 
     context_depth += type->AllignedWidth(stack_alignment);
     UpdateStackDepth();
 }
 
+shared_ptr<VariableSymbol> FunctionContext::ReserveSlot(shared_ptr<SymbolType> type, const Location& loc)
+{
+    // offsets are resolved against the final stack depth, so growing the frame
+    // shifts every existing slot up and leaves room at the bottom
+    auto slot = std::make_shared<VariableSymbol>("", type, stack_depth, loc);
+    AddSlot(slot->offset, *type, true);
+    stack_depth += type->AllignedWidth(stack_alignment);
+    return slot;
+}
+
+void FunctionContext::LayoutFrame(Code& code) const
+{
+    for (auto& instruction : code)
+        for (auto& operand : instruction.operands)
+        {
+            if (!operand.frame_relocation || frame_layout.empty())
+            {
+                operand.Relocate(stack_depth);
+                continue;
+            }
+            auto moved = frame_layout.find(operand.value);
+            assert(moved != frame_layout.end());
+            operand.value = moved->second;
+            operand.frame_relocation = false;
+        }
+}
+
+void FunctionContext::AddSlot(int offset, const SymbolType& type, bool pinned, bool parameter)
+{
+    // symbols of sibling blocks may be given the same offset, the slot then covers them all
+    FrameSlot& slot = frame_slots[offset];
+    bool bytes = type.kind == SymbolType::Kind::Array
+        && static_cast<const ArrayType&>(type).underlying_type->Width() == 1;
+    int width = type.kind == SymbolType::Kind::Array ? type.Width() : type.AllignedWidth(stack_alignment);
+    slot.width = std::max(slot.width, width);
+    slot.alignment = std::max(slot.alignment, bytes ? 1 : stack_alignment);
+    slot.pinned |= pinned;
+    slot.parameter |= parameter;
+}
+
+void FunctionContext::AllocateFrame(const Code& body)
+{
+    // where each slot is first and last referenced in the body, and the labels it can jump back to
+    struct Lifetime { int offset, start, end, begin = 0; };
+    std::unordered_map<int, Lifetime> lifetimes;
+    std::unordered_map<string, int> labels;
+    int position = 0;
+    for (auto& instruction : body)
+    {
+        if (instruction.opcode == Opcode::Label)
+            labels.emplace(instruction.text, position);
+        for (auto& operand : instruction.operands)
+        {
+            if (!operand.frame_relocation)
+                continue;
+            auto slot = frame_slots.find(operand.value);
+            if (slot == frame_slots.end())
+                return;
+            // an address may be used after its slot is last referenced, e.g. by a callee
+            if (operand.kind != Operand::Kind::Memory)
+                slot->second.pinned = true;
+            auto [lifetime, inserted] = lifetimes.emplace(operand.value, Lifetime{ operand.value, position, position });
+            lifetime->second.end = position;
+        }
+        position++;
+    }
+
+    // a slot referenced inside a loop lives through the whole loop, overlapping loops are joined,
+    // jumps out of the body (to the epilogue or a self tail call) leave the values of the locals behind
+    vector<std::pair<int, int>> loops;
+    position = 0;
+    for (auto& instruction : body)
+    {
+        auto jump_back = [&](const string& label) {
+            auto target = labels.find(label);
+            if (target != labels.end() && target->second <= position)
+                loops.emplace_back(target->second, position);
+        };
+        for (auto& operand : instruction.operands)
+            if (operand.kind == Operand::Kind::Label)
+                jump_back(operand.name);
+        if (instruction.opcode == Opcode::Jr && !instruction.text.empty())
+            for (auto& table : global_context.jump_tables)
+                if (table.label == instruction.text)
+                    for (auto& target : table.targets)
+                        jump_back(target);
+        position++;
+    }
+    std::sort(loops.begin(), loops.end());
+    vector<std::pair<int, int>> joined;
+    for (auto& loop : loops)
+    {
+        if (!joined.empty() && loop.first <= joined.back().second)
+            joined.back().second = std::max(joined.back().second, loop.second);
+        else
+            joined.push_back(loop);
+    }
+
+    vector<Lifetime> order;
+    for (auto& [offset, slot] : frame_slots)
+    {
+        auto lifetime = lifetimes.find(offset);
+        if (slot.pinned)
+            order.push_back({ offset, -1, position });
+        else if (slot.parameter)
+            // stored by the prologue
+            order.push_back({ offset, -1, lifetime == lifetimes.end() ? -1 : lifetime->second.end });
+        else if (lifetime != lifetimes.end())
+            order.push_back(lifetime->second);
+    }
+    for (auto& lifetime : order)
+    {
+        auto loop = std::lower_bound(joined.begin(), joined.end(), lifetime.start,
+            [](const std::pair<int, int>& loop, int start) { return loop.second < start; });
+        for (; loop != joined.end() && loop->first <= lifetime.end; ++loop)
+        {
+            lifetime.start = std::min(lifetime.start, loop->first);
+            lifetime.end = std::max(lifetime.end, loop->second);
+        }
+    }
+
+    // lifetimes are intervals, so the slots that interfere are colored by giving each in order of its start
+    // the lowest bytes free, a one byte array takes a single byte of a shared word and larger arrays take fresh bytes on top
+    std::sort(order.begin(), order.end(), [](const Lifetime& a, const Lifetime& b) {
+        return a.start != b.start ? a.start < b.start : a.offset < b.offset;
+    });
+    using Heap = std::priority_queue<int, vector<int>, std::greater<int>>;
+    Heap free_words, free_bytes;
+    // the end and index in order of the slots taking bytes
+    std::priority_queue<std::pair<int, size_t>, vector<std::pair<int, size_t>>, std::greater<std::pair<int, size_t>>> live;
+    int top = 0;
+    auto release = [&](int begin, int end) {
+        for (int byte = begin; byte < end; )
+        {
+            if (byte % stack_alignment == 0 && byte + stack_alignment <= end)
+            {
+                free_words.push(byte);
+                byte += stack_alignment;
+            }
+            else
+                free_bytes.push(byte++);
+        }
+    };
+    auto take = [&](Heap& heap) {
+        int byte = heap.top();
+        heap.pop();
+        return byte;
+    };
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        Lifetime& lifetime = order[i];
+        for (; !live.empty() && live.top().first < lifetime.start; live.pop())
+        {
+            const Lifetime& ended = order[live.top().second];
+            release(ended.begin, ended.begin + frame_slots[ended.offset].width);
+        }
+
+        const FrameSlot& slot = frame_slots[lifetime.offset];
+        int begin;
+        if (slot.width == 1)
+        {
+            if (free_bytes.empty())
+            {
+                int word = free_words.empty() ? (top += stack_alignment) - stack_alignment : take(free_words);
+                for (int byte = word; byte < word + stack_alignment; byte++)
+                    free_bytes.push(byte);
+            }
+            begin = take(free_bytes);
+        }
+        else if (slot.width == stack_alignment && !free_words.empty())
+            begin = take(free_words);
+        else
+        {
+            begin = top;
+            top += (slot.width + stack_alignment - 1) / stack_alignment * stack_alignment;
+            release(begin + slot.width, top);
+        }
+        lifetime.begin = begin;
+        live.emplace(lifetime.end, i);
+    }
+
+    // like the offsets relocated against the top, the frame takes the lowest word of the caller
+    // and leaves its own to the callees
+    frame_layout.clear();
+    for (auto& lifetime : order)
+        frame_layout[lifetime.offset] = lifetime.begin + stack_alignment;
+    stack_depth = top;
+}
+
 shared_ptr<Symbol> FunctionContext::operator[](const string& name) const
 {
-    auto it = std::find_if(symbols.begin(), symbols.end(), [&name](auto s) { return s->name == name; });
-    if (it != symbols.end())
-        return *it;
+    if (auto symbol = symbols.FindInScope(name, 0))
+        return symbol;
     return global_context[name];
 }
 
 void LocalContext::DeclareVariable(const string& name, shared_ptr<SymbolType> type, const Location& loc)
 {
-    if (std::find_if(symbols.begin(), symbols.end(),
-        [&name](auto s) { return s->name == name; }) != symbols.end())
+    Identifier identifier(name);
+    auto& table = function_context.symbols;
+    if (table.FindInScope(identifier, scope))
         throw CompileError(loc, "redeclaration of local variable \"" + name + "\"");
 
     if (previous_context == nullptr)
         // also look in function paramters
-        if (std::find_if(function_context.symbols.begin(), function_context.symbols.end(),
-            [&name](auto s) { return s->name == name; }) != function_context.symbols.end())
+        if (table.FindInScope(identifier, 0))
             throw CompileError(loc, "redeclaration of local variable \"" + name + "\"");
 
-    if (std::find_if(referenced_symbols.begin(), referenced_symbols.end(),
-        [&name](auto s) { return s->name == name; }) != referenced_symbols.end())
+    if (table.Referenced(identifier, scope))
         throw CompileError(loc, "variable \"" + name + "\" is referenced before declaration");
+    if (auto counters = global_context.options.counters)
+        counters->symbols++;
 
     int stack_offset = CumulativeDepth() +
         type->AllignedWidth(function_context.stack_alignment) - function_context.stack_alignment;
-    symbols.push_back(std::make_shared<VariableSymbol>(name, type, stack_offset, function_context.stack_depth, loc));
+    auto symbol = std::make_shared<VariableSymbol>(name, type, stack_offset, loc);
+    function_context.AddSlot(stack_offset, *type);
+    table.Declare(identifier, symbol, scope);
 
     context_depth += type->AllignedWidth(function_context.stack_alignment);
     UpdateStackDepth();
@@ -256,28 +665,68 @@ void LocalContext::DeclareVariable(const string& name, shared_ptr<SymbolType> ty
 
 shared_ptr<Symbol> LocalContext::operator[](const string& name)
 {
-    shared_ptr<Symbol> result;
-    auto it = std::find_if(symbols.begin(), symbols.end(), [&name](auto s) { return s->name == name; });
-    if (it != symbols.end())
-        result = *it;
-    else if (previous_context != nullptr)
-        result = (*previous_context)[name];
-    else
-        result = function_context[name];
-    referenced_symbols.insert(result);
-    return result;
+    if (inlined != nullptr)
+    {
+        if (auto symbol = function_context.symbols.FindInScope(name, scope))
+            return symbol;
+        auto symbol = std::dynamic_pointer_cast<GlobalSymbol>(global_context[name]);
+        if (symbol != nullptr && symbol->order <= inlined->order)
+            return symbol;
+        return nullptr;
+    }
+    if (auto symbol = function_context.symbols.Find(name, scope))
+        return symbol;
+    return function_context.global_context[name];
 }
 
-shared_ptr<VariableSymbol> ExpressionContext::NewTemp(shared_ptr<SymbolType> type, const Location& loc)
+shared_ptr<VariableSymbol> ExpressionContext::TempSlot(size_t index, shared_ptr<SymbolType> type, const Location& loc)
 {
-    int stack_offset = local_context.CumulativeDepth() + context_depth;
-    auto temp = std::make_shared<VariableSymbol>("", type, stack_offset,
-        local_context.function_context.stack_depth, loc);
+    int stack_offset = local_context.CumulativeDepth() + index * local_context.function_context.stack_alignment;
+    local_context.function_context.AddSlot(stack_offset, *int_type, false);
+    return std::make_shared<VariableSymbol>("", type, stack_offset, loc);
+}
 
-    context_depth += local_context.function_context.stack_alignment;
+shared_ptr<Symbol> ExpressionContext::NewTemp(shared_ptr<SymbolType> type, const Location& loc)
+{
+    if (auto counters = local_context.global_context.options.counters)
+        counters->temps++;
+    FunctionContext& fctx = local_context.function_context;
+    size_t index = context_depth / fctx.stack_alignment;
+    auto slot = TempSlot(index, type, loc);
+
+    // every temporary keeps its stack slot, registers are saved there across calls
+    context_depth += fctx.stack_alignment;
     local_context.UpdateStackDepth(context_depth);
 
-    return temp;
+    if (index >= fctx.temp_registers.size() - fctx.pointer_registers)
+        return slot;
+
+    const string& reg = fctx.temp_registers[index];
+    if (!fctx.IsCallerSaved(reg))
+        fctx.saved_registers.insert(reg);
+    return std::make_shared<RegisterSymbol>(reg, type, loc);
 }
 
+Code ExpressionContext::SaveLiveTemps(const Location& loc)
+{
+    FunctionContext& fctx = local_context.function_context;
+    size_t live = std::min(context_depth / fctx.stack_alignment, int(fctx.temp_registers.size()));
+
+    Code code;
+    for (size_t i = 0; i < live; i++)
+        if (fctx.IsCallerSaved(fctx.temp_registers[i]))
+            code += TempSlot(i, int_type, loc)->SaveValue(fctx.temp_registers[i]);
+    return code;
+}
 
+Code ExpressionContext::RestoreLiveTemps(const Location& loc)
+{
+    FunctionContext& fctx = local_context.function_context;
+    size_t live = std::min(context_depth / fctx.stack_alignment, int(fctx.temp_registers.size()));
+
+    Code code;
+    for (size_t i = 0; i < live; i++)
+        if (fctx.IsCallerSaved(fctx.temp_registers[i]))
+            code += TempSlot(i, int_type, loc)->LoadValue(fctx.temp_registers[i]);
+    return code;
+}
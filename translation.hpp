@@ -5,22 +5,81 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <cassert>
-#include <variant>
 #include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
 
 using std::string, std::vector, std::map, std::set;
-using std::shared_ptr, std::variant, std::function;
+using std::shared_ptr, std::function;
 
 #include "location.hpp"
 using Location = yy::location;
 
+// a location packed into 12 bytes for the nodes of the tree, the file is an index into a table of
+// all file names, a position from line 2^20 - 1 or column 2^12 - 1 on does not fit and comes back
+// as line and column 0, which diagnostics show as unknown instead of pointing at the wrong place
+class SourceSpan
+{
+public:
+    SourceSpan(const Location& loc)
+        : begin(Pack(loc.begin)), end(Pack(loc.end)), file(FileIndex(loc.begin.filename)) {}
+
+    operator Location() const
+    {
+        auto filename = FileName(file);
+        return Location(Unpack(begin, filename), Unpack(end, filename));
+    }
+
+    friend Location operator+(const SourceSpan& left, const SourceSpan& right) { return Location(left) + right; }
+    friend Location operator+(const Location& left, const SourceSpan& right) { return left + Location(right); }
+    friend Location operator+(const SourceSpan& left, const Location& right) { return Location(left) + right; }
+
+private:
+    static constexpr int column_bits = 12;
+    static constexpr uint32_t max_line = (1u << (32 - column_bits)) - 1, max_column = (1u << column_bits) - 1;
+
+    uint32_t begin, end;
+    uint16_t file;
+
+    static uint32_t Pack(const yy::position& position)
+    {
+        if (uint32_t(position.line) >= max_line || uint32_t(position.column) >= max_column)
+            return max_line << column_bits | max_column;
+        return uint32_t(position.line) << column_bits | uint32_t(position.column);
+    }
+
+    static yy::position Unpack(uint32_t packed, const string* filename)
+    {
+        if (packed >> column_bits == max_line)
+            return yy::position(filename, 0, 0);
+        return yy::position(filename, packed >> column_bits, packed & max_column);
+    }
 
+    static uint16_t FileIndex(const string* filename);
+    static const string* FileName(uint16_t index);
+};
+
+#include "ir.hpp"
+#include "peephole.hpp"
+
+
+// types are interned, two types are equal only if they are the same object
 class SymbolType
 {
 public:
+    enum class Kind { Void, Int, Char, Array, Pointer };
+
+    SymbolType(Kind kind) : kind(kind) {}
+    SymbolType(const SymbolType&) = delete;
     virtual ~SymbolType() {}
+
+    const Kind kind;
+
     virtual string Name() const = 0;
     virtual size_t Width() const = 0;
     virtual size_t AllignedWidth(int alignment = 4) const
@@ -29,106 +88,87 @@ public:
         return (((Width() - 1) / alignment) + 1) * alignment;
     };
 
-    virtual bool CompatibleWith(shared_ptr<SymbolType> other) const = 0;
-    virtual bool operator==(const SymbolType& other) const = 0;
+    bool IsValue() const { return kind == Kind::Int || kind == Kind::Char; }
+
+    virtual bool CompatibleWith(const SymbolType& other) const = 0;
+
+    bool operator==(const SymbolType& other) const { return this == &other; }
+    bool operator!=(const SymbolType& other) const { return this != &other; }
 };
 
 class VoidType : public SymbolType
 {
 public:
+    VoidType() : SymbolType(Kind::Void) {}
+
     virtual string Name() const { return "void"; }
     virtual size_t Width() const { return 0; }
 
-    virtual bool CompatibleWith(shared_ptr<SymbolType> other) const
+    virtual bool CompatibleWith(const SymbolType& other) const
     {
-        return *this == *other;
-    }
-
-    virtual bool operator==(const SymbolType& other) const
-    {
-        if (dynamic_cast<const VoidType*>(&other))
-            return true;
-        return false;
+        return *this == other;
     }
 };
 
 class ValueType : public SymbolType
 {
 public:
-    virtual string Allocation(int value) const = 0;
-    virtual string Allocation() const { return ".space " + std::to_string(Width()); }
+    ValueType(Kind kind) : SymbolType(kind) {}
+
+    virtual Instruction Allocation(int value) const = 0;
+    virtual Instruction Allocation() const { return Instruction::Directive(".space", { int(Width()) }); }
 
-    virtual bool CompatibleWith(shared_ptr<SymbolType> other) const
+    virtual bool CompatibleWith(const SymbolType& other) const
     {
-        if (std::dynamic_pointer_cast<ValueType>(other))
-            return true;
-        return false;
+        return other.IsValue();
     }
 };
 
 class IntType : public ValueType
 {
 public:
+    IntType() : ValueType(Kind::Int) {}
+
     virtual string Name() const { return "int"; }
     virtual size_t Width() const { return 4; }
-    virtual string Allocation(int value) const { return ".word " + std::to_string(value); }
-
-    virtual bool operator==(const SymbolType& other) const
-    {
-        if (dynamic_cast<const IntType*>(&other))
-            return true;
-        return false;
-    }
+    virtual Instruction Allocation(int value) const { return Instruction::Directive(".word", { value }); }
 };
 
 class CharType : public ValueType
 {
 public:
+    CharType() : ValueType(Kind::Char) {}
+
     virtual string Name() const { return "char"; }
     virtual size_t Width() const { return 1; }
-    virtual string Allocation(int value) const
-    {
-        if (isprint(value) && value != '\\' && value != '\'')
-            return ".byte " + std::to_string((char)value);
-        return ".byte " + std::to_string(value);
-    }
-
-    virtual bool operator==(const SymbolType& other) const
-    {
-        if (dynamic_cast<const CharType*>(&other))
-            return true;
-        return false;
-    }
+    virtual Instruction Allocation(int value) const { return Instruction::Directive(".byte", { value }); }
 };
 
 class ArrayType : public SymbolType
 {
 public:
-    ArrayType(shared_ptr<ValueType> underlying_type, size_t size)
-        : underlying_type(underlying_type), size(size)
-    {
-        assert(size > 0);
-    }
+    // the one array type of size elements of underlying_type
+    static shared_ptr<ArrayType> Get(shared_ptr<ValueType> underlying_type, size_t size);
 
     virtual size_t Width() const { return underlying_type->Width() * size; }
     virtual string Name() const { return underlying_type->Name() + "[" + std::to_string(size) + "]"; }
-    virtual string Allocation() const { return ".space " + std::to_string(Width()); }
-    virtual string Allocation(const string& literal) const { return ".asciiz \"" + literal + "\""; }
+    virtual Instruction Allocation() const { return Instruction::Directive(".space", { int(Width()) }); }
+    virtual Instruction Allocation(const string& literal) const { return Instruction::Directive(".asciiz", { Operand::String(literal) }); }
 
-    virtual bool CompatibleWith(shared_ptr<SymbolType> other) const
+    virtual bool CompatibleWith(const SymbolType& other) const
     {
-        return *this == *other;
+        return *this == other;
     }
 
-    virtual bool operator==(const SymbolType& other) const
+    const shared_ptr<ValueType> underlying_type;
+    const size_t size;
+
+private:
+    ArrayType(shared_ptr<ValueType> underlying_type, size_t size)
+        : SymbolType(Kind::Array), underlying_type(underlying_type), size(size)
     {
-        if (auto array = dynamic_cast<const ArrayType*>(&other))
-            return underlying_type == array->underlying_type && size == array->size;
-        return false;
+        assert(size > 0);
     }
-
-    shared_ptr<ValueType> underlying_type;
-    size_t size;
 };
 
 // only usable for function parameters for now
@@ -136,30 +176,20 @@ class PointerType : public SymbolType
 {
 private:
     size_t pointer_width = 4;
-public:
+
     PointerType(shared_ptr<ValueType> underlying_type)
-        : underlying_type(underlying_type) {}
+        : SymbolType(Kind::Pointer), underlying_type(underlying_type) {}
+
+public:
+    // the one pointer type to underlying_type
+    static shared_ptr<PointerType> Get(shared_ptr<ValueType> underlying_type);
 
     virtual size_t Width() const { return pointer_width; }
     virtual string Name() const { return underlying_type->Name() + "*"; }
 
-    virtual bool CompatibleWith(shared_ptr<SymbolType> other) const
-    {
-        if (*this == *other)
-            return true;
-        if (auto array = std::dynamic_pointer_cast<ArrayType>(other))
-            return underlying_type->Width() == array->underlying_type->Width();
-        return false;
-    }
-    
-    virtual bool operator==(const SymbolType& other) const
-    {
-        if (auto pointer = dynamic_cast<const PointerType*>(&other))
-            return underlying_type == pointer->underlying_type;
-        return false;
-    }
+    virtual bool CompatibleWith(const SymbolType& other) const;
 
-    shared_ptr<ValueType> underlying_type;
+    const shared_ptr<ValueType> underlying_type;
 };
 
 
@@ -167,32 +197,33 @@ public:
 inline const std::shared_ptr<VoidType> void_type = std::make_shared<VoidType>();
 inline const std::shared_ptr<CharType> char_type = std::make_shared<CharType>();
 inline const std::shared_ptr<IntType> int_type = std::make_shared<IntType>();
-inline const std::shared_ptr<PointerType> char_pointer_type = std::make_shared<PointerType>(char_type);
-inline const std::shared_ptr<PointerType> int_pointer_type = std::make_shared<PointerType>(int_type);
+inline const std::shared_ptr<PointerType> char_pointer_type = PointerType::Get(char_type);
+inline const std::shared_ptr<PointerType> int_pointer_type = PointerType::Get(int_type);
 
-inline bool is_value_type(std::shared_ptr<SymbolType> type)
+// the checks take the type by reference and compare its tag, so they cost no refcounting or RTTI
+inline bool is_value_type(const std::shared_ptr<SymbolType>& type)
 {
-    return std::dynamic_pointer_cast<ValueType>(type) != nullptr;
+    return type->IsValue();
 }
 
-inline bool is_array_type(std::shared_ptr<SymbolType> type)
+inline bool is_array_type(const std::shared_ptr<SymbolType>& type)
 {
-    return std::dynamic_pointer_cast<ArrayType>(type) != nullptr;
+    return type->kind == SymbolType::Kind::Array;
 }
 
-inline bool is_pointer_type(std::shared_ptr<SymbolType> type)
+inline bool is_pointer_type(const std::shared_ptr<SymbolType>& type)
 {
-    return std::dynamic_pointer_cast<PointerType>(type) != nullptr;
+    return type->kind == SymbolType::Kind::Pointer;
 }
 
-inline std::shared_ptr<ArrayType> as_array_type(std::shared_ptr<SymbolType> type)
+inline const ArrayType* as_array_type(const std::shared_ptr<SymbolType>& type)
 {
-    return std::dynamic_pointer_cast<ArrayType>(type);
+    return is_array_type(type) ? static_cast<const ArrayType*>(type.get()) : nullptr;
 }
 
-inline std::shared_ptr<PointerType> as_pointer_type(std::shared_ptr<SymbolType> type)
+inline const PointerType* as_pointer_type(const std::shared_ptr<SymbolType>& type)
 {
-    return std::dynamic_pointer_cast<PointerType>(type);
+    return is_pointer_type(type) ? static_cast<const PointerType*>(type.get()) : nullptr;
 }
 
 
@@ -209,58 +240,7 @@ public:
 };
 
 
-class Code
-{
-private:
-    vector<variant<shared_ptr<string>, function<string()>>> lines;
-public:
-    Code() {}
-
-    Code(const char* str)
-    {
-        lines.push_back(std::make_shared<string>(str));
-    }
-
-    Code(const string& str)
-    {
-        lines.push_back(std::make_shared<string>(str));
-    }
-    
-    Code(const function<string()>& func)
-    {
-        lines.push_back(func);
-    }
-
-    friend Code& operator+=(Code& left, const Code& right);
-    friend Code operator+(Code left, const Code& right);
-    friend std::ostream& operator<<(std::ostream& out, const Code& code);
-};
-
-inline Code& operator+=(Code& left, const Code& right)
-{
-    left.lines.insert(left.lines.end(), right.lines.begin(), right.lines.end());
-    return left;
-}
-
-inline Code operator+(Code left, const Code& right)
-{
-    return left += right;
-}
-
-inline std::ostream& operator<<(std::ostream& out, const Code& code)
-{
-    for (auto v : code.lines)
-    {
-        if (v.index() == 0) // string
-            out << *std::get<shared_ptr<string>>(v);
-        else // function
-            out << std::get<function<string()>>(v)();
-    }
-    return out;
-}
-
 inline const size_t indent_length = 2;
-inline const string& tab = "    ";
 
 
 class Symbol
@@ -281,6 +261,12 @@ public:
     virtual Code LoadElementValue(const string& index_reg, const string& dest_reg) = 0;
     virtual Code SaveElementValue(const string& index_reg, const string& source_reg) = 0;
 
+    // the register holding the value of this symbol, empty if it lives in memory
+    virtual string Register() { return ""; }
+
+    // whether this symbol is a compile-time constant, and its value
+    virtual bool Constant(int& value) { return false; }
+
 protected:
     string ReadableName()
     {
@@ -296,6 +282,9 @@ class GlobalSymbol : public Symbol
 public:
     GlobalSymbol(const string& name, shared_ptr<SymbolType> type, const Location& loc)
         : Symbol(name, type, loc) {}
+
+    // the position of the declaration, a definition sees the globals declared up to it
+    size_t order = 0;
         
     virtual Code LoadAddress(const string& reg);
 };
@@ -317,14 +306,23 @@ public:
 };
 
 
+class FunctionDefinition;
+
 class FunctionSymbol : public GlobalSymbol
 {
 public:
     FunctionSymbol(const string& name, shared_ptr<SymbolType> type,
-        vector<shared_ptr<SymbolType>> param_types, const Location& loc)
-        : GlobalSymbol(name, type, loc), param_types(param_types) {}
+        vector<shared_ptr<SymbolType>> param_types, const Location& loc, bool builtin = false)
+        : GlobalSymbol(name, type, loc), param_types(param_types), builtin(builtin) {}
 
     vector<shared_ptr<SymbolType>> param_types;
+
+    // builtins only touch $v0, the argument registers, hi and lo (print_int of the buffered runtime divides),
+    // so temporaries survive calls to them, values kept in hi or lo do not
+    bool builtin;
+
+    // calls are replaced by the expression this definition returns, nullptr if they jump to it
+    FunctionDefinition* inlined = nullptr;
         
     virtual Code LoadValue(const string& reg)
     {
@@ -351,12 +349,11 @@ public:
 class VariableSymbol : public Symbol
 {
 public:
-    VariableSymbol(const string& name, shared_ptr<SymbolType> type, int offset,
-        shared_ptr<int> stack_depth, const Location& loc)
-        : Symbol(name, type, loc), offset(offset), stack_depth(stack_depth) {}
+    VariableSymbol(const string& name, shared_ptr<SymbolType> type, int offset, const Location& loc)
+        : Symbol(name, type, loc), offset(offset) {}
 
+    // counted down from the top of the frame, see FunctionContext::LayoutFrame
     int offset;
-    shared_ptr<int> stack_depth;
     
     virtual Code LoadValue(const string& reg);
 
@@ -369,15 +366,86 @@ public:
     virtual Code SaveElementValue(const string& index_reg, const string& source_reg);
 
 private:
-    Code StackOffset()
+    Operand StackOffset()
     {
-        auto stack_depth = this->stack_depth;
-        int offset = this->offset;
-        return Code([stack_depth, offset]() { return std::to_string(*stack_depth - offset); });
+        return Operand::StackOffset(offset);
     }
 };
 
 
+// a compile-time constant, materialized only where a register is needed
+class ConstantSymbol : public Symbol
+{
+public:
+    ConstantSymbol(int value, shared_ptr<SymbolType> type, const Location& loc)
+        : Symbol("", type, loc), value(value) {}
+
+    int value;
+
+    virtual bool Constant(int& result)
+    {
+        result = value;
+        return true;
+    }
+
+    virtual Code LoadValue(const string& reg)
+    {
+        return Instruction(Opcode::Li, reg, value);
+    }
+
+    virtual Code SaveValue(const string& reg)
+    {
+        throw CompileError(location, ReadableName() + " is not assignable");
+    }
+
+    virtual Code LoadAddress(const string& reg)
+    {
+        throw CompileError(location, ReadableName() + " is not addressable");
+    }
+
+    virtual Code LoadElementValue(const string& index_reg, const string& dest_reg)
+    {
+        throw CompileError(location, ReadableName() + " is not a indexable");
+    }
+
+    virtual Code SaveElementValue(const string& index_reg, const string& source_reg)
+    {
+        throw CompileError(location, ReadableName() + " is not a indexable");
+    }
+};
+
+
+// a temporary value or a parameter held in a register
+class RegisterSymbol : public Symbol
+{
+public:
+    RegisterSymbol(const string& register_name, shared_ptr<SymbolType> type, const Location& loc,
+        const string& name = "")
+        : Symbol(name, type, loc), register_name(register_name) {}
+
+    string register_name;
+
+    virtual string Register() { return register_name; }
+
+    virtual Code LoadValue(const string& reg);
+
+    virtual Code SaveValue(const string& reg);
+
+    virtual Code LoadAddress(const string& reg)
+    {
+        throw CompileError(location, ReadableName() + " is not addressable");
+    }
+
+    // only pointers can be indexed, arrays always live in memory
+    virtual Code LoadElementValue(const string& index_reg, const string& dest_reg);
+
+    virtual Code SaveElementValue(const string& index_reg, const string& source_reg);
+
+private:
+    Code ElementAddress(const string& index_reg);
+};
+
+
 class VoidSymbol : public Symbol
 {
 public:
@@ -398,26 +466,162 @@ private:
 };
 
 
+// an interned name, equal names share one string so they compare and hash by address
+class Identifier
+{
+public:
+    Identifier(const string& name);
+
+    const string& Name() const { return *name; }
+
+    bool operator==(const Identifier& other) const { return name == other.name; }
+
+    struct Hash
+    {
+        size_t operator()(const Identifier& identifier) const { return std::hash<const string*>()(identifier.name); }
+    };
+
+private:
+    const string* name;
+};
+
+
+// symbols of nested scopes, the outermost scope 0 holds the function parameters
+class SymbolTable
+{
+public:
+    SymbolTable() { PushScope(); }
+
+    // open a new innermost scope and return its depth
+    size_t PushScope();
+
+    // close the innermost scope and forget its symbols
+    void PopScope();
+
+    size_t Depth() const { return scopes.size() - 1; }
+
+    void Declare(const Identifier& name, shared_ptr<Symbol> symbol, size_t scope);
+
+    // the symbol declared in exactly this scope, nullptr if there is none
+    shared_ptr<Symbol> FindInScope(const Identifier& name, size_t scope) const;
+
+    // the innermost symbol visible from scope, nullptr if there is none,
+    // the scopes the name is looked up in before it is found remember the reference
+    shared_ptr<Symbol> Find(const Identifier& name, size_t scope);
+
+    // whether name was looked up in scope before it is declared there
+    bool Referenced(const Identifier& name, size_t scope) const;
+
+private:
+    struct Binding
+    {
+        size_t scope;
+        shared_ptr<Symbol> symbol;
+    };
+
+    struct Scope
+    {
+        vector<Identifier> declared;
+        std::unordered_set<Identifier, Identifier::Hash> referenced;
+    };
+
+    // the bindings of each name, sorted from the outermost to the innermost scope
+    std::unordered_map<Identifier, vector<Binding>, Identifier::Hash> bindings;
+    vector<Scope> scopes;
+};
+
+
+// what compiling made, counted for the time report by every thread compiling definitions
+struct CompileCounters
+{
+    std::atomic<size_t> symbols = 0;
+    std::atomic<size_t> temps = 0;
+    std::atomic<size_t> labels = 0;
+};
+
+
+// switches changing how a program is translated
+struct CompileOptions
+{
+    // check array bounds once before a counting loop instead of on every access,
+    // reports the error before the loop runs even if the access is never reached
+    bool hoist_bounds_checks = false;
+
+    // turn calls in return statements into jumps that reuse the frame of the caller
+    bool tail_calls = true;
+
+    // rewrites run on the generated code before it is written
+    PeepholeOptions peephole;
+
+    // leave out the functions, globals and builtins main does not refer to, directly or not
+    bool remove_unreferenced = true;
+
+    // link the builtins writing output through a buffer, flushed when it fills up, before reading
+    // and on exit, instead of a syscall per print, the output of a program stopped early may be lost
+    bool buffered_output = false;
+
+    // functions returning an expression of at most this many nodes are inlined, 0 for none,
+    // see Program::InlineCalls
+    size_t inline_limit = 16;
+
+    // share frame slots between locals and temporaries that are never live at once,
+    // see FunctionContext::AllocateFrame
+    bool pack_frames = true;
+
+    // threads compiling function bodies, 0 for one per core
+    size_t jobs = 0;
+
+    // directory keeping the generated code of functions between runs, empty for none
+    string cache_directory;
+
+    // where to count what compiling makes, nullptr to not count
+    CompileCounters* counters = nullptr;
+};
+
+
 class GlobalContext
 {
 public:
-    string current_section = "code";
+    CompileOptions options;
 
+    // globals are declared one by one in source order, before any definition is compiled
     shared_ptr<FieldSymbol> DeclareField(const FieldSymbol& field);
 
     shared_ptr<FunctionSymbol> DeclareFunction(const FunctionSymbol& function);
 
+    // builtins are shared by all compilations and visible to every definition
+    void DeclareBuiltin(shared_ptr<FunctionSymbol> function);
+
+    // only the globals declared up to the definition being compiled are visible
     shared_ptr<Symbol> operator[](const string& name) const;
 
+    // a context of its own for compiling a definition, sharing the declared globals,
+    // so definitions can be compiled in parallel
+    GlobalContext ForDefinition(shared_ptr<GlobalSymbol> symbol) const;
+
+    // labels are numbered per definition and prefixed by its name, e.g. $f_L12
     string NewLabel()
     {
-        static size_t i = 0;
-        return "$L" + std::to_string(++i);
+        if (options.counters != nullptr)
+            options.counters->labels++;
+        return label_prefix + std::to_string(++labels);
     }
 
     function<void(const Location&, const string&, const string&)> printer;
 
-    map<string, shared_ptr<GlobalSymbol>> symbols;
+    // the global being defined, nullptr while declaring
+    shared_ptr<GlobalSymbol> definition;
+
+    // jump tables of the function being compiled
+    vector<JumpTable> jump_tables;
+
+private:
+    shared_ptr<std::unordered_map<Identifier, shared_ptr<GlobalSymbol>, Identifier::Hash>> symbols =
+        std::make_shared<std::unordered_map<Identifier, shared_ptr<GlobalSymbol>, Identifier::Hash>>();
+    size_t declarations = 0;
+
+    string label_prefix = "$L";
+    size_t labels = 0;
 };
 
 
@@ -428,40 +632,132 @@ public:
         : global_context(global_context), function_symbol(symbol),
         epilouge_label("$" + symbol.name + "_epilouge") {}
 
-    void DeclareParameter(const string& name, shared_ptr<SymbolType> type, const Location& loc);
+    // the parameter is kept in reg if given, otherwise it is stored in the frame
+    void DeclareParameter(const string& name, shared_ptr<SymbolType> type, const Location& loc,
+        const string& reg = "");
 
     shared_ptr<Symbol> operator[](const string& name) const;
 
     void UpdateStackDepth(int depth = 0)
     {
-        *stack_depth = std::max(*stack_depth, context_depth + depth);
+        stack_depth = std::max(stack_depth, context_depth + depth);
     }
 
+    // patch the stack offsets in the code of the function now that the frame size is final
+    void LayoutFrame(Code& code) const;
+
+    // reserve a slot on top of the frame once the body is compiled (e.g. for saved registers)
+    shared_ptr<VariableSymbol> ReserveSlot(shared_ptr<SymbolType> type, const Location& loc);
+
+    // the bytes of the frame a symbol is given, pinned slots are kept for the whole function
+    struct FrameSlot
+    {
+        int width = 0;
+        int alignment = 1;
+        bool pinned = false;
+        bool parameter = false;
+    };
+
+    void AddSlot(int offset, const SymbolType& type, bool pinned = false, bool parameter = false);
+
+    // move the slots to the smallest frame in which no two slots live at once share a byte,
+    // must be called once the body is compiled and before the prologue is made
+    void AllocateFrame(const Code& body);
+
     GlobalContext& global_context;
     FunctionSymbol& function_symbol;
 
     string epilouge_label;
+    // where self tail calls jump to, empty if the function makes no tail calls
+    string recursion_label;
+    // labels of the epilogues ending in a jump to each tail callee
+    map<string, string> tail_calls;
 
     int context_depth = 0;
-    shared_ptr<int> stack_depth = std::make_shared<int>(0);
-    vector<shared_ptr<VariableSymbol>> symbols;
+    int stack_depth = 0;
+
+    // the slots by the offset their symbols were given, and where AllocateFrame moved them
+    // counted up from the bottom of the frame, empty if it did not run
+    map<int, FrameSlot> frame_slots;
+    map<int, int> frame_layout;
+
+    // parameters in scope 0, then the locals of the blocks being compiled
+    SymbolTable symbols;
+
+    // callee-saved registers holding temporaries, to be preserved by the prologue
+    set<string> saved_registers;
+
+    // the last temp_registers are taken by pointers stepping through arrays in loops, see LocalContext::element_pointers
+    size_t pointer_registers = 0;
+    static const size_t max_pointer_registers = 4;
 
     static const int stack_alignment = 4;
+
+    // registers used for temporaries in allocation order, $t0 is kept as a scratch register
+    static inline const vector<string> temp_registers = {
+        "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$t8", "$t9",
+        "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7"
+    };
+
+    static bool IsCallerSaved(const string& reg) { return reg.compare(0, 2, "$t") == 0; }
 };
 
 
+// code compiled only for its diagnostics and then thrown away, such as an untaken branch,
+// leaves behind none of what compiling it records outside of the code: jump tables,
+// epilogues of tail calls and callee-saved registers are put back as they were when the scope ends
+class DiscardedCode
+{
+public:
+    DiscardedCode(FunctionContext& function_context)
+        : function_context(function_context), jump_tables(function_context.global_context.jump_tables.size()),
+        tail_calls(function_context.tail_calls), saved_registers(function_context.saved_registers) {}
+    DiscardedCode(const DiscardedCode&) = delete;
+
+    ~DiscardedCode()
+    {
+        auto& tables = function_context.global_context.jump_tables;
+        tables.erase(tables.begin() + jump_tables, tables.end());
+        function_context.tail_calls = std::move(tail_calls);
+        function_context.saved_registers = std::move(saved_registers);
+    }
+
+private:
+    FunctionContext& function_context;
+    size_t jump_tables;
+    map<string, string> tail_calls;
+    set<string> saved_registers;
+};
+
 class LocalContext
 {
 public:
     LocalContext(FunctionContext& function_context)
         : previous_context(nullptr),
         function_context(function_context),
-        global_context(function_context.global_context) {}
+        global_context(function_context.global_context),
+        scope(function_context.symbols.PushScope()) {}
         
     LocalContext(LocalContext& previous_context)
         : previous_context(&previous_context),
         function_context(previous_context.function_context),
-        global_context(previous_context.global_context) {}
+        global_context(previous_context.global_context),
+        scope(function_context.symbols.PushScope()) {}
+
+    // the body of an inlined function, seeing only the parameters declared in it and the
+    // globals declared before the function, not the locals of the caller
+    LocalContext(LocalContext& previous_context, FunctionSymbol& inlined)
+        : LocalContext(previous_context)
+    {
+        this->inlined = &inlined;
+    }
+
+    // contexts are nested, so they are destroyed in the reverse order they are made
+    ~LocalContext()
+    {
+        assert(scope == function_context.symbols.Depth());
+        function_context.symbols.PopScope();
+    }
 
     void DeclareVariable(const string& name, shared_ptr<SymbolType> type, const Location& loc);
 
@@ -488,8 +784,11 @@ public:
     GlobalContext& global_context;
     
     int context_depth = 0;
-    vector<shared_ptr<VariableSymbol>> symbols;
-    set<shared_ptr<Symbol>> referenced_symbols;
+    // the scope of this context in the symbol table of the function
+    size_t scope;
+
+    // the function whose body is compiled in this context, nullptr if it is not inlined
+    FunctionSymbol* inlined = nullptr;
 
     string break_label;
     string LastBreakLabel()
@@ -510,6 +809,36 @@ public:
             return previous_context->LastContinueLabel();
         return "";
     }
+
+    // registers holding the address of array[counter] for loop counters, kept in step with the counter
+    map<std::pair<Symbol*, Symbol*>, string> element_pointers;
+    string ElementPointer(shared_ptr<Symbol> array, shared_ptr<Symbol> counter)
+    {
+        for (LocalContext* ctx = this; ctx != nullptr; ctx = ctx->previous_context)
+        {
+            auto it = ctx->element_pointers.find({ array.get(), counter.get() });
+            if (it != ctx->element_pointers.end())
+                return it->second;
+        }
+        return "";
+    }
+
+    // bounds of variables known to hold in this context (e.g. loop counters), used to skip bounds checks
+    map<shared_ptr<Symbol>, std::pair<int, int>> ranges;
+    bool KnownRange(shared_ptr<Symbol> symbol, int& low, int& high)
+    {
+        bool known = false;
+        for (LocalContext* ctx = this; ctx != nullptr; ctx = ctx->previous_context)
+        {
+            auto it = ctx->ranges.find(symbol);
+            if (it == ctx->ranges.end())
+                continue;
+            low = known ? std::max(low, it->second.first) : it->second.first;
+            high = known ? std::min(high, it->second.second) : it->second.second;
+            known = true;
+        }
+        return known;
+    }
 };
 
 
@@ -524,13 +853,21 @@ public:
 
     LocalContext& local_context;
     
-    shared_ptr<VariableSymbol> NewTemp(const Location& loc)
+    shared_ptr<Symbol> NewTemp(const Location& loc)
     {
-        return NewTemp(std::make_shared<IntType>(), loc);
+        return NewTemp(int_type, loc);
     }
 
-    shared_ptr<VariableSymbol> NewTemp(shared_ptr<SymbolType> type, const Location& loc);
+    // temporaries live in registers, spilling to the stack only when they run out
+    shared_ptr<Symbol> NewTemp(shared_ptr<SymbolType> type, const Location& loc);
+
+    // save and restore the live temporaries held in caller-saved registers around a call
+    Code SaveLiveTemps(const Location& loc);
+    Code RestoreLiveTemps(const Location& loc);
 
     int context_depth = 0;
+
+private:
+    shared_ptr<VariableSymbol> TempSlot(size_t index, shared_ptr<SymbolType> type, const Location& loc);
 };
 